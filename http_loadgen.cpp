@@ -0,0 +1,286 @@
+/**
+  HTTP load generator: hammers a web server with requests from
+  many connections, and reports throughput and latency percentiles.
+
+  Build with:
+	g++ -O2 http_loadgen.cpp webservice.cpp socket.cpp porthread.cpp \
+	    webserver.cpp webserver_threaded.cpp webserver_router.cpp \
+	    webserver_metrics.cpp webserver_admission.cpp webserver_http2.cpp \
+	    -lpthread -o http_loadgen
+
+  Run like:
+	http_loadgen -c 16 -d 10 http://localhost:8080/
+  or, to benchmark our own osl::http_threaded_server over loopback:
+	http_loadgen -c 16 -d 5 -self
+
+  Closed loop (the default): each connection sends its next request
+  as soon as the last reply arrives, so this measures peak throughput.
+
+  Open loop (-r rate): requests are scheduled at a fixed total rate,
+  like real independent users.  If the server stalls, requests that
+  should have been sent during the stall are charged the time they
+  spent waiting to be sent, so latency percentiles aren't fooled by
+  the stall holding back the load ("coordinated omission").
+*/
+#include "webservice.h"
+#include "webserver_threaded.h"
+#include "porthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <vector>
+#include <stdexcept>
+
+/**
+ Latency histogram with about 1% precision from 1 microsecond to
+ over an hour: 128 linear sub-buckets per power of two.
+ Each thread fills its own, and we add them up at the end.
+*/
+class loadgen_histogram {
+public:
+	enum {sub_bits=7, sub=1<<sub_bits, powers=32};
+	std::vector<long long> counts;
+	long long total;
+	double max_usec;
+	loadgen_histogram() :counts(sub*powers,0), total(0), max_usec(0) {}
+
+	static int bucket(long long usec) {
+		if (usec<sub) return (int)(usec<0?0:usec);
+		int e=0;
+		while ((usec>>e)>=2*sub) e++;
+		return (e+1)*sub+(int)((usec>>e)-sub);
+	}
+	/* Lower edge of this bucket, in microseconds */
+	static double bucket_usec(int b) {
+		if (b<sub) return b;
+		int e=b/sub-1;
+		return (double)((long long)(sub+b%sub)<<e);
+	}
+	void add(double seconds) {
+		long long usec=(long long)(seconds*1.0e6);
+		int b=bucket(usec);
+		if (b>=(int)counts.size()) b=counts.size()-1;
+		counts[b]++; total++;
+		if (usec>max_usec) max_usec=usec;
+	}
+	void add(const loadgen_histogram &h) {
+		for (unsigned int b=0;b<counts.size();b++) counts[b]+=h.counts[b];
+		total+=h.total;
+		if (h.max_usec>max_usec) max_usec=h.max_usec;
+	}
+	/* Return the latency at this percentile (0-100), in milliseconds */
+	double percentile(double pct) const {
+		long long want=(long long)ceil(total*pct*0.01);
+		if (want<1) want=1;
+		long long seen=0;
+		for (unsigned int b=0;b<counts.size();b++) {
+			seen+=counts[b];
+			if (seen>=want) return bucket_usec(b)*1.0e-3;
+		}
+		return max_usec*1.0e-3;
+	}
+};
+
+/* Settings shared by all the load threads */
+struct loadgen_config {
+	std::string host, path;
+	int port;
+	int connections;
+	double duration; /* seconds */
+	double rate; /* total requests per second, or 0 for closed loop */
+	bool keepalive;
+	double start; /* porthread_time() the run starts */
+};
+
+/* What one load thread saw */
+struct loadgen_thread {
+	const loadgen_config *cfg;
+	int index;
+	loadgen_histogram latency;
+	long long requests, errors, non2xx, bytes, connects;
+	long long missed; /* open loop: scheduled sends the run ended before we got to */
+};
+
+/* Socket errors abort the program by default; we'd rather count them. */
+static int loadgen_skt_abort(int code,const char *msg) {
+	throw std::runtime_error(msg);
+}
+
+/* Status reports from http_connection: we don't want them */
+static osl::network_progress loadgen_quiet;
+
+static void loadgen_run(void *ptr)
+{
+	loadgen_thread *t=(loadgen_thread *)ptr;
+	const loadgen_config &cfg=*t->cfg;
+	std::string request="GET "+cfg.path+" HTTP/1.1\r\n"
+		"Host: "+cfg.host+"\r\n"
+		"User-Agent: osl http_loadgen\r\n"+
+		(cfg.keepalive?"":"Connection: close\r\n")+
+		"\r\n";
+	double end=cfg.start+cfg.duration;
+	/* Open loop: this thread sends every interval seconds, offset from the others */
+	double interval=cfg.rate>0?cfg.connections/cfg.rate:0;
+	double next=cfg.start+interval*t->index/cfg.connections;
+
+	osl::http_connection *c=0;
+	bool reused=false;
+	while (true) {
+		double intended=porthread_time();
+		if (interval>0) { /* wait for our next scheduled send */
+			if (next>=end) break;
+			if (intended>=end) { /* server fell too far behind: count what we never sent */
+				t->missed+=(long long)ceil((end-next)/interval);
+				break;
+			}
+			while (intended<next) {
+				double wait=next-intended;
+				if (wait>0.002) porthread_yield((int)(wait*1000)-1);
+				intended=porthread_time();
+			}
+			intended=next; /* latency counts from when we *should* have sent */
+			next+=interval;
+		}
+		else if (intended>=end) break;
+
+		int tries=0;
+		while (true) {
+			try {
+				if (!c) {
+					c=new osl::http_connection(cfg.host,loadgen_quiet,cfg.port,10);
+					t->connects++;
+					reused=false;
+				}
+				int status=c->send(request);
+				std::string body=c->receive();
+				if (!cfg.keepalive || !c->keep_alive()) {
+					delete c; c=0;
+				}
+				else reused=true;
+				t->requests++;
+				t->bytes+=body.size();
+				if (status<200 || status>=300) t->non2xx++;
+				t->latency.add(porthread_time()-intended);
+				break;
+			} catch (std::exception &e) {
+				delete c; c=0;
+				if (reused && tries++==0) continue; /* server closed our idle connection: retry */
+				t->errors++;
+				break;
+			}
+		}
+	}
+	delete c;
+}
+
+/* A tiny fixed reply, for benchmarking the server itself */
+class loadgen_responder : public osl::http_responder {
+public:
+	std::string reply;
+	loadgen_responder(int size) :reply(size,'x') {}
+	bool respond(osl::http_served_client &client) {
+		client.send("text/plain",reply);
+		return true;
+	}
+};
+
+static void loadgen_usage(const char *prog) {
+	fprintf(stderr,"Usage: %s [options] <url>\n"
+		"  -c <n>      concurrent connections (default 10)\n"
+		"  -d <sec>    test duration in seconds (default 10)\n"
+		"  -r <rate>   open loop: send this many total requests per second\n"
+		"              (default: closed loop, as fast as replies come back)\n"
+		"  -close      open a new connection for every request\n"
+		"  -self [n]   instead of a URL, benchmark an in-process\n"
+		"              osl::http_threaded_server sending n byte replies (default 100)\n"
+		"  -max99 <ms> exit with status 1 if the 99th percentile latency exceeds this\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc,char *argv[])
+{
+	loadgen_config cfg;
+	cfg.connections=10;
+	cfg.duration=10;
+	cfg.rate=0;
+	cfg.keepalive=true;
+	std::string url;
+	int self_size=-1;
+	double max99=0;
+	for (int i=1;i<argc;i++) {
+		std::string a=argv[i];
+		bool more=(i+1<argc);
+		if (a=="-c" && more) cfg.connections=atoi(argv[++i]);
+		else if (a=="-d" && more) cfg.duration=atof(argv[++i]);
+		else if (a=="-r" && more) cfg.rate=atof(argv[++i]);
+		else if (a=="-close") cfg.keepalive=false;
+		else if (a=="-max99" && more) max99=atof(argv[++i]);
+		else if (a=="-self") {
+			self_size=100;
+			if (more && isdigit(argv[i+1][0])) self_size=atoi(argv[++i]);
+		}
+		else if (a[0]!='-') url=a;
+		else loadgen_usage(argv[0]);
+	}
+	if (cfg.connections<1 || cfg.duration<=0 || (url.size()==0 && self_size<0))
+		loadgen_usage(argv[0]);
+
+	skt_set_abort(loadgen_skt_abort);
+	if (self_size>=0) { /* serve ourselves, on a loopback port */
+		osl::http_threaded_server *server=new osl::http_threaded_server(0);
+		server->add_responder(new loadgen_responder(self_size));
+		server->start();
+		char buf[100];
+		sprintf(buf,"http://127.0.0.1:%d/",server->get_port());
+		url=buf;
+	}
+	osl::url_parser u(url);
+	cfg.host=u.host; cfg.port=u.port; cfg.path=u.path;
+	if (cfg.path.size()==0) cfg.path="/";
+
+	printf("%s: %d connections for %.1f s, %s%s\n",url.c_str(),cfg.connections,cfg.duration,
+		cfg.rate>0?"open loop":"closed loop",cfg.keepalive?", keep-alive":", new connection per request");
+	if (cfg.rate>0) printf("  target rate %.1f requests/s\n",cfg.rate);
+	fflush(stdout);
+
+	std::vector<loadgen_thread> threads(cfg.connections);
+	std::vector<porthread_t> tids(cfg.connections);
+	cfg.start=porthread_time()+0.05; /* let all the threads get going */
+	for (int i=0;i<cfg.connections;i++) {
+		loadgen_thread &t=threads[i];
+		t.cfg=&cfg; t.index=i;
+		t.requests=t.errors=t.non2xx=t.bytes=t.connects=t.missed=0;
+		tids[i]=porthread_create(loadgen_run,&t);
+	}
+	loadgen_histogram all;
+	long long requests=0, errors=0, non2xx=0, bytes=0, connects=0, missed=0;
+	for (int i=0;i<cfg.connections;i++) {
+		porthread_wait(tids[i]);
+		loadgen_thread &t=threads[i];
+		all.add(t.latency);
+		requests+=t.requests; errors+=t.errors; non2xx+=t.non2xx;
+		bytes+=t.bytes; connects+=t.connects; missed+=t.missed;
+	}
+	double elapsed=porthread_time()-cfg.start;
+
+	printf("  %lld requests in %.2f s: %.1f requests/s, %.2f MB/s\n",
+		requests,elapsed,requests/elapsed,bytes/elapsed*1.0e-6);
+	printf("  %lld connections opened, %lld errors, %lld non-2xx replies\n",connects,errors,non2xx);
+	if (missed>0) printf("  %lld scheduled requests never sent: server can't keep up with this rate\n",missed);
+	if (requests>0) {
+		printf("  latency%s (ms):\n",cfg.rate>0?", corrected for coordinated omission":"");
+		static const double pcts[]={50,90,99,99.9,99.99};
+		for (unsigned int p=0;p<sizeof(pcts)/sizeof(pcts[0]);p++)
+			printf("    p%-6g %10.3f\n",pcts[p],all.percentile(pcts[p]));
+		printf("    max     %10.3f\n",all.max_usec*1.0e-3);
+	}
+	if (errors>0 || missed>0 || requests==0) return 1;
+	if (max99>0 && all.percentile(99)>max99) {
+		printf("  FAILED: p99 latency above %g ms\n",max99);
+		return 1;
+	}
+	return 0;
+}
@@ -62,6 +62,14 @@ void porthread_yield(int msec) {
 	Sleep(msec);
 }
 
+double porthread_time(void) {
+	static LARGE_INTEGER freq={0};
+	LARGE_INTEGER t;
+	if (freq.QuadPart==0) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return t.QuadPart/(double)freq.QuadPart;
+}
+
 #else 
 /******* System Specifics: (non-windows) POSIX thread *******/
 #include <pthread.h>
@@ -107,5 +115,12 @@ void porthread_yield(int msec) {
 	usleep(msec*1000);
 }
 
+#include <time.h> /* for clock_gettime */
+double porthread_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+1.0e-9*ts.tv_nsec;
+}
+
 
 #endif
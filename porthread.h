@@ -34,6 +34,13 @@ void porthread_detach(porthread_t p);
  */
 void porthread_yield(int msec);
 
+/**
+ * Return a steadily increasing time, in seconds.
+ * The zero point is arbitrary, so this is only useful
+ * for measuring intervals and timeouts.
+ */
+double porthread_time(void);
+
 /**************** Locks ***************
 	From Hovik Melikyan's http://www.melikyan.com/ptypes/ 
 	(pasync.h)
@@ -44,6 +51,7 @@ void porthread_yield(int msec);
 class porlock
 {
 protected:
+	friend class porcond;
 	CRITICAL_SECTION critsec;
 public:
 	inline porlock()	{ InitializeCriticalSection(&critsec); }
@@ -59,6 +67,7 @@ public:
 class porlock
 {
 protected:
+	friend class porcond;
 	pthread_mutex_t mtx;
 public:
 	inline porlock()	{ pthread_mutex_init(&mtx, 0); }
@@ -69,6 +78,84 @@ public:
 
 #endif
 
+/**************** Condition Variables ***************
+  A porcond lets threads sleep until another thread signals them.
+  You must hold the porlock while calling wait, which atomically
+  releases the lock while sleeping, and relocks it before returning.
+  The timed version of wait returns false if msec elapse with no signal.
+  As with all condition variables, wakeups can be spurious, so 
+  always re-check your condition in a loop:
+	porlock_scoped l(&lock);
+	while (!ready) cond.wait(&lock);
+*/
+#ifdef _WIN32 /* Windows implementation */
+class porcond
+{
+protected:
+	CONDITION_VARIABLE cv;
+public:
+	inline porcond()	{ InitializeConditionVariable(&cv); }
+	inline void wait(porlock *l)	{ SleepConditionVariableCS(&cv,&l->critsec,INFINITE); }
+	inline bool wait(porlock *l,int msec)	
+		{ return 0!=SleepConditionVariableCS(&cv,&l->critsec,msec); }
+	inline void signal()	{ WakeConditionVariable(&cv); }
+	inline void broadcast()	{ WakeAllConditionVariable(&cv); }
+};
+
+#else /* Portable UNIX pthread version */
+#include <sys/time.h> /* for gettimeofday */
+class porcond
+{
+protected:
+	pthread_cond_t cv;
+public:
+	inline porcond()	{ pthread_cond_init(&cv, 0); }
+	inline ~porcond()	{ pthread_cond_destroy(&cv); }
+	inline void wait(porlock *l)	{ pthread_cond_wait(&cv, &l->mtx); }
+	inline bool wait(porlock *l,int msec)	{
+		struct timeval now; gettimeofday(&now,0);
+		long long ns=(now.tv_usec+(msec%1000)*1000LL)*1000;
+		struct timespec ts;
+		ts.tv_sec=now.tv_sec+msec/1000+(time_t)(ns/1000000000);
+		ts.tv_nsec=(long)(ns%1000000000);
+		return 0==pthread_cond_timedwait(&cv, &l->mtx, &ts);
+	}
+	inline void signal()	{ pthread_cond_signal(&cv); }
+	inline void broadcast()	{ pthread_cond_broadcast(&cv); }
+};
+
+#endif
+
+/**************** Atomic Operations ***************
+  Lock-free operations on 64-bit integers shared between threads.
+  Loads have acquire semantics, stores have release semantics,
+  and add and compare-and-swap are full barriers.
+*/
+typedef volatile long long porthread_atomic_t;
+#ifdef _WIN32
+inline long long porthread_atomic_add(porthread_atomic_t *p,long long v) 
+	{ return InterlockedExchangeAdd64(p,v)+v; }
+inline bool porthread_atomic_cas(porthread_atomic_t *p,long long oldv,long long newv) 
+	{ return oldv==InterlockedCompareExchange64(p,newv,oldv); }
+inline long long porthread_atomic_load(porthread_atomic_t *p) 
+	{ long long v=*p; MemoryBarrier(); return v; }
+inline void porthread_atomic_store(porthread_atomic_t *p,long long v) 
+	{ InterlockedExchange64(p,v); }
+#else /* gcc and clang builtins */
+/** Add v to *p, and return the new value */
+inline long long porthread_atomic_add(porthread_atomic_t *p,long long v) 
+	{ return __sync_add_and_fetch(p,v); }
+/** If *p==oldv, set *p=newv and return true.  Otherwise leave *p alone and return false. */
+inline bool porthread_atomic_cas(porthread_atomic_t *p,long long oldv,long long newv) 
+	{ return __sync_bool_compare_and_swap(p,oldv,newv); }
+/** Return the current value of *p */
+inline long long porthread_atomic_load(porthread_atomic_t *p) 
+	{ return __atomic_load_n(p,__ATOMIC_ACQUIRE); }
+/** Set *p=v */
+inline void porthread_atomic_store(porthread_atomic_t *p,long long v) 
+	{ __atomic_store_n(p,v,__ATOMIC_RELEASE); }
+#endif
+
 /**
   C++ "scoped" lock.  Locks the lock on creation,
   unlocks the lock on deletion, which is guaranteed
@@ -443,6 +443,121 @@ int skt_sendN(SOCKET hSocket,const void *buff,int nBytes)
   return 0;
 }
 
+/******* Non-aborting variants *********/
+int skt_set_blocking(SOCKET skt,int blocking)
+{
+#if defined(_WIN32) && !defined(__CYGWIN__)
+  u_long nonblock=blocking?0:1;
+  return ioctlsocket(skt,FIONBIO,&nonblock)==0?0:-1;
+#else
+  int flags=fcntl(skt,F_GETFL,0);
+  if (flags<0) return -1;
+  if (blocking) flags&=~O_NONBLOCK; else flags|=O_NONBLOCK;
+  return fcntl(skt,F_SETFL,flags)==0?0:-1;
+#endif
+}
+
+SOCKET skt_start_connect(skt_ip_t ip, int port)
+{
+  struct sockaddr_in addr=skt_build_addr(ip,port);
+  int ok;
+  SOCKET ret;
+  
+  if (!skt_inited) skt_init();
+  ret = socket(AF_INET, SOCK_STREAM, 0);
+  if (ret==INVALID_SOCKET) return INVALID_SOCKET;
+  
+  skt_set_blocking(ret,0);
+  ok = connect(ret, (struct sockaddr *)&(addr), sizeof(addr));
+  if (ok == SOCKET_ERROR) {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    if (WSAGetLastError()!=WSAEWOULDBLOCK) {skt_close(ret); return INVALID_SOCKET;}
+#else
+    if (errno!=EINPROGRESS) {skt_close(ret); return INVALID_SOCKET;}
+#endif
+  }
+  return ret;
+}
+
+int skt_finish_connect(SOCKET skt)
+{
+  int err=0;
+  socklen_t errlen=sizeof(err);
+  if (0!=getsockopt(skt,SOL_SOCKET,SO_ERROR,(char *)&err,&errlen) || err!=0)
+    return -1;
+  return 0;
+}
+
+SOCKET skt_try_connect(skt_ip_t ip, int port, int timeout_msec)
+{
+  fd_set wfds, efds;
+  struct timeval tmo;
+  int ok;
+  SOCKET ret=skt_start_connect(ip,port);
+  if (ret==INVALID_SOCKET) return INVALID_SOCKET;
+  
+  /* Wait for the non-blocking connect, so we can time it out ourselves */
+  FD_ZERO(&wfds); FD_SET(ret,&wfds);
+  FD_ZERO(&efds); FD_SET(ret,&efds); /* Windows reports failures here */
+  tmo.tv_sec=timeout_msec/1000;
+  tmo.tv_usec=(timeout_msec%1000)*1000;
+  do {
+    ok=select(1+ret,NULL,&wfds,&efds,&tmo);
+  } while (ok<0 && errno==EINTR);
+  if (ok<=0 || FD_ISSET(ret,&efds) || 0!=skt_finish_connect(ret))
+  { /* timeout, or connect failed */
+    skt_close(ret);
+    return INVALID_SOCKET;
+  }
+  
+  /* Back to normal blocking socket */
+  skt_set_blocking(ret,1);
+  return ret;
+}
+
+int skt_recv_some(SOCKET hSocket,void *buff,int nMax,int msec)
+{
+  int nRead;
+  while (1) {
+    if (0==skt_select1(hSocket,msec)) return -1; /* timeout */
+    skt_ignore_SIGPIPE=1;
+    nRead = recv(hSocket,(char *)buff,nMax,0);
+    skt_ignore_SIGPIPE=0;
+    if (nRead>=0) return nRead;
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    if (WSAGetLastError()!=WSAEINTR) return -1;
+#else
+    if (errno!=EINTR) return -1;
+#endif
+  }
+}
+
+int skt_try_sendN(SOCKET hSocket,const void *buff,int nBytes)
+{
+  int nLeft,nWritten;
+  const char *pBuff=(const char *)buff;
+  
+  nLeft = nBytes;
+  while (0 < nLeft)
+  {
+    skt_ignore_SIGPIPE=1;
+    nWritten = send(hSocket,pBuff,nLeft,0);
+    skt_ignore_SIGPIPE=0;
+    if (nWritten<=0)
+    {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+      if (nWritten<0 && WSAGetLastError()==WSAEINTR) continue;
+#else
+      if (nWritten<0 && errno==EINTR) continue;
+#endif
+      return -1;
+    }
+    nLeft -= nWritten;
+    pBuff += nWritten;
+  }
+  return 0;
+}
+
 /*Cheezy vector send: 
   really should use writev on machines where it's available. 
 */
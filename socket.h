@@ -179,6 +179,39 @@ int skt_recvN(SOCKET skt,      void *pBuff,int nBytes);
 int skt_sendV(SOCKET skt,int nBuffers,const void **buffers,int *lengths);
 
 
+/********** Non-aborting variants ***********
+ These report failures back to the caller instead of calling the abort 
+ routine, for talking to peers that are expected to fail sometimes,
+ like the upstream servers of a proxy.
+*/
+
+/** Like skt_connect, but wait at most timeout_msec milliseconds,
+  and return INVALID_SOCKET on any failure (including a refused connection,
+  which skt_connect retries).
+*/
+SOCKET skt_try_connect(skt_ip_t server_ip, int server_port, int timeout_msec);
+
+/** Start connecting a non-blocking socket to this server, and return 
+  it right away (or INVALID_SOCKET if the connect failed already).
+  Once select says the socket is writable, call skt_finish_connect.
+*/
+SOCKET skt_start_connect(skt_ip_t server_ip, int server_port);
+/** Return 0 if this skt_start_connect socket connected, or -1 if it failed. */
+int skt_finish_connect(SOCKET skt);
+/** Make this socket blocking (1) or non-blocking (0).  Returns 0 on success. */
+int skt_set_blocking(SOCKET skt,int blocking);
+
+/** Receive up to nMax bytes from this socket, waiting at most msec 
+  milliseconds (or forever if msec==0) for some to arrive.  
+  Returns the number of bytes received, 0 if the socket was closed,
+  or -1 on an error or timeout.
+*/
+int skt_recv_some(SOCKET skt,void *pBuff,int nMax,int msec);
+
+/** Like skt_sendN, but returns -1 on error instead of calling abort. */
+int skt_try_sendN(SOCKET skt,const void *pBuff,int nBytes);
+
+
 /**************** Utility Routines *******************/
 
 /**
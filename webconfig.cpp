@@ -11,9 +11,23 @@
 */
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <set>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "webconfig.h"
 
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
+
 
 
 /***************** Implementation of webconfig **************/
@@ -24,6 +38,7 @@ std::vector<pup_this_object *> webconfig_pup_list;
 /* Add this object to be pup'd at any time by webconfig. */
 void webconfig_add_pup(pup_this_object *p) {
 	webconfig_pup_list.push_back(p);
+	webconfig_invalidate_index();
 }
 
 /* Pup all web config objects registered above */
@@ -32,6 +47,12 @@ void webconfig_pup_all(pup_er_virtual &p) {
 		webconfig_pup_list[i]->pupto(p);
 }
 
+/* Tell all the objects we've just changed them */
+static void webconfig_edited(void) {
+	for (unsigned int i=0;i<webconfig_pup_list.size();i++)
+		webconfig_pup_list[i]->edited();
+}
+
 /*************** Implementation Utility Functions ****************/
 /* Convert an integer to a short std::string */
 std::string itos(int i) {
@@ -40,6 +61,15 @@ std::string itos(int i) {
 	return v;
 }
 
+/* FNV-1a hash of these bytes, for checksums */
+static unsigned int webconfig_checksum(const char *data,size_t len,unsigned int h=2166136261u) {
+	for (size_t i=0;i<len;i++) {
+		h^=(unsigned char)data[i];
+		h*=16777619u;
+	}
+	return h;
+}
+
 /* Return the number of newlines in this string */
 int count_newlines(const std::string &src) {
 	int r=0;
@@ -117,6 +147,12 @@ public:
 		value.resize(len);
 		s.read((char *)&value[0],len);
 	}
+	void pup_array(float *values,int n) {
+		s.read((char *)values,n*sizeof(float));
+	}
+	void pup_array(int *values,int n) {
+		s.read((char *)values,n*sizeof(int));
+	}
 };
 
 /**
@@ -139,6 +175,12 @@ public:
 		s.write((char *)&len,sizeof(int));
 		s.write((char *)&value[0],len);
 	}
+	void pup_array(float *values,int n) {
+		s.write((char *)values,n*sizeof(float));
+	}
+	void pup_array(int *values,int n) {
+		s.write((char *)values,n*sizeof(int));
+	}
 };
 
 
@@ -197,100 +239,801 @@ private:
 };
 
 
+/**
+ Where to find one field, so an edit can go straight to it.
+*/
+struct webconfig_field {
+	enum field_type {f_float,f_int,f_string,f_enum,
+		f_traverse /* no stable address (like a vector length): set it by pupping */
+	} type;
+	void *ptr; /* or 0 for a temporary */
+	bool length; /* f_traverse: a container length, so it's range checked */
+	const name_value_record *names; /* f_enum only: the allowed values */
+	int container; /* innermost container holding us, in webconfig_field_index::containers, or -1 */
+};
+
+/**
+ A container (like a std::vector) fields live inside, and where its
+ elements were when we indexed it.  If they've moved, so have the fields.
+*/
+struct webconfig_container {
+	const void *container;
+	pup_er_virtual::storage_fn storage;
+	const void *data;
+	size_t count;
+	int parent; /* container holding this one, or -1 */
+};
+
+/**
+ Maps the fully-qualified name of every field to its address.
+*/
+class webconfig_field_index {
+public:
+	webconfig_field_index() :valid(false) {}
+	
+	/* Forget everything: we'll rebuild on the next lookup */
+	void invalidate(void) {valid=false;}
+	
+	/* Return the field with this fully-qualified name, or 0 if there's none.
+	   The address is good until the index or the field's containers change. */
+	webconfig_field *find(const std::string &fullname);
+	
+	/* Set this field to this URL-encoded value.
+	   Returns 1 if we set it, 0 if there's no such field, 
+	   or -1 if it can only be set by pupping everything. */
+	int set(const std::string &fullname,const std::string &value);
+	
+private:
+	friend class pup_to_field_index;
+	bool valid;
+	std::map<std::string,webconfig_field> fields;
+	std::vector<webconfig_container> containers;
+	
+	void build(void);
+	/* Return true if this container, and everything it's in, hasn't moved */
+	bool unmoved(int container);
+	/* Return true if no container has moved or changed size */
+	bool all_unmoved(void);
+};
+
+/**
+ Record the address of every field, for webconfig_field_index.
+*/
+class pup_to_field_index : public pup_er_virtual {
+public:
+	typedef pup_to_field_index this_t;
+	pup_to_field_index(webconfig_field_index &index_) :index(index_), temporaries(0) {}
+	
+	void pup(const char *shortname,float &value) {
+		add(shortname,webconfig_field::f_float,&value);
+	}
+	void pup(const char *shortname,int &value) {
+		add(shortname,webconfig_field::f_int,&value);
+	}
+	void pup(const char *shortname,std::string &value) {
+		add(shortname,webconfig_field::f_string,&value);
+	}
+	void pup(const char *shortname,
+			unsigned int &value,const name_value_record *namevalue) 
+	{
+		add(shortname,webconfig_field::f_enum,&value)->names=namevalue;
+	}
+	void pup_length(const char *shortname,int &length) {
+		add(shortname,webconfig_field::f_traverse,0)->length=true;
+	}
+	void pup_temporary_begin(void) {temporaries++;}
+	void pup_temporary_end(void) {temporaries--;}
+	
+	virtual void pup_objectbegin(const char *shortname) {
+		old_addresses.push_back(address); /* store old address */
+		address=address+shortname+"."; /* add full name to our sub-objects */
+	}
+	virtual void pup_objectend(const char *shortname) {
+		address=*(old_addresses.end()-1);
+		old_addresses.pop_back();
+	}
+	
+	virtual void pup_container_begin(const void *container,storage_fn storage) {
+		webconfig_container c;
+		c.container=container;
+		c.storage=storage;
+		storage(container,&c.data,&c.count);
+		c.parent=current();
+		index.containers.push_back(c);
+		open_containers.push_back(index.containers.size()-1);
+	}
+	virtual void pup_container_end(void) {
+		open_containers.pop_back();
+	}
+private:
+	webconfig_field_index &index;
+	std::string address; /* current fully-qualified object address */
+	std::vector<std::string> old_addresses; /* for tracing object names */
+	std::vector<int> open_containers; /* containers we're inside now */
+	int temporaries; /* >0 while pupping values with no lasting address */
+	
+	int current(void) {return open_containers.size()>0?*(open_containers.end()-1):-1;}
+	
+	webconfig_field *add(const char *shortname,webconfig_field::field_type type,void *ptr) {
+		std::string fullname=address+shortname;
+		std::map<std::string,webconfig_field>::iterator it=index.fields.find(fullname);
+		if (it!=index.fields.end()) { /* duplicate name: pupping sets them all */
+			it->second.type=webconfig_field::f_traverse;
+			return &it->second;
+		}
+		if (temporaries>0) { /* gone after this pup call: don't keep its address */
+			type=webconfig_field::f_traverse;
+			ptr=0;
+		}
+		webconfig_field &f=index.fields[fullname];
+		f.type=type;
+		f.ptr=ptr;
+		f.length=false;
+		f.names=0;
+		f.container=current();
+		return &f;
+	}
+};
+
+void webconfig_field_index::build(void)
+{
+	fields.clear();
+	containers.clear();
+	pup_to_field_index p(*this);
+	webconfig_pup_all(p);
+	valid=true;
+}
+
+bool webconfig_field_index::unmoved(int container)
+{
+	/* Check from the outside in: an inner container lives in its parent's storage */
+	std::vector<int> chain;
+	for (int c=container;c>=0;c=containers[c].parent) chain.push_back(c);
+	for (int i=chain.size()-1;i>=0;i--) {
+		const webconfig_container &c=containers[chain[i]];
+		const void *data; size_t count;
+		c.storage(c.container,&data,&count);
+		if (data!=c.data || count!=c.count) return false;
+	}
+	return true;
+}
+
+bool webconfig_field_index::all_unmoved(void)
+{
+	/* Parents come before their children, so we stop before 
+	   looking inside a container that's moved */
+	for (unsigned int i=0;i<containers.size();i++) {
+		const webconfig_container &c=containers[i];
+		const void *data; size_t count;
+		c.storage(c.container,&data,&count);
+		if (data!=c.data || count!=c.count) return false;
+	}
+	return true;
+}
+
+webconfig_field *webconfig_field_index::find(const std::string &fullname)
+{
+	if (!valid) build();
+	std::map<std::string,webconfig_field>::iterator it=fields.find(fullname);
+	if (it!=fields.end()?!unmoved(it->second.container):!all_unmoved()) { /* a vector was resized */
+		build();
+		it=fields.find(fullname);
+	}
+	if (it==fields.end()) return 0;
+	return &it->second;
+}
+
+int webconfig_field_index::set(const std::string &fullname,const std::string &value)
+{
+	webconfig_field *found=find(fullname);
+	if (!found) return 0;
+	const webconfig_field &f=*found;
+	switch (f.type) {
+	case webconfig_field::f_float: *(float *)f.ptr=atof(value.c_str()); break;
+	case webconfig_field::f_int: *(int *)f.ptr=atoi(value.c_str()); break;
+	case webconfig_field::f_string: *(std::string *)f.ptr=unescape_URL(value); break;
+	case webconfig_field::f_enum: *(unsigned int *)f.ptr=atoi(value.c_str()); break;
+	default: return -1;
+	}
+	return 1;
+}
+
+webconfig_field_index webconfig_index;
+
+void webconfig_invalidate_index(void) {
+	webconfig_index.invalidate();
+}
+
+
+/***************** Self-describing config file **************/
+/*
+ A config file is a header, a table of fields (in pup order), their
+ full dotted names, and their data:
+	config_file_header
+	config_file_field[field_count]
+	names (not nul terminated)
+	data (each field's starts on an 8-byte boundary)
+ Restore finds each field by name, so fields can be added, removed,
+ or reordered without disturbing the others.  Everything's in the
+ writer's byte order, which byte_order records.
+*/
+static const char config_file_magic[8]={'O','S','L','c','o','n','f',0};
+enum {config_file_version=1, config_file_byte_order=0x01020304};
+/* Field types for whole arrays, named "*" in their object (past the webconfig_field types) */
+enum {config_file_float_array=100, config_file_int_array};
+
+struct config_file_header {
+	char magic[8]; /* config_file_magic */
+	unsigned int version; /* config_file_version */
+	unsigned int byte_order; /* config_file_byte_order, as written */
+	unsigned int field_count;
+	unsigned int checksum; /* webconfig_checksum of everything after this header */
+	long long names_start, data_start, file_size; /* offsets from the start of the file */
+};
+
+struct config_file_field {
+	unsigned long long hash; /* name_hash of the full name */
+	unsigned int type; /* a webconfig_field::field_type, or a config_file array type */
+	unsigned int name_length;
+	long long name_offset; /* from names_start */
+	long long data_offset; /* from data_start */
+	long long data_length;
+};
+
+/* 64-bit FNV-1a hash, continued from h over these bytes */
+static unsigned long long name_hash(const char *s,size_t len,
+	unsigned long long h=14695981039346656037ull) 
+{
+	for (size_t i=0;i<len;i++) {
+		h^=(unsigned char)s[i];
+		h*=1099511628211ull;
+	}
+	return h;
+}
+
+/**
+ Tracks the fully-qualified name of the object we're in, and its hash,
+ for pup_ers that look fields up by name.
+*/
+class pup_er_named : public pup_er_virtual {
+public:
+	pup_er_named() {hashes.push_back(name_hash("",0));}
+	virtual void pup_objectbegin(const char *shortname) {
+		address=address+shortname+"."; /* add full name to our sub-objects */
+		hashes.push_back(name_hash(address.data(),address.size()));
+	}
+	virtual void pup_objectend(const char *shortname) {
+		hashes.pop_back();
+		address.erase(address.size()-strlen(shortname)-1);
+	}
+protected:
+	std::string address; /* current fully-qualified object address */
+	std::vector<unsigned long long> hashes; /* name_hash of each level's address */
+	
+	/* Return the hash of this field's full name */
+	unsigned long long hash(const char *shortname) {
+		return name_hash(shortname,strlen(shortname),*(hashes.end()-1));
+	}
+};
+
+/**
+ Write object data to a self-describing config file.
+*/
+class pup_to_binary_table : public pup_er_named {
+public:
+	typedef pup_to_binary_table this_t;
+	
+	void pup(const char *shortname,float &value) {
+		add(shortname,webconfig_field::f_float,&value,sizeof(float));
+	}
+	void pup(const char *shortname,int &value) {
+		add(shortname,webconfig_field::f_int,&value,sizeof(int));
+	}
+	void pup(const char *shortname,std::string &value) {
+		add(shortname,webconfig_field::f_string,value.data(),value.size());
+	}
+	void pup(const char *shortname,
+			unsigned int &value,const name_value_record *namevalue) 
+	{
+		add(shortname,webconfig_field::f_enum,&value,sizeof(unsigned int));
+	}
+	void pup_array(float *values,int n) {
+		add("*",config_file_float_array,values,n*sizeof(float));
+	}
+	void pup_array(int *values,int n) {
+		add("*",config_file_int_array,values,n*sizeof(int));
+	}
+	
+	/* Write everything to this stream.  Returns false on errors. */
+	bool write(std::ostream &s) {
+		config_file_header h;
+		memcpy(h.magic,config_file_magic,sizeof(h.magic));
+		h.version=config_file_version;
+		h.byte_order=config_file_byte_order;
+		h.field_count=fields.size();
+		while (names.size()%8) names+='\0'; /* align the data */
+		h.names_start=sizeof(h)+fields.size()*sizeof(config_file_field);
+		h.data_start=h.names_start+names.size();
+		h.file_size=h.data_start+data.size();
+		
+		const char *table=fields.size()?(const char *)&fields[0]:"";
+		size_t table_size=fields.size()*sizeof(config_file_field);
+		unsigned int sum=webconfig_checksum(table,table_size);
+		h.checksum=webconfig_checksum(names.data(),names.size(),sum);
+		h.checksum=webconfig_checksum(data.data(),data.size(),h.checksum);
+		
+		s.write((const char *)&h,sizeof(h));
+		s.write(table,table_size);
+		s.write(names.data(),names.size());
+		s.write(data.data(),data.size());
+		return !!s;
+	}
+private:
+	std::vector<config_file_field> fields;
+	std::string names, data;
+	
+	void add(const char *shortname,int type,const void *ptr,size_t len) {
+		config_file_field f;
+		f.hash=hash(shortname);
+		f.type=type;
+		f.name_offset=names.size();
+		names+=address;
+		names+=shortname;
+		f.name_length=names.size()-f.name_offset;
+		while (data.size()%8) data+='\0';
+		f.data_offset=data.size();
+		f.data_length=len;
+		data.append((const char *)ptr,len);
+		fields.push_back(f);
+	}
+};
+
+/**
+ Read object data from a self-describing config file, already in memory.
+*/
+class pup_from_binary_table : public pup_er_named {
+public:
+	typedef pup_from_binary_table this_t;
+	pup_from_binary_table() :found(0),file(0),table(0),count(0),next(0) {}
+	
+	/* Number of fields we found, out of the file's field_count */
+	unsigned int found;
+	unsigned int get_count(void) const {return count;}
+	
+	/* Check this file's layout and checksum.  Returns 0 if it's OK,
+	   or else an error message, and pupping does nothing. */
+	const char *open(const char *file_,size_t size) {
+		file=file_;
+		const config_file_header &h=*(const config_file_header *)file;
+		if (size<sizeof(h) || memcmp(h.magic,config_file_magic,sizeof(h.magic))!=0) return "not a config file";
+		if (h.version!=config_file_version) return "unknown config file version";
+		if (h.byte_order!=config_file_byte_order) return "config file is from a machine with a different byte order";
+		if (h.file_size!=(long long)size) return "config file is the wrong size";
+		long long table_end=sizeof(h)+(long long)h.field_count*sizeof(config_file_field);
+		if (h.names_start!=table_end || h.data_start<h.names_start || h.data_start>h.file_size)
+			return "config file layout is damaged";
+		if (h.checksum!=webconfig_checksum(file+sizeof(h),size-sizeof(h))) return "config file checksum mismatch";
+		table=(const config_file_field *)(file+sizeof(h));
+		count=h.field_count;
+		names=file+h.names_start;
+		names_size=h.data_start-h.names_start;
+		data=file+h.data_start;
+		data_size=h.file_size-h.data_start;
+		for (unsigned int i=0;i<count;i++) {
+			const config_file_field &f=table[i];
+			if (f.name_offset<0 || f.name_offset+f.name_length>names_size ||
+			    f.data_offset<0 || f.data_length<0 || f.data_offset+f.data_length>data_size)
+				return "config file field table is damaged";
+		}
+		return 0;
+	}
+	
+	void pup(const char *shortname,float &value) {
+		const config_file_field *f=find(shortname,webconfig_field::f_float,sizeof(float));
+		if (f) memcpy(&value,data+f->data_offset,sizeof(float));
+	}
+	void pup(const char *shortname,int &value) {
+		const config_file_field *f=find(shortname,webconfig_field::f_int,sizeof(int));
+		if (f) memcpy(&value,data+f->data_offset,sizeof(int));
+	}
+	void pup(const char *shortname,std::string &value) {
+		const config_file_field *f=find(shortname,webconfig_field::f_string,-1);
+		if (f) value.assign(data+f->data_offset,f->data_length);
+	}
+	void pup(const char *shortname,
+			unsigned int &value,const name_value_record *namevalue) 
+	{
+		const config_file_field *f=find(shortname,webconfig_field::f_enum,sizeof(unsigned int));
+		if (f) memcpy(&value,data+f->data_offset,sizeof(unsigned int));
+	}
+	void pup_array(float *values,int n) {find_array(config_file_float_array,values,n);}
+	void pup_array(int *values,int n) {find_array(config_file_int_array,values,n);}
+private:
+	const char *file;
+	const config_file_field *table;
+	unsigned int count;
+	const char *names, *data;
+	long long names_size, data_size;
+	unsigned int next; /* table entry we expect next, if nothing's changed */
+	std::multimap<unsigned long long,unsigned int> by_hash; /* built on first miss */
+	
+	/* Return true if this table entry is the field with this name */
+	bool matches(const config_file_field &f,unsigned long long h,const char *shortname) {
+		if (f.hash!=h) return false;
+		const char *n=names+f.name_offset;
+		size_t len=strlen(shortname);
+		return f.name_length==address.size()+len &&
+			address.compare(0,address.size(),n,address.size())==0 &&
+			memcmp(n+address.size(),shortname,len)==0;
+	}
+	
+	/* Return the table entry for this field, if it's there with this type and length */
+	const config_file_field *find(const char *shortname,int type,long long length) {
+		if (!table) return 0;
+		unsigned long long h=hash(shortname);
+		const config_file_field *f=0;
+		if (next<count && matches(table[next],h,shortname)) f=&table[next]; /* usual case: in order */
+		else {
+			if (by_hash.size()==0)
+				for (unsigned int i=0;i<count;i++) by_hash.insert(std::make_pair(table[i].hash,i));
+			std::multimap<unsigned long long,unsigned int>::iterator it=by_hash.lower_bound(h);
+			for (;it!=by_hash.end() && it->first==h;++it)
+				if (matches(table[it->second],h,shortname)) {f=&table[it->second]; break;}
+		}
+		if (!f) return 0; /* new field: keep its current value */
+		next=f-table+1;
+		if (f->type!=(unsigned int)type || (length>=0 && f->data_length!=length)) return 0; /* type changed */
+		found++;
+		return f;
+	}
+	
+	/* Copy in this array, or as much of it as the file has.
+	   Files without it may still have the elements one by one. */
+	template <class T>
+	void find_array(int type,T *values,int n) {
+		const config_file_field *f=find("*",type,-1);
+		if (!f) {pup_each(values,n); return;}
+		long long len=n*(long long)sizeof(T);
+		if (len>f->data_length) len=f->data_length-f->data_length%sizeof(T);
+		memcpy(values,data+f->data_offset,len);
+	}
+};
+
+/**
+ A config file mapped into memory, read-only.
+*/
+class config_file_map {
+public:
+	const char *data;
+	size_t size;
+	config_file_map() :data(0), size(0) {}
+	~config_file_map() {close();}
+	
+	/* Map this file.  Returns false if it can't be read. */
+	bool open(const char *filename) {
+		close();
+#ifdef _WIN32 /* just read it */
+		std::ifstream f(filename,std::ios_base::binary);
+		if (!f) return false;
+		std::stringstream all;
+		all<<f.rdbuf();
+		copy=all.str();
+		data=copy.data();
+		size=copy.size();
+		return true;
+#else
+		int fd=::open(filename,O_RDONLY);
+		if (fd<0) return false;
+		struct stat st;
+		if (0!=fstat(fd,&st)) {::close(fd); return false;}
+		if (st.st_size==0) {::close(fd); return true;} /* nothing to map */
+		void *p=mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		::close(fd); /* the mapping keeps the file */
+		if (p==MAP_FAILED) return false;
+		data=(const char *)p;
+		size=st.st_size;
+		return true;
+#endif
+	}
+	void close(void) {
+#ifndef _WIN32
+		if (data) munmap((void *)data,size);
+#endif
+		data=0; size=0;
+	}
+private:
+#ifdef _WIN32
+	std::string copy;
+#endif
+};
+
+
+/**
+ A page of HTML, written into one growable buffer.
+*/
+class html_buffer {
+public:
+	html_buffer() :len(0),buf(64*1024) {}
+	
+	void append(const char *data,size_t n) {
+		if (len+n>buf.size()) buf.resize(2*(len+n));
+		if (n>0) memcpy(&buf[len],data,n);
+		len+=n;
+	}
+	void append(const std::string &s) {append(s.data(),s.size());}
+	
+	const char *data(void) const {return len?&buf[0]:"";}
+	size_t size(void) const {return len;}
+private:
+	size_t len; /* bytes used in buf */
+	std::vector<char> buf;
+};
+
+/**
+ One pup call, and the HTML form we made for it.  The value goes
+ in the middle of our static HTML, and changes from page to page.
+*/
+struct html_form_event {
+	enum kind_t {e_float,e_int,e_string,e_enum,e_objectbegin,e_objectend,e_array,e_comment} kind;
+	unsigned int name_start, name_length; /* shortname (or comment), in html_form_template::names */
+	int array_start, array_length; /* e_array: first element shown, and how many there are */
+	size_t text_start, value_at, text_end; /* our static HTML, in html_form_template::text */
+	int divcount; /* pup_to_HTML_form's divcount after us */
+	
+	bool have_value; /* value_html is up to date for value_bits or value_raw */
+	unsigned int value_bits; /* last float, int, or enum value */
+	std::string value_raw; /* last string value */
+	std::string value_html;
+};
+
+/**
+ The HTML form as we last made it.  As long as the objects keep
+ the same structure, only changed values need to be redone.
+*/
+class html_form_template {
+public:
+	std::string text; /* static HTML of every event, in order */
+	std::string names; /* shortnames of every event, in order */
+	std::vector<html_form_event> events;
+	
+	/* Forget event e and everything after it */
+	void truncate(size_t e) {
+		if (e>=events.size()) return;
+		text.erase(events[e].text_start);
+		names.erase(events[e].name_start);
+		events.erase(events.begin()+e,events.end());
+	}
+};
+
 /**
  Convert arbitrary incoming types into working HTML form fields.
  To simplify processing of the returned data, we use a separate FORM for each field
  rather than one big form.
+ We walk the form's template along with the pup calls, reusing its
+ HTML while the calls match, and rebuilding from the first that doesn't.
 */
 class pup_to_HTML_form : public pup_er_virtual {
 public:
 	typedef pup_to_HTML_form this_t;
-	pup_to_HTML_form(std::string &html_,const std::string &form_name_) 
-		:html(html_),form_name(form_name_),indent(0),divcount(0) {}
+	/* views gives the first element to show of big arrays, by name */
+	pup_to_HTML_form(html_buffer &html_,html_form_template &form_,const std::string &form_name_,
+			const std::map<std::string,int> *views_=0) 
+		:html(html_),form(form_),form_name(form_name_),views(views_),
+		 next(0),building(false),indent(0),divcount(0) {}
+	
+	/* We're done: drop any events the objects no longer make */
+	void finish(void) {
+		form.truncate(next);
+	}
 	
 	void comment(const std::string &s) {
-		html+=s;
+		html_form_event &e=event(html_form_event::e_comment,s.data(),s.size());
+		if (building) {
+			form.text+=s;
+			end_event(e);
+		}
+		emit(e);
 	}
 	
 	// Pup a float
 	void pup(const char *shortname,float &value) {
-		char curvalue[100];
-		snprintf(curvalue,100,"%f",(float)value);
-		inner(shortname,curvalue);
+		html_form_event &e=event(html_form_event::e_float,shortname);
+		if (building) inner(e,shortname);
+		unsigned int bits;
+		memcpy(&bits,&value,sizeof(bits));
+		if (!e.have_value || e.value_bits!=bits) {
+			char curvalue[100];
+			snprintf(curvalue,100,"%f",(float)value);
+			set_value(e,bits,curvalue);
+		}
+		emit(e);
 	}
 	
 	// Pup an integer
 	void pup(const char *shortname,int &value) {
-		inner(shortname,itos(value));
+		html_form_event &e=event(html_form_event::e_int,shortname);
+		if (building) inner(e,shortname);
+		if (!e.have_value || e.value_bits!=(unsigned int)value) 
+			set_value(e,value,itos(value));
+		emit(e);
 	}
 	
 	// Pup a string
 	void pup(const char *shortname,std::string &value) {
-		if (count_newlines(value)==0) { // short string (no newlines)
-			inner(shortname,escape_HTML(value).c_str());
-		} else { // long string, with newlines
+		html_form_event &e=event(html_form_event::e_string,shortname);
+		if (building) { /* short and long strings get different inputs: all in the value */
+			startform();
+			e.value_at=form.text.size();
+			endform();
+			end_event(e);
+		}
+		if (!e.have_value || e.value_raw!=value) {
 			std::string fullname=address+shortname;
-			html+=startform()
-				+shortname+":<br>\n"
+			std::string &v=e.value_html;
+			if (count_newlines(value)==0) { // short string (no newlines)
+				v=shortname;
+				v+=": <INPUT type=\"text\" name=\""+fullname+"\" value=\""+escape_HTML(value)+"\" />";
+			} else { // long string, with newlines
+				v=shortname;
+				v+=":<br>\n"
 				"<textarea name=\""+fullname+"\" cols=\"85\" rows=\""+itos(count_newlines(value)+2)+"\">"
-				+escape_HTML(value)
-				+"</textarea><br>"+endform();
+					+escape_HTML(value)
+					+"</textarea><br>";
+			}
+			e.value_raw=value;
+			e.have_value=true;
 		}
+		emit(e);
 	}
 	
 	// Pup an enum, with a list of name/value pairs
 	void pup(const char *shortname,
 			unsigned int &value,const name_value_record *namevalue) 
 	{
-		std::string fullname=address+shortname;
-		html+=startform()
-			+shortname+": <SELECT name=\""+fullname+"\" >\n";
-		
-		// Loop over the enum options
-		for (const name_value_record *nv=namevalue;nv->name!=0;nv++) {
-			html=html+"<option value=\""+itos((int)nv->value)+"\" ";
-			if (value==nv->value) html+="selected=\"selected\"";
-			html=html+">"+nv->name+"</option>\n";
+		html_form_event &e=event(html_form_event::e_enum,shortname);
+		if (building) {
+			startform();
+			form.text+=shortname;
+			form.text+=": <SELECT name=\"";
+			form.text+=address;
+			form.text+=shortname;
+			form.text+="\" >\n";
+			e.value_at=form.text.size();
+			form.text+="</SELECT>";
+			endform();
+			end_event(e);
 		}
-		
-		html+="</SELECT>"+endform();
+		if (!e.have_value || e.value_bits!=value) {
+			std::string &v=e.value_html;
+			v="";
+			// Loop over the enum options
+			for (const name_value_record *nv=namevalue;nv->name!=0;nv++) {
+				v+="<option value=\"";
+				v+=itos((int)nv->value);
+				v+="\" ";
+				if (value==nv->value) v+="selected=\"selected\"";
+				v+=">";
+				v+=nv->name;
+				v+="</option>\n";
+			}
+			e.value_bits=value;
+			e.have_value=true;
+		}
+		emit(e);
 	}
 	
 	virtual void pup_objectbegin(const char *shortname) {
-		old_addresses.push_back(address); /* store old address */
-		
-		html+=itemdiv();
-		html+=address+"<B>"+shortname+"</B> {"; /* GUI */
-		address=address+shortname+"."; /* add full name to our sub-objects */
+		html_form_event &e=event(html_form_event::e_objectbegin,shortname);
+		if (building) {
+			itemdiv();
+			form.text+=address;
+			form.text+="<B>";
+			form.text+=shortname;
+			form.text+="</B> {"; /* GUI */
+			form.text+="<DIV STYLE=\"margin-left:1em; padding-left:1em;\">\n";
+			// background-color:"+getobjectcolor()+"\">\n";
+			end_event(e);
+		}
+		emit(e);
+		address+=shortname; /* add full name to our sub-objects */
+		address+='.';
 		indent++;
-		html+="<DIV STYLE=\"margin-left:1em; padding-left:1em;\">\n";
-		// background-color:"+getobjectcolor()+"\">\n";
-		
 	}
 	virtual void pup_objectend(const char *shortname) {
-		html+="</DIV>}<br>\n\n";
+		html_form_event &e=event(html_form_event::e_objectend,shortname);
+		if (building) {
+			form.text+="</DIV>}<br>\n\n";
+			form.text+="</DIV><br>";
+			end_event(e);
+		}
+		emit(e);
 		indent--;
-		address=*(old_addresses.end()-1);
-		html+="</DIV><br>";
-		
-		old_addresses.pop_back();
+		address.erase(address.size()-strlen(shortname)-1);
 	}
 	
+	/* Big arrays get one page of elements at a time */
+	void pup_array(float *values,int n) {page(values,n);}
+	void pup_array(int *values,int n) {page(values,n);}
+	
 private:
-	std::string &html; /* HTML string where our output is stored */
+	html_buffer &html; /* where our output is stored */
+	html_form_template &form; /* what we made last time, and are making now */
 	const std::string &form_name; /* relative URL to send HTTP responses */
-	std::string startform(void) {
-		return itemdiv()+"<FORM ACTION=\"/"
-			+form_name+"\">";
+	const std::map<std::string,int> *views;
+	enum {page_size=100}; /* array elements per page */
+	size_t next; /* index of our next event in form */
+	bool building; /* the current event is new: write its static HTML */
+	
+	/* Return our next event in the form, if it still matches this one.
+	   If not, the form's changed from here on: start a new event. */
+	html_form_event &event(html_form_event::kind_t kind,const char *name,size_t len,
+		int array_start=0,int array_length=0) 
+	{
+		if (!building && next<form.events.size()) {
+			html_form_event &e=form.events[next];
+			if (e.kind==kind && e.name_length==len && 
+			    e.array_start==array_start && e.array_length==array_length &&
+			    0==form.names.compare(e.name_start,len,name,len)) 
+			{
+				next++;
+				divcount=e.divcount;
+				return e;
+			}
+		}
+		form.truncate(next);
+		building=true;
+		html_form_event e;
+		e.kind=kind;
+		e.name_start=form.names.size();
+		e.name_length=len;
+		form.names.append(name,len);
+		e.array_start=array_start;
+		e.array_length=array_length;
+		e.text_start=form.text.size();
+		e.value_at=std::string::npos;
+		e.text_end=e.text_start;
+		e.divcount=divcount;
+		e.have_value=false;
+		e.value_bits=0;
+		form.events.push_back(e);
+		next++;
+		return form.events.back();
+	}
+	html_form_event &event(html_form_event::kind_t kind,const char *shortname) {
+		return event(kind,shortname,strlen(shortname));
+	}
+	/* The event's static HTML is all written */
+	void end_event(html_form_event &e) {
+		e.text_end=form.text.size();
+		if (e.value_at==std::string::npos) e.value_at=e.text_end;
+		e.divcount=divcount;
+	}
+	void set_value(html_form_event &e,unsigned int bits,const std::string &v) {
+		e.value_bits=bits;
+		e.value_html=v;
+		e.have_value=true;
+	}
+	/* Write out this event's HTML, with its current value */
+	void emit(const html_form_event &e) {
+		const char *t=form.text.data();
+		html.append(t+e.text_start,e.value_at-e.text_start);
+		html.append(e.value_html);
+		html.append(t+e.value_at,e.text_end-e.value_at);
 	}
 	
-	std::string endform(void) {
-		return "<INPUT type=\"submit\" value=\"Go!\"/></FORM></DIV>\n\n";
+	void startform(void) {
+		itemdiv();
+		form.text+="<FORM ACTION=\"/";
+		form.text+=form_name;
+		form.text+="\">";
+	}
+	void endform(void) {
+		form.text+="<INPUT type=\"submit\" value=\"Go!\"/></FORM></DIV>\n\n";
 	}
 	int indent;
 	int divcount;
 	/* Return the color of an object's content div */
-	std::string getobjectcolor(void) {
+	const char *getobjectcolor(void) {
 		switch (indent) {
 		case 0:
 			return "#f0f0f0";
@@ -303,9 +1046,10 @@ private:
 		};
 	}
 	/* Make a div for this item */
-	std::string itemdiv(void) {
+	void itemdiv(void) {
 		divcount++;
-		std::string color=getobjectcolor();
+		char color[8];
+		memcpy(color,getobjectcolor(),sizeof(color));
 		// Just adjust low digit of color, to get subtle colors:
 		if (divcount%2) {
 			//color[5]='f';
@@ -322,26 +1066,219 @@ private:
 			color="#ff0000"; break;
 		}
 		*/
-		return "<DIV STYLE=\"background-color:"+color+"\">\n\t";
+		form.text+="<DIV STYLE=\"background-color:";
+		form.text+=color;
+		form.text+="\">\n\t";
 	}
 	
 	std::string address; /* current fully-qualified object address */
-	std::vector<std::string> old_addresses; /* for tracing object names */
 	
-	/* Make an HTML form to set this field, with this current value. */
-	void inner(const char *shortname,const std::string &curvalue) {
-		std::string fullname=address+shortname;
-		html+=startform()
-			+shortname+": <INPUT type=\"text\" name=\""
-			+fullname+"\" value=\""
-			+curvalue+"\" />"
-			+endform(); 
+	/* Make an HTML form to set this field; the value goes in the middle. */
+	void inner(html_form_event &e,const char *shortname) {
+		startform();
+		form.text+=shortname;
+		form.text+=": <INPUT type=\"text\" name=\"";
+		form.text+=address;
+		form.text+=shortname;
+		form.text+="\" value=\"";
+		e.value_at=form.text.size();
+		form.text+="\" />";
+		endform();
+		end_event(e);
+	}
+	
+	template <class T>
+	void page(T *values,int n) {
+		if (n<=page_size) {pup_each(values,n); return;}
+		std::string name=address.substr(0,address.size()-1);
+		int start=0;
+		if (views) {
+			std::map<std::string,int>::const_iterator it=views->find(name);
+			if (it!=views->end()) start=it->second;
+		}
+		if (start>n-1) start=(n-1)/page_size*page_size;
+		if (start<0) start=0;
+		int end=start+page_size;
+		if (end>n) end=n;
+		
+		html_form_event &e=event(html_form_event::e_array,"",0,start,n);
+		if (building) {
+			startform();
+			form.text+="Elements "+itos(start)+" to "+itos(end-1)+" of "+itos(n)+": "
+				+pagelink(name,0,"first")+pagelink(name,start-page_size,"previous")
+				+pagelink(name,end,"next")+pagelink(name,(n-1)/page_size*page_size,"last")
+				+" Show from <INPUT type=\"text\" size=\"8\" name=\""+name+".*\" value=\""+itos(start)+"\" />";
+			endform();
+			end_event(e);
+		}
+		emit(e);
+		char index[100];
+		for (int i=start;i<end;i++) {
+			snprintf(index,100,"%d",i);
+			pup(index,values[i]);
+		}
+	}
+	std::string pagelink(const std::string &name,int start,const char *label) {
+		if (start<0) start=0;
+		return "<A HREF=\"/"+form_name+"?"+name+".*="+itos(start)+"\">"+label+"</A> ";
+	}
+};
+
+
+/***************** Journal **************/
+/*
+ The journal file is a series of records, each
+	int body_length; body; unsigned int checksum of body
+ where the body is an int count of edits, each
+	int name_length; name; char type (a webconfig_field::field_type); value
+ and the value is 4 bytes for a float, int, or enum, or else an int length
+ and bytes: a string, or (for f_traverse) the text to pup it from.
+ Everything's in native byte order, like the config file itself.
+ A record that's cut short or fails its checksum (from a crash while
+ appending it) ends the journal.  Edits set absolute values, so replaying
+ edits the config file already has (from a crash while compacting) is harmless.
+*/
+static bool journal_on=false;
+static long journal_compact_bytes=0;
+
+/* Return the journal's file name, for this config file */
+static std::string journal_filename(const char *configfile) {
+	return std::string(configfile)+".journal";
+}
+
+/**
+ Edits that were just applied, to be saved together.
+*/
+class webconfig_journal_record {
+public:
+	webconfig_journal_record() :count(0) {}
+	
+	/* Record the new value of this field, which was just set from this text. */
+	void add(const std::string &name,const std::string &text) {
+		webconfig_field *f=webconfig_index.find(name);
+		if (!f) return; /* gone again, by a later resize */
+		put_int(name.size());
+		put(name.data(),name.size());
+		char type=f->type;
+		put(&type,1);
+		switch (f->type) {
+		case webconfig_field::f_float: put(f->ptr,sizeof(float)); break;
+		case webconfig_field::f_int: put(f->ptr,sizeof(int)); break;
+		case webconfig_field::f_enum: put(f->ptr,sizeof(unsigned int)); break;
+		case webconfig_field::f_string: put_string(*(std::string *)f->ptr); break;
+		default: put_string(text); break;
+		}
+		count++;
+	}
+	
+	/* Save these edits: append them to the journal, or else save everything. */
+	void commit(void) {
+		if (count==0) return;
+		if (!journal_on) {webconfig_save(); return;}
+		std::string record;
+		int len=sizeof(int)+body.size();
+		record.append((const char *)&len,sizeof(int));
+		record.append((const char *)&count,sizeof(int));
+		record+=body;
+		unsigned int sum=webconfig_checksum(&record[sizeof(int)],len);
+		record.append((const char *)&sum,sizeof(sum));
+		
+		FILE *f=fopen(journal_filename(WEBCONFIG_FILENAME).c_str(),"ab");
+		bool ok=(f!=0) && fwrite(&record[0],1,record.size(),f)==record.size();
+		long size=ok?ftell(f):0;
+		if (f && 0!=fclose(f)) ok=false;
+		if (!ok || size>journal_compact_bytes) 
+			webconfig_save(); /* fold the journal into a new snapshot */
 	}
+private:
+	std::string body; /* the edits, after the count */
+	int count;
+	void put(const void *data,size_t len) {body.append((const char *)data,len);}
+	void put_int(int i) {put(&i,sizeof(int));}
+	void put_string(const std::string &str) {put_int(str.size()); put(str.data(),str.size());}
 };
 
+/* Read an int from data at b, and advance past it.  Returns 0 past the end. */
+static int get_int(const std::string &data,size_t &b) {
+	int i=0;
+	if (b+sizeof(int)<=data.size()) memcpy(&i,&data[b],sizeof(int));
+	b+=sizeof(int);
+	return i;
+}
+/* Read a length-prefixed string from data at b, and advance past it. */
+static std::string get_string(const std::string &data,size_t &b) {
+	int len=get_int(data,b);
+	if (len<0 || b>data.size() || (size_t)len>data.size()-b) {b=data.size(); return "";}
+	std::string s=data.substr(b,len);
+	b+=len;
+	return s;
+}
+
+/**
+ Apply the edits in this journal file.  Returns the number of 
+ records applied, or -1 if there's no journal.
+*/
+static int webconfig_replay_journal(const std::string &filename)
+{
+	std::ifstream f(filename.c_str(),std::ios_base::binary);
+	if (!f) return -1;
+	std::stringstream all;
+	all<<f.rdbuf();
+	std::string j=all.str();
+	
+	int records=0;
+	size_t at=0;
+	while (at+sizeof(int)<=j.size()) {
+		int len;
+		memcpy(&len,&j[at],sizeof(int));
+		size_t start=at+sizeof(int), end=start+len;
+		if (len<(int)sizeof(int) || end+sizeof(unsigned int)>j.size()) break; /* cut short */
+		unsigned int sum;
+		memcpy(&sum,&j[end],sizeof(sum));
+		if (sum!=webconfig_checksum(&j[start],len)) break; /* damaged */
+		at=end+sizeof(sum);
+		
+		/* Decode and apply the edits in this record */
+		std::string body=j.substr(start,len);
+		size_t b=0;
+		int count=get_int(body,b);
+		for (int e=0;e<count && b<body.size();e++) {
+			std::string name=get_string(body,b);
+			if (b+1>body.size()) break;
+			char type=body[b++];
+			webconfig_field *fld=webconfig_index.find(name);
+			bool same=fld && fld->type==type; /* else the program changed: skip it */
+			if (type==webconfig_field::f_string || type==webconfig_field::f_traverse) {
+				std::string text=get_string(body,b);
+				if (same && type==webconfig_field::f_string) *(std::string *)fld->ptr=text;
+				else if (same) {
+					pup_from_name_value p(name,text);
+					webconfig_pup_all(p);
+					webconfig_invalidate_index();
+				}
+			}
+			else {
+				if (b+4>body.size()) break;
+				if (same) memcpy(fld->ptr,&body[b],4);
+				b+=4;
+			}
+		}
+		records++;
+	}
+	return records;
+}
+
+/* Longest container we'll resize to, from the network */
+enum {webconfig_max_length=16*1024*1024};
+
+/* Held by web requests while they read or modify objects */
+static porlock webconfig_lock;
+porlock &webconfig_edit_lock(void) {return webconfig_lock;}
 
 class webconfig_editor : public osl::http_responder {
 	std::string form_name;
+	std::map<std::string,int> views; /* first element shown of big arrays, by name */
+	html_form_template form; /* the main form, as we last made it */
 public:
 	std::string page_start; /* <HTML>, <BODY>, up to actual items. */
 	std::string page_end; /* </BODY>, </HTML> */
@@ -365,15 +1302,36 @@ Enter new values and hit enter or Submit:<br>
 	}
 
 	bool respond(osl::http_served_client &client) {
+		std::vector<std::string> changed;
+		html_buffer out;
+		bool make_form=false;
+		bool responded=edit(client,changed,out,make_form);
+		if (changed.size()>0) webconfig_changed(changed); /* without the lock, so listeners can read */
+		
+		/* Send the page without the lock too, so a browser that
+		   stops reading can't hold up everybody else's edits. */
+		if (make_form) {
+			client.send_chunked_header("text/html");
+			const size_t chunk=64*1024;
+			for (size_t at=0;at<out.size();at+=chunk)
+				client.send_chunk(out.data()+at,std::min(chunk,out.size()-at));
+			client.end_chunks();
+		}
+		else if (responded) client.send("text/html",std::string(out.data(),out.size()));
+		return responded;
+	}
+private:
+	/* Handle this request, and make the page to send back in out.
+	   make_form is set if out is the whole form. */
+	bool edit(osl::http_served_client &client,std::vector<std::string> &changed,
+		html_buffer &out,bool &make_form) {
 		/* Serialize responses.  Parallel packing or unpacking is asking for disaster. */
-		static porlock web_lock;
-		porlock_scoped scoped_lock(&web_lock);
+		porlock_scoped scoped_lock(&webconfig_lock);
 	
 	/* Start the page */
 		std::string html=page_start;
 
 	/* Check parameters */
-		bool make_form=false;
 		bool send_response=false;
 		if (client.get_path()=="/" || client.get_path()=="/"+form_name) 
 		{ /* initial page request */
@@ -383,37 +1341,61 @@ Enter new values and hit enter or Submit:<br>
 		if (client.get_path().substr(0,2+form_name.size())=="/"+form_name+"?") 
 		{ /* form data coming back */
 			send_response=true;
-			make_form=apply_parameters(html,client.get_path().substr(2+form_name.size()));
+			make_form=apply_parameters(html,client.get_path().substr(2+form_name.size()),changed);
 		}
 		
 	/* Create the main form */
+		out.append(html);
 		if (make_form) {
-			pup_to_HTML_form p(html,form_name);
+			pup_to_HTML_form p(out,form,form_name,&views);
 			webconfig_pup_all(p);
-
-			html+=page_end;
+			p.finish();
+			out.append(page_end);
 		}
-		if (send_response) client.send("text/html",html);
 		return send_response;
 	}
-private:
-	/* Change our values according to these CGI FORM parameters.
+	
+	/* Change our values according to these CGI FORM parameters,
+	   and add the field we changed to changed.
 	   CAUTION: NETWORK-SOURCED DATA! */
-	bool apply_parameters(std::string &html,const std::string &parameters)
+	bool apply_parameters(std::string &html,const std::string &parameters,std::vector<std::string> &changed)
 	{
 		if (parameters.size()<2) return true; /* nothing to apply */
 		size_t eq=parameters.find_first_of("=");
 		if (eq==std::string::npos) {html+="<P>ERROR! Missing equals sign in CGI parameters!\n";return false;}
 		std::string fullname=parameters.substr(0,eq);
 		std::string value=parameters.substr(eq+1);
+		if (fullname.size()>2 && fullname.substr(fullname.size()-2)==".*") { /* paging through an array */
+			views[fullname.substr(0,fullname.size()-2)]=atoi(value.c_str());
+			return true;
+		}
 		std::cout<<"Setting '"<<fullname<<"' to '"<<value<<"'\n";
 		
-		pup_from_name_value p(fullname,value);
-		webconfig_pup_all(p);
-		
-		webconfig_save();
+		int set=webconfig_index.set(fullname,value);
+		if (set<0) { /* no fixed address: pup everything to find it */
+			const webconfig_field *f=webconfig_index.find(fullname);
+			long length=atol(value.c_str());
+			if (f->length && (length<0 || length>webconfig_max_length)) {
+				html+="<P>ERROR! Length out of range for '"+fullname+"'!\n";
+				return false;
+			}
+			webconfig_invalidate_index(); /* it may resize a vector */
+			try {
+				pup_from_name_value p(fullname,value);
+				webconfig_pup_all(p);
+				set=p.found;
+			} catch (std::exception &e) {
+				html+="<P>ERROR! Could not set '"+fullname+"': "+e.what()+"\n";
+				return false;
+			}
+		}
 		
-		if (p.found) {
+		if (set) {
+			webconfig_edited();
+			changed.push_back(fullname);
+			webconfig_journal_record journal;
+			journal.add(fullname,value);
+			journal.commit();
 			return true;
 		} else {
 			html+="<P>ERROR! Missing field '"+fullname+"'!\n";
@@ -422,15 +1404,662 @@ private:
 	}	
 };
 
-/* Restore our objects from this .dat file: */
+
+/***************** JSON access **************/
+
+/* Quote this string for JSON */
+std::string escape_JSON(const std::string &str) {
+	std::string ret="\"";
+	for (unsigned int i=0;i<str.size();i++) {
+		unsigned char c=str[i];
+		    if (c=='\"') { ret+="\\\""; }
+		else if (c=='\\') { ret+="\\\\"; }
+		else if (c=='\n') { ret+="\\n"; }
+		else if (c=='\r') { ret+="\\r"; }
+		else if (c=='\t') { ret+="\\t"; }
+		else if (c<0x20) {
+			char buf[10];
+			snprintf(buf,10,"\\u%04x",c);
+			ret+=buf;
+		}
+		else {
+			ret+=c;
+		}
+	}
+	return ret+"\"";
+}
+
+/**
+ Write the fields under these names as one flat JSON object, 
+ like {"cfg.a":3,"cfg.name":"foo"}.
+*/
+class pup_to_JSON : public pup_er_virtual {
+public:
+	typedef pup_to_JSON this_t;
+	/* Only write fields named in select, or inside objects named there.
+	   If select is empty, write everything. */
+	pup_to_JSON(std::string &json_,const std::vector<std::string> &select_) 
+		:json(json_),select(select_),count(0) {}
+	
+	void pup(const char *shortname,float &value) {
+		char buf[100];
+		if (value==value && value-value==0) snprintf(buf,100,"%.9g",value);
+		else strcpy(buf,"null"); /* JSON has no NaN or infinity */
+		inner(shortname,buf);
+	}
+	void pup(const char *shortname,int &value) {
+		inner(shortname,itos(value));
+	}
+	void pup(const char *shortname,std::string &value) {
+		if (wanted(shortname)) inner(shortname,escape_JSON(value));
+	}
+	void pup(const char *shortname,
+			unsigned int &value,const name_value_record *namevalue) 
+	{
+		inner(shortname,itos(value));
+	}
+	
+	virtual void pup_objectbegin(const char *shortname) {
+		old_addresses.push_back(address); /* store old address */
+		address=address+shortname+"."; /* add full name to our sub-objects */
+	}
+	virtual void pup_objectend(const char *shortname) {
+		address=*(old_addresses.end()-1);
+		old_addresses.pop_back();
+	}
+	
+	/* Close the object, and return the number of fields written */
+	int finish(void) {
+		json+=(count==0)?"{}\n":"\n}\n";
+		return count;
+	}
+private:
+	std::string &json;
+	const std::vector<std::string> &select;
+	int count;
+	std::string address; /* current fully-qualified object address */
+	std::vector<std::string> old_addresses; /* for tracing object names */
+	
+	/* Return true if this field is selected */
+	bool wanted(const char *shortname) {
+		if (select.size()==0) return true;
+		std::string fullname=address+shortname;
+		for (unsigned int i=0;i<select.size();i++) {
+			const std::string &s=select[i];
+			if (fullname.compare(0,s.size(),s)==0 && 
+				(fullname.size()==s.size() || fullname[s.size()]=='.'))
+				return true;
+		}
+		return false;
+	}
+	void inner(const char *shortname,const std::string &value) {
+		if (!wanted(shortname)) return;
+		json+=(count++==0)?"{\n":",\n";
+		json+=escape_JSON(address+shortname)+":"+value;
+	}
+};
+
+/* One value from a JSON object */
+struct json_value {
+	bool is_string;
+	std::string text; /* unquoted string, or number text */
+};
+
+/* Append this code point to s as UTF-8 */
+static void append_UTF8(std::string &s,unsigned int c) {
+	if (c<0x80) s+=(char)c;
+	else if (c<0x800) {
+		s+=(char)(0xC0|(c>>6));
+		s+=(char)(0x80|(c&0x3F));
+	}
+	else if (c<0x10000) {
+		s+=(char)(0xE0|(c>>12));
+		s+=(char)(0x80|((c>>6)&0x3F));
+		s+=(char)(0x80|(c&0x3F));
+	}
+	else {
+		s+=(char)(0xF0|(c>>18));
+		s+=(char)(0x80|((c>>12)&0x3F));
+		s+=(char)(0x80|((c>>6)&0x3F));
+		s+=(char)(0x80|(c&0x3F));
+	}
+}
+
+/**
+ Parse a flat JSON object of names and numbers or strings, 
+ like {"cfg.a":3,"cfg.name":"foo"}.
+ CAUTION: NETWORK-SOURCED DATA!
+*/
+class json_object_parser {
+public:
+	json_object_parser(const std::string &src_) :src(src_), at(0) {}
+	
+	/* Parse the whole object into these (name,value) pairs, in order.
+	   Returns 0 on success, or an error message. */
+	const char *parse(std::vector<std::pair<std::string,json_value> > &out) {
+		if (!next('{')) return "Expected a JSON object";
+		if (next('}')) return end();
+		do {
+			std::pair<std::string,json_value> p;
+			if (!string(p.first)) return "Expected a quoted field name";
+			if (!next(':')) return "Expected a colon after the field name";
+			skip();
+			p.second.is_string=(at<src.size() && src[at]=='\"');
+			if (p.second.is_string) {
+				if (!string(p.second.text)) return "Bad string value";
+			}
+			else if (literal("true")) p.second.text="1";
+			else if (literal("false")) p.second.text="0";
+			else if (!number(p.second.text)) return "Expected a number or string value";
+			out.push_back(p);
+		} while (next(','));
+		if (!next('}')) return "Expected a comma or closing brace";
+		return end();
+	}
+private:
+	const std::string &src;
+	unsigned int at;
+	
+	const char *end(void) {
+		skip();
+		if (at!=src.size()) return "Extra data after the JSON object";
+		return 0;
+	}
+	void skip(void) {
+		while (at<src.size() && (src[at]==' ' || src[at]=='\t' || src[at]=='\n' || src[at]=='\r')) at++;
+	}
+	/* If the next thing is this character, consume it and return true */
+	bool next(char c) {
+		skip();
+		if (at<src.size() && src[at]==c) {at++; return true;}
+		return false;
+	}
+	bool literal(const char *word) {
+		unsigned int len=strlen(word);
+		if (src.compare(at,len,word)!=0) return false;
+		at+=len;
+		return true;
+	}
+	bool hex4(unsigned int &c) {
+		if (at+4>src.size()) return false;
+		c=0;
+		for (int i=0;i<4;i++) {
+			char h=src[at++];
+			c*=16;
+			if (h>='0' && h<='9') c+=h-'0';
+			else if (h>='a' && h<='f') c+=h-'a'+10;
+			else if (h>='A' && h<='F') c+=h-'A'+10;
+			else return false;
+		}
+		return true;
+	}
+	bool string(std::string &out) {
+		if (!next('\"')) return false;
+		while (at<src.size()) {
+			char c=src[at++];
+			if (c=='\"') return true;
+			if (c!='\\') {out+=c; continue;}
+			if (at>=src.size()) return false;
+			c=src[at++];
+			switch (c) {
+			case 'n': out+='\n'; break;
+			case 'r': out+='\r'; break;
+			case 't': out+='\t'; break;
+			case 'b': out+='\b'; break;
+			case 'f': out+='\f'; break;
+			case 'u': {
+				unsigned int u, lo;
+				if (!hex4(u)) return false;
+				if (u>=0xD800 && u<0xDC00) { /* surrogate pair */
+					if (!literal("\\u") || !hex4(lo) || lo<0xDC00 || lo>=0xE000) return false;
+					u=0x10000+((u-0xD800)<<10)+(lo-0xDC00);
+				}
+				append_UTF8(out,u);
+				break;
+			}
+			default: out+=c; break; /* \" \\ \/ */
+			}
+		}
+		return false;
+	}
+	bool number(std::string &out) {
+		unsigned int start=at;
+		while (at<src.size() && strchr("+-.0123456789eE",src[at])) at++;
+		out=src.substr(start,at-start);
+		if (out.size()==0) return false;
+		char *end;
+		strtod(out.c_str(),&end);
+		return *end==0;
+	}
+};
+
+/* Check that this JSON value suits this field, and if set is true, store it there.
+   Returns 0 on success, or an error message. */
+static const char *webconfig_json_value(const webconfig_field &f,const json_value &v,bool set)
+{
+	const char *s=v.text.c_str();
+	char *end;
+	switch (f.type) {
+	case webconfig_field::f_float: {
+		if (v.is_string) return "expected a number";
+		float d=strtod(s,&end);
+		if (set) *(float *)f.ptr=d;
+		return 0;
+	}
+	case webconfig_field::f_int: {
+		if (v.is_string) return "expected a number";
+		long i=strtol(s,&end,10);
+		if (*end!=0 || i!=(int)i) return "expected an integer";
+		if (set) *(int *)f.ptr=i;
+		return 0;
+	}
+	case webconfig_field::f_string:
+		if (!v.is_string) return "expected a string";
+		if (set) *(std::string *)f.ptr=v.text;
+		return 0;
+	case webconfig_field::f_enum: { /* by value, or by name */
+		long i=v.is_string?-1:strtol(s,&end,10);
+		for (const name_value_record *nv=f.names;nv && nv->name!=0;nv++)
+			if (v.is_string?(v.text==nv->name):(i>=0 && (unsigned long)i==nv->value)) {
+				if (set) *(unsigned int *)f.ptr=nv->value;
+				return 0;
+			}
+		return "not one of the allowed values";
+	}
+	default: { /* needs pupping: only numbers go there */
+		if (v.is_string) return "expected a number";
+		if (!f.length) return 0; /* a temporary, or a name pupped twice */
+		long i=strtol(s,&end,10);
+		if (*end!=0 || i!=(int)i) return "expected an integer";
+		if (i<0 || i>webconfig_max_length) return "length out of range";
+		return 0;
+	}
+	}
+}
+
+/**
+ Apply all these edits, or none of them.  Returns empty on success,
+ or an error message.  Call with webconfig_lock held.
+*/
+static std::string webconfig_set_fields(const std::vector<std::pair<std::string,json_value> > &edits)
+{
+	/* Check everything we can before changing anything */
+	bool restructure=false; /* some edit resizes a container */
+	for (unsigned int i=0;i<edits.size();i++) {
+		const std::string &name=edits[i].first;
+		webconfig_field *f=webconfig_index.find(name);
+		if (!f) {
+			if (restructure) continue; /* may exist once an earlier resize happens */
+			return "Missing field '"+name+"'";
+		}
+		const char *err=webconfig_json_value(*f,edits[i].second,false);
+		if (err) return "Field '"+name+"': "+err;
+		if (f->type==webconfig_field::f_traverse) restructure=true;
+	}
+	
+	/* Resizes may expose fields we can't check in advance: keep a copy to roll back to. */
+	std::stringstream backup;
+	if (restructure) {
+		pup_to_binary_file b(backup);
+		webconfig_pup_all(b);
+	}
+	std::string error;
+	for (unsigned int i=0;error.size()==0 && i<edits.size();i++) {
+		const std::string &name=edits[i].first;
+		try {
+			webconfig_field *f=webconfig_index.find(name);
+			const char *err=f?webconfig_json_value(*f,edits[i].second,true):"missing field";
+			if (!err && f->type==webconfig_field::f_traverse) {
+				webconfig_invalidate_index();
+				pup_from_name_value p(name,edits[i].second.text);
+				webconfig_pup_all(p);
+			}
+			if (err) error="Field '"+name+"': "+err;
+		} catch (std::exception &e) { /* like bad_alloc from a resize: roll back */
+			error="Field '"+name+"': "+e.what();
+		}
+	}
+	if (error.size()>0) {
+		pup_from_binary_file r(backup);
+		webconfig_pup_all(r);
+		webconfig_invalidate_index();
+	}
+	return error;
+}
+
+/**
+ JSON access to all our objects:
+	GET /conf.json                  returns every field, as {"name":value,...}
+	GET /conf.json?cfg.a&cfg.list   returns just these fields, or objects' fields
+	POST /conf.json {"cfg.a":3,"cfg.name":"foo"}
+	                                sets all these fields, or (on error) none
+ Names are the same dotted names the HTML editor uses.
+*/
+class webconfig_json : public osl::http_responder {
+	std::string path;
+public:
+	webconfig_json(const std::string &path_) :path("/"+path_) {}
+	
+	bool respond(osl::http_served_client &client) {
+		std::string p=client.get_path();
+		std::string query;
+		if (p.substr(0,path.size()+1)==path+"?") query=p.substr(path.size()+1);
+		else if (p!=path) return false;
+		
+		if (client.get_method()=="POST" || client.get_method()=="PUT") {
+			std::string body=client.read_body_string();
+			if (client.get_error()) return true; /* too long, or broken */
+			std::vector<std::pair<std::string,json_value> > edits;
+			const char *err=json_object_parser(body).parse(edits);
+			if (err) {
+				reply(client,err,400);
+				return true;
+			}
+			std::string error;
+			{
+				porlock_scoped scoped_lock(&webconfig_lock);
+				error=webconfig_set_fields(edits);
+				webconfig_edited(); /* even a failure may have rolled things back */
+				if (error.size()==0) {
+					webconfig_journal_record journal;
+					for (unsigned int i=0;i<edits.size();i++)
+						journal.add(edits[i].first,edits[i].second.text);
+					journal.commit();
+				}
+			}
+			if (error.size()>0) reply(client,error,400);
+			else {
+				std::vector<std::string> changed;
+				for (unsigned int i=0;i<edits.size();i++) changed.push_back(edits[i].first);
+				if (changed.size()>0) webconfig_changed(changed);
+				reply(client,"",200,(int)edits.size());
+			}
+			return true;
+		}
+		
+		/* Everything, or just the fields named in the query, like ?cfg.a&cfg.b */
+		std::vector<std::string> select;
+		while (query.size()>0) {
+			size_t amp=query.find('&');
+			std::string name=unescape_URL(query.substr(0,amp));
+			if (name.size()>0) select.push_back(name);
+			query=(amp==std::string::npos)?"":query.substr(amp+1);
+		}
+		std::string json;
+		{
+			porlock_scoped scoped_lock(&webconfig_lock);
+			pup_to_JSON j(json,select);
+			webconfig_pup_all(j);
+			j.finish();
+		}
+		client.send("application/json",json);
+		return true;
+	}
+private:
+	void reply(osl::http_served_client &client,const std::string &error,int status,int count=0) {
+		std::string json=(status==200)?
+			"{\"ok\":true,\"set\":"+itos(count)+"}\n":
+			"{\"ok\":false,\"error\":"+escape_JSON(error)+"}\n";
+		client.send_error("application/json",json,status);
+	}
+};
+
+/***************** Change notification **************/
+struct webconfig_subscription {
+	std::string path;
+	webconfig_listener *listener;
+	bool queued; /* wait for webconfig_deliver_changes */
+	std::set<std::string> pending; /* queued changes, not yet delivered */
+};
+
+static porlock change_lock; /* protects everything below */
+static porcond change_cond; /* broadcast after each change */
+static std::vector<webconfig_subscription *> subscriptions;
+/* Listeners we're calling right now, outside the lock, once per call */
+static std::multiset<webconfig_listener *> calling;
+static porcond called_cond; /* broadcast as each of those calls returns */
+static long long change_count=0;
+/* The most recent changes, for event streams: change number and field names */
+static std::deque<std::pair<long long,std::vector<std::string> > > change_history;
+enum {change_history_max=256};
+
+/* Return true if a change to this field is a change to something at path.
+   Fields inside path count, and so do fields path is inside. */
+static bool change_affects(std::string name,const std::string &path) {
+	const std::string length=".length"; /* resizing a container changes all of it */
+	if (name.size()>length.size() && name.compare(name.size()-length.size(),length.size(),length)==0)
+		name.erase(name.size()-length.size());
+	const std::string &shorter=(name.size()<path.size())?name:path;
+	const std::string &longer=(name.size()<path.size())?path:name;
+	if (shorter.size()==0) return true; /* everything */
+	return longer.compare(0,shorter.size(),shorter)==0 && 
+		(longer.size()==shorter.size() || longer[shorter.size()]=='.');
+}
+
+/* Return the names in fields that affect path */
+static std::vector<std::string> changes_affecting(const std::vector<std::string> &fields,const std::string &path) {
+	std::vector<std::string> r;
+	for (unsigned int i=0;i<fields.size();i++)
+		if (change_affects(fields[i],path)) r.push_back(fields[i]);
+	return r;
+}
+
+void webconfig_subscribe(const std::string &path,webconfig_listener *listener,bool queued)
+{
+	webconfig_subscription *sub=new webconfig_subscription;
+	sub->path=path;
+	sub->listener=listener;
+	sub->queued=queued;
+	porlock_scoped l(&change_lock);
+	subscriptions.push_back(sub);
+}
+
+void webconfig_unsubscribe(webconfig_listener *listener)
+{
+	porlock_scoped l(&change_lock);
+	for (unsigned int i=0;i<subscriptions.size();)
+		if (subscriptions[i]->listener==listener) {
+			delete subscriptions[i];
+			subscriptions.erase(subscriptions.begin()+i);
+		}
+		else i++;
+	/* Another thread may have picked up changes for listener just before
+	   we removed it: wait for those calls, so the caller can delete it. */
+	while (calling.count(listener)>0) called_cond.wait(&change_lock);
+}
+
+typedef std::vector<std::pair<webconfig_listener *,std::vector<std::string> > > webconfig_deliveries;
+
+/* Call each listener with its changes.  Each one was added to calling
+   (under change_lock) when it was picked; we take it back out as we go. */
+static void webconfig_deliver(const webconfig_deliveries &now)
+{
+	unsigned int i=0;
+	try {
+		for (;i<now.size();i++) {
+			now[i].first->changed(now[i].second);
+			porlock_scoped l(&change_lock);
+			calling.erase(calling.find(now[i].first));
+			called_cond.broadcast();
+		}
+	} catch (...) { /* a listener threw: the rest won't be called either */
+		porlock_scoped l(&change_lock);
+		for (;i<now.size();i++) calling.erase(calling.find(now[i].first));
+		called_cond.broadcast();
+		throw;
+	}
+}
+
+void webconfig_changed(const std::vector<std::string> &fields)
+{
+	webconfig_deliveries now;
+	{
+		porlock_scoped l(&change_lock);
+		change_count++;
+		change_history.push_back(std::make_pair(change_count,fields));
+		if (change_history.size()>change_history_max) change_history.pop_front();
+		change_cond.broadcast();
+		
+		for (unsigned int i=0;i<subscriptions.size();i++) {
+			webconfig_subscription *sub=subscriptions[i];
+			std::vector<std::string> mine=changes_affecting(fields,sub->path);
+			if (mine.size()==0) continue;
+			if (sub->queued) sub->pending.insert(mine.begin(),mine.end());
+			else {
+				now.push_back(std::make_pair(sub->listener,mine));
+				calling.insert(sub->listener);
+			}
+		}
+	}
+	webconfig_deliver(now);
+}
+
+int webconfig_deliver_changes(void)
+{
+	webconfig_deliveries now;
+	{
+		porlock_scoped l(&change_lock);
+		for (unsigned int i=0;i<subscriptions.size();i++) {
+			webconfig_subscription *sub=subscriptions[i];
+			if (sub->pending.size()==0) continue;
+			now.push_back(std::make_pair(sub->listener,
+				std::vector<std::string>(sub->pending.begin(),sub->pending.end())));
+			calling.insert(sub->listener);
+			sub->pending.clear();
+		}
+	}
+	webconfig_deliver(now);
+	return now.size();
+}
+
+long long webconfig_change_count(void)
+{
+	porlock_scoped l(&change_lock);
+	return change_count;
+}
+
+/**
+ A Server-Sent Events stream of changes, for browsers and scripts:
+	GET /conf.events               every change
+	GET /conf.events?cfg.a&cfg.b   just changes affecting these fields or objects
+ Each change is an event like
+	id: 17
+	event: change
+	data: {"fields":["cfg.a"]}
+ where "" in fields means anything may have changed.  Reconnecting clients
+ send Last-Event-ID, and get any recent changes they missed.
+*/
+class webconfig_events : public osl::http_responder {
+	std::string path;
+public:
+	webconfig_events(const std::string &path_) :path("/"+path_) {}
+	
+	bool respond(osl::http_served_client &client) {
+		std::string p=client.get_path();
+		std::string query;
+		if (p.substr(0,path.size()+1)==path+"?") query=p.substr(path.size()+1);
+		else if (p!=path) return false;
+		std::vector<std::string> select;
+		while (query.size()>0) {
+			size_t amp=query.find('&');
+			select.push_back(unescape_URL(query.substr(0,amp)));
+			query=(amp==std::string::npos)?"":query.substr(amp+1);
+		}
+		if (select.size()==0) select.push_back(""); /* everything */
+		
+		long long last;
+		std::string resume=client.get_header("Last-Event-ID");
+		{
+			porlock_scoped l(&change_lock);
+			last=(resume.size()>0)?atoll(resume.c_str()):change_count;
+			if (last>change_count) last=change_count; /* we restarted since */
+		}
+		client.add_header("Cache-Control","no-cache");
+		client.send_header("text/event-stream",-1);
+		SOCKET s=client.detach_socket(); /* we'll notice a closed connection ourselves */
+		if (s==0) return true; /* not a plain socket, like HTTP/2: can't stream */
+		std::string hello="retry: 2000\nid: "+lltos(last)+"\nevent: ready\ndata: {}\n\n";
+		bool ok=(0==skt_try_sendN(s,&hello[0],hello.size()));
+		while (ok) {
+			std::vector<std::string> fields;
+			bool any=false;
+			{
+				porlock_scoped l(&change_lock);
+				if (change_count==last) change_cond.wait(&change_lock,15000);
+				if (change_count>last) {
+					any=true;
+					if (change_history.size()==0 || change_history.front().first>last+1)
+						fields.push_back(""); /* we missed some: could be anything */
+					for (unsigned int i=0;i<change_history.size();i++)
+						if (change_history[i].first>last)
+							fields.insert(fields.end(),change_history[i].second.begin(),change_history[i].second.end());
+					last=change_count;
+				}
+			}
+			std::string event;
+			if (any) { /* just the fields this client asked about */
+				std::vector<std::string> mine;
+				for (unsigned int i=0;i<fields.size();i++)
+					for (unsigned int j=0;j<select.size();j++)
+						if (change_affects(fields[i],select[j])) {
+							if (std::find(mine.begin(),mine.end(),fields[i])==mine.end()) mine.push_back(fields[i]);
+							break;
+						}
+				if (mine.size()==0) continue;
+				event="id: "+lltos(last)+"\nevent: change\ndata: {\"fields\":[";
+				for (unsigned int i=0;i<mine.size();i++) event+=(i?",":"")+escape_JSON(mine[i]);
+				event+="]}\n\n";
+			}
+			else event=":\n\n"; /* keepalive comment, and a check the client's still there */
+			ok=(0==skt_try_sendN(s,&event[0],event.size()));
+		}
+		skt_close(s);
+		return true;
+	}
+private:
+	static std::string lltos(long long v) {
+		char buf[30];
+		snprintf(buf,30,"%lld",v);
+		return buf;
+	}
+};
+
+/* Restore our objects from this .dat file, and any journal of edits since: */
 void webconfig_restore(const char *configfile)
 {
 	try {
-		std::ifstream config(configfile,std::ios_base::binary);
-		pup_from_binary_file pconf(config);
-		webconfig_pup_all(pconf);
-		if (config)
-			std::cout<<"Restored "<<config.tellg()<<" bytes of objects from "<<configfile<<"\n";
+		config_file_map file;
+		if (file.open(configfile) && file.size>=sizeof(config_file_magic) && 
+			0==memcmp(file.data,config_file_magic,sizeof(config_file_magic)))
+		{ /* self-describing file */
+			pup_from_binary_table pconf;
+			const char *err=pconf.open(file.data,file.size);
+			if (err) std::cout<<"Can't restore from "<<configfile<<": "<<err<<"\n";
+			else {
+				webconfig_pup_all(pconf);
+				std::cout<<"Restored "<<pconf.found<<" of "<<pconf.get_count()<<" fields from "<<configfile<<"\n";
+			}
+		}
+		else { /* old flat file, from before we had names */
+			std::ifstream config(configfile,std::ios_base::binary);
+			pup_from_binary_file pconf(config);
+			webconfig_pup_all(pconf);
+			if (config)
+				std::cout<<"Restored "<<config.tellg()<<" bytes of objects from "<<configfile<<"\n";
+		}
+		file.close();
+		webconfig_invalidate_index();
+		
+		int records=webconfig_replay_journal(journal_filename(configfile));
+		{
+			porlock_scoped l(&webconfig_lock);
+			webconfig_edited();
+		}
+		webconfig_changed(std::vector<std::string>(1,"")); /* anything may have changed */
+		if (records>=0) {
+			std::cout<<"Replayed "<<records<<" journaled edits\n";
+			webconfig_save(configfile); /* start over with a clean snapshot */
+		}
 	}
 	catch (...) {
 		std::cout<<"Tried to restore from "<<configfile<<", but failed...\n";
@@ -438,19 +2067,39 @@ void webconfig_restore(const char *configfile)
 }
 
 
-/* Save a copy of the modified data to our .dat file: */
+/* Save a copy of the modified data to our .dat file.
+   We write a temporary file and rename it into place, so a crash
+   leaves either the old file or the new one, never half of each. */
 void webconfig_save(const char *configfile)
 {
 	try {
-		std::ofstream config(configfile,std::ios_base::binary);
-		pup_to_binary_file pconf(config);
-		webconfig_pup_all(pconf);
+		std::string temp=std::string(configfile)+".tmp";
+		{
+			std::ofstream config(temp.c_str(),std::ios_base::binary);
+			pup_to_binary_table pconf;
+			webconfig_pup_all(pconf);
+			pconf.write(config);
+			config.close();
+			if (!config) throw std::ios_base::failure("write failed");
+		}
+#ifdef _WIN32
+		remove(configfile); /* rename won't replace */
+#endif
+		if (0!=rename(temp.c_str(),configfile)) throw std::ios_base::failure("rename failed");
+		remove(journal_filename(configfile).c_str()); /* it's all in the snapshot now */
 	}
 	catch (...) {
 		std::cout<<"Tried to save to "<<configfile<<", but failed...\n";
 	}	
 }
 
+/* Save web edits to a journal, folded into the config file every compact_bytes */
+void webconfig_journal(bool enable,long compact_bytes)
+{
+	journal_on=enable;
+	journal_compact_bytes=compact_bytes;
+}
+
 osl::http_threaded_server *webconfig_server=0;
 
 /* Create a web server to respond to webconfig requests */
@@ -473,6 +2122,8 @@ void webconfig_init(unsigned int portNumber,bool startBrowser) {
 	}
 
 	webconfig_server->add_responder(new osl::html_logger(std::cout));
+	webconfig_server->add_responder(new webconfig_json("conf.json"));
+	webconfig_server->add_responder(new webconfig_events("conf.events"));
 	webconfig_server->add_responder(new webconfig_editor("conf"));
 	webconfig_server->start();
 }
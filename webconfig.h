@@ -26,7 +26,8 @@
 
 /**
   Webconfig will save your data to this binary file
-  every time you edit it over the web.
+  every time you edit it over the web (or, with webconfig_journal,
+  to this file plus a journal of edits).
 */
 #ifndef WEBCONFIG_FILENAME
 #define WEBCONFIG_FILENAME "config.dat"
@@ -59,7 +60,9 @@ public:
 #define PUPc(commentString) p.comment(commentString)
 
 
-/* Pup's std::vectors */
+/* Pup's std::vectors.  The length here is a temporary: for
+   pup_er_virtual, pup temporaries like it with pup_length or
+   pup_temporary (below), never with plain pup. */
 template <class PUP_er,class T>
 void pup(PUP_er &p,std::vector<T> &v) {
 	int length=v.size();
@@ -111,7 +114,79 @@ public:
 	/* Pup for objects: default is to do nothing */
 	virtual void pup_objectbegin(const char *shortname) {}
 	virtual void pup_objectend(const char *shortname) {}
+	
+	/* Pup a container's length, before its elements.  The length is 
+	   a temporary, so changing it only takes effect by pupping again. */
+	virtual void pup_length(const char *shortname,int &length) {pup(shortname,length);}
+	
+	/* Called around values that only live during this pup call,
+	   like a copy from a getter.  Webconfig indexes the address of
+	   everything else you pup, to edit it directly later, so every
+	   other value must outlive the pup call.  Use pup_temporary, below. */
+	virtual void pup_temporary_begin(void) {}
+	virtual void pup_temporary_end(void) {}
+	
+	/* Called around a container's elements.  storage finds the container's
+	   current element data and count, to tell if it's been reallocated.
+	   Default: ignore containers. */
+	typedef void (*storage_fn)(const void *container,const void **data,size_t *count);
+	virtual void pup_container_begin(const void *container,storage_fn storage) {}
+	virtual void pup_container_end(void) {}
+	
+	/* Pup n contiguous values, named by their indices "0", "1", ... 
+	   in the current object.  Binary pup_ers override these to copy 
+	   the whole array at once; the default pups each value separately. */
+	virtual void pup_array(float *values,int n) {pup_each(values,n);}
+	virtual void pup_array(int *values,int n) {pup_each(values,n);}
+protected:
+	template <class T>
+	void pup_each(T *values,int n) {
+		for (int i=0;i<n;i++) {
+			char index[100];
+			snprintf(index,100,"%d",i);
+			pup(index,values[i]);
+		}
+	}
 };
+
+/* Find a std::vector's element storage, for pup_container_begin */
+template <class T>
+void pup_vector_storage(const void *container,const void **data,size_t *count) {
+	const std::vector<T> &v=*(const std::vector<T> *)container;
+	*data=v.empty()?0:&v[0];
+	*count=v.size();
+}
+
+/* Pup's std::vectors, telling virtual pup_ers where the elements live */
+template <class T>
+void pup(pup_er_virtual &p,std::vector<T> &v) {
+	int length=v.size();
+	p.pup_length("length",length);
+	v.resize(length);
+	
+	p.pup_container_begin(&v,pup_vector_storage<T>);
+	for (int i=0;i<length;i++) {
+		char index[100];
+		snprintf(index,100,"%d",i);
+		pup(p,index,v[i]);
+	}
+	p.pup_container_end();
+}
+
+/* Pup's std::vectors of plain numbers as one array, so binary pup_ers can copy them in bulk */
+template <class T>
+void pup_vector_array(pup_er_virtual &p,std::vector<T> &v) {
+	int length=v.size();
+	p.pup_length("length",length);
+	v.resize(length);
+	
+	p.pup_container_begin(&v,pup_vector_storage<T>);
+	if (length>0) p.pup_array(&v[0],length);
+	p.pup_container_end();
+}
+inline void pup(pup_er_virtual &p,std::vector<float> &v) {pup_vector_array(p,v);}
+inline void pup(pup_er_virtual &p,std::vector<int> &v) {pup_vector_array(p,v);}
+
 	template <class T>
 	void pup(pup_er_virtual &p,const char *shortname,T &value) {
 		p.pup_objectbegin(shortname);
@@ -119,6 +194,17 @@ public:
 		p.pup_objectend(shortname);
 	}
 
+/* Pup a value that isn't stored in your object, like a copy from a
+   getter that you pass to a setter afterwards:
+	int n=v.get_n(); pup_temporary(p,"n",n); v.set_n(n);
+   Edits to it are made by pupping everything again. */
+template <class T>
+void pup_temporary(pup_er_virtual &p,const char *shortname,T &value) {
+	p.pup_temporary_begin();
+	pup(p,shortname,value);
+	p.pup_temporary_end();
+}
+
 
 /************ Webconfig User Functions *************/
 
@@ -128,7 +214,23 @@ void webconfig_restore(const char *configfile=WEBCONFIG_FILENAME);
 /* Save a copy of all persistent data to our .dat file: */
 void webconfig_save(const char *configfile=WEBCONFIG_FILENAME);
 
-/* Create a web server to respond to webconfig requests to read/modify persistent data */
+/**
+  Save web edits incrementally: each edit appends a small checksummed 
+  record to WEBCONFIG_FILENAME.journal, instead of rewriting the whole file.
+  Once the journal grows past compact_bytes, it's folded into a new
+  WEBCONFIG_FILENAME.  webconfig_restore replays any journal it finds.
+*/
+void webconfig_journal(bool enable=true,long compact_bytes=1024*1024);
+
+/* Create a web server to respond to webconfig requests to read/modify persistent data.
+  Besides the HTML editor at /conf, scripts can use JSON at /conf.json:
+	GET /conf.json?obj.a&obj.list  returns {"obj.a":3,"obj.list.length":2,...}
+	                               (or every field, with no query)
+	POST /conf.json {"obj.a":4,"obj.name":"foo"}
+	                               sets all these fields and saves once,
+	                               or on any error changes nothing.
+  and GET /conf.events?obj.a is a Server-Sent Events stream of changes.
+*/
 void webconfig_init(unsigned int portNumber=8888,bool startbrowser=true);
 
 /* This is our server process. Use add_responder to populate the namespace. */
@@ -140,6 +242,8 @@ extern osl::http_threaded_server *webconfig_server;
 class pup_this_object {
 public:
 	virtual void pupto(pup_er_virtual &p) =0;
+	/* Called after webconfig changes this object.  Default: do nothing. */
+	virtual void edited(void) {}
 };
 
 /* Add this object to be pup'd at any time by webconfig. */
@@ -148,6 +252,51 @@ void webconfig_add_pup(pup_this_object *p);
 /* Pup all web config objects registered above */
 void webconfig_pup_all(pup_er_virtual &p);
 
+/* Web edits find fields through an index, built by pupping everything once.
+  Call this if the set of fields your objects pup changes, other than by
+  std::vector resizes, which are noticed automatically. */
+void webconfig_invalidate_index(void);
+
+/* Webconfig holds this lock while it reads or changes your objects. */
+porlock &webconfig_edit_lock(void);
+
+/**
+ Gets told when webconfig changes fields it's subscribed to.
+*/
+class webconfig_listener {
+public:
+	/* These fields changed, by their full dotted names.  An empty name
+	  means anything may have changed, like after webconfig_restore. */
+	virtual void changed(const std::vector<std::string> &fields) =0;
+	virtual ~webconfig_listener() {}
+};
+
+/* Call listener after edits to the field or object at path, like "cfg.list",
+  or anything inside it ("" subscribes to everything).
+  If queued is false, listener is called on the web server thread, just
+  after each edit.  If queued is true, changes pile up (each field once)
+  until your own thread calls webconfig_deliver_changes. */
+void webconfig_subscribe(const std::string &path,webconfig_listener *listener,bool queued=false);
+/* Stop calling this listener, for any path.  If another thread is
+  calling it right now, waits for that call to return, so you can
+  delete listener afterwards.  So don't call this from inside the
+  listener's own changed(). */
+void webconfig_unsubscribe(webconfig_listener *listener);
+
+/* Call the queued listeners that have changes waiting, on this thread.
+  Returns the number of listeners called. */
+int webconfig_deliver_changes(void);
+
+/* Tell listeners these fields changed.  Webconfig calls this after
+  every web edit; call it yourself after changing objects directly. */
+void webconfig_changed(const std::vector<std::string> &fields);
+
+/* Return the number of changes so far: cheap to poll */
+long long webconfig_change_count(void);
+
+/* Called after webconfig changes an object.  Default: do nothing. */
+template <class T> void webconfig_was_edited(T &obj) {}
+
 template <class T>
 class pup_this_object_t : public pup_this_object {
 public:
@@ -155,6 +304,7 @@ public:
 	T &obj;
 	pup_this_object_t(const std::string &name_,T &obj_) :name(name_), obj(obj_) {}
 	virtual void pupto(pup_er_virtual &p) { pup(p,name.c_str(),obj); }
+	virtual void edited(void) { webconfig_was_edited(obj); }
 };
 template <class T> pup_this_object *make_pup_this_object_t(const std::string &name,T &t) {
 	return new pup_this_object_t<T>(name,t);
@@ -170,9 +320,148 @@ template <class T> pup_this_object *make_pup_this_object_t(const std::string &na
 	}	} while(0)
 
 
+/**
+ Configuration that hot threads can read without locks, while webconfig
+ edits it.  Web edits change a private working copy; after each edit,
+ we publish an immutable copy of it with an atomic pointer swap.
+	static webconfig_versioned<my_config> conf;
+	WEBCONFIG_THIS(conf); // edit conf.working over the web
+	...
+	// In each thread that reads it:
+	webconfig_versioned<my_config>::reader r(conf);
+	while (working) {
+		const my_config &c=r.get(); // one atomic load, no lock
+		... use c, until r's next get ...
+	}
+ Old copies are freed once every reader has called get again (or idle),
+ so a reader that stops calling get keeps later copies alive.
+*/
+template <class T>
+class webconfig_versioned {
+public:
+	/* A published copy of the configuration */
+	struct version {
+		T value;
+		long long number; /* counts up from 1 */
+		version(const T &v,long long n) :value(v), number(n) {}
+	};
+	
+	/* The copy webconfig edits.  Only touch it with webconfig_edit_lock held. */
+	T working;
+	
+	webconfig_versioned(const T &initial=T()) :working(initial), published(0) {
+		latest=new version(working,++published);
+		porthread_atomic_store(&current,(long long)(size_t)latest);
+	}
+	~webconfig_versioned() {
+		for (unsigned int i=0;i<retired.size();i++) delete retired[i];
+		delete latest;
+	}
+	
+	/* Replace the configuration, from the application side */
+	void set(const T &v) {
+		porlock_scoped l(&webconfig_edit_lock());
+		working=v;
+		publish();
+	}
+	
+	/* Publish a copy of working.  Call with webconfig_edit_lock held. */
+	void publish(void) {
+		version *v=new version(working,published+1);
+		porlock_scoped l(&readers_lock);
+		retired.push_back(latest);
+		latest=v;
+		published=v->number;
+		/* A full barrier: a reader back from idle either sees the new
+		   version, or has set its seen before we read it in reclaim */
+		porthread_atomic_cas(&current,(long long)(size_t)retired.back(),(long long)(size_t)latest);
+		reclaim();
+	}
+	
+	/**
+	 One thread's way to read the configuration.
+	*/
+	class reader {
+	public:
+		reader(webconfig_versioned<T> &owner_) :owner(owner_) {
+			porlock_scoped l(&owner.readers_lock);
+			last=owner.published;
+			seen=last;
+			owner.readers.push_back(this);
+		}
+		~reader() {
+			porlock_scoped l(&owner.readers_lock);
+			for (unsigned int i=0;i<owner.readers.size();i++)
+				if (owner.readers[i]==this) {
+					owner.readers.erase(owner.readers.begin()+i);
+					break;
+				}
+			owner.reclaim();
+		}
+		
+		/* Return the latest configuration.  It won't change or go away
+		  until this reader's next get or idle call. */
+		const T &get(void) {
+			if (last==0) { /* back from idle: protect every version before we pick one */
+				porthread_atomic_cas(&seen,idle_number,0); /* full barrier, unlike a store */
+			}
+			version *v=(version *)(size_t)porthread_atomic_load(&owner.current);
+			if (v->number!=last) { /* tell the writer we're done with older copies */
+				last=v->number;
+				porthread_atomic_store(&seen,last);
+			}
+			return v->value;
+		}
+		
+		/* We won't read for a while: don't keep any copies alive for us.
+		  Call get again before reading. */
+		void idle(void) {
+			last=0;
+			porthread_atomic_store(&seen,idle_number);
+		}
+	private:
+		friend class webconfig_versioned<T>;
+		webconfig_versioned<T> &owner;
+		long long last; /* number of the copy we're using, or 0 */
+		porthread_atomic_t seen; /* written by us, read by publish */
+		char pad[64]; /* keep other readers off our cache line */
+		reader(const reader &src); /* do not copy */
+		void operator=(const reader &src);
+	};
+private:
+	enum {idle_number=0x7fffffff};
+	porthread_atomic_t current; /* the latest version, for readers */
+	version *latest; /* the same, for writers */
+	long long published; /* versions so far, changed only by writers */
+	porlock readers_lock; /* protects readers, retired, and changes to latest */
+	std::vector<reader *> readers;
+	std::vector<version *> retired; /* replaced, but maybe still being read */
+	
+	/* Free retired versions no reader can still be using */
+	void reclaim(void) {
+		long long oldest=idle_number;
+		for (unsigned int i=0;i<readers.size();i++) {
+			long long s=porthread_atomic_load(&readers[i]->seen);
+			if (s<oldest) oldest=s;
+		}
+		for (unsigned int i=0;i<retired.size();)
+			if (retired[i]->number<oldest) {
+				delete retired[i];
+				retired.erase(retired.begin()+i);
+			}
+			else i++;
+	}
+	webconfig_versioned(const webconfig_versioned<T> &src); /* do not copy */
+	void operator=(const webconfig_versioned<T> &src);
+};
 
-
-
+/* Webconfig sees and edits the working copy */
+template <class T>
+void pup(pup_er_virtual &p,webconfig_versioned<T> &v) {
+	pup(p,v.working);
+}
+/* and publishes it after every edit */
+template <class T> void webconfig_was_edited(webconfig_versioned<T> &v) {v.publish();}
 
 
 #endif
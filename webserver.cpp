@@ -4,6 +4,7 @@
  Orion Sky Lawlor, olawlor@acm.org, 2007/09/28 (Public Domain)
 */
 #include <stdio.h> /* for snprintf */
+#include <ctype.h> /* for tolower */
 #include /*osl/*/"webserver.h"
 
 using namespace osl;
@@ -17,53 +18,372 @@ osl::http_server::http_server(unsigned int port_,int timeoutSeconds)
 http_served_client osl::http_server::serve(void) const
 {
 	skt_ip_t ip; unsigned int port;
-	SOCKET client=skt_accept(s,&ip,&port);
+	SOCKET client=accept_client(&ip,&port);
 	return http_served_client(client,ip,port);
 }
 
 osl::http_served_client::http_served_client(SOCKET socket,skt_ip_t ip_,unsigned int port_)
-	:s(socket), ip(ip_), port(port_), error(0)
+	:s(socket), ip(ip_), port(port_), reply_sink(0), reply_status(0),
+	 reply_chunked(false), chunks_ok(false), reply_bytes(0), error(0),
+	 body_length(0), body_left(0), body_chunked(false), body_started(false), body_source(0)
 {
-	/* Pull down the first HTTP request line.*/
+	/* Pull down the first HTTP request line, like "POST /foo HTTP/1.1" */
 	std::string req=skt_recv_line(s);
-	if (std::string(req,0,4)!="GET ") {error="Malformed HTTP header (only GET supported for now)"; return;}
-	std::string path_ver(req,4); /* clip off "GET " */
-	int ver_start=path_ver.find(" HTTP/"); /* find " HTTP/1.x" marker */
-	path=std::string(path_ver,0,ver_start); /* extract path in between */
+	size_t method_end=req.find(' ');
+	size_t ver_start=req.rfind(" HTTP/"); /* find " HTTP/1.x" marker */
+	if (method_end==0 || method_end==std::string::npos || 
+	    ver_start==std::string::npos || ver_start<=method_end) 
+		{error="Malformed HTTP request line"; return;}
+	method=req.substr(0,method_end);
+	path=req.substr(method_end+1,ver_start-(method_end+1)); /* extract path in between */
+	chunks_ok=(req.compare(ver_start+1,std::string::npos,"HTTP/1.0")!=0);
 	
 	/* Pull down the rest of the HTTP request headers. */
 	std::string l;
 	while (0!=(l=skt_recv_line(s)).size()) 
 	{   /* ^ a zero-length line indicates the end of the HTTP headers */
-		int firstColon=l.find_first_of(":");
+		size_t firstColon=l.find_first_of(":");
+		if (firstColon==std::string::npos) continue; /* not a header; ignore it */
+		size_t value_start=l.find_first_not_of(" \t",firstColon+1);
 		std::string keyword=l.substr(0,firstColon);
-		std::string value=l.substr(firstColon+2,std::string::npos);
+		std::string value=(value_start==std::string::npos)?"":l.substr(value_start);
 		header[keyword]=value;
 	}
+	
+	/* Figure out if a request body follows the headers. */
+	std::string te=header["Transfer-Encoding"];
+	if (te.size()>0 && te!="identity") {
+		body_chunked=true;
+	}
+	else {
+		std::string len=header["Content-Length"];
+		if (len.size()>0) {
+			if (1!=sscanf(len.c_str(),"%lld",&body_length) || body_length<0)
+				{error="Malformed Content-Length"; body_length=0;}
+			body_left=body_length;
+		}
+	}
+}
+
+osl::http_served_client::http_served_client(const std::string &method_,const std::string &path_,
+		const http_header_list &headers,http_body_source *body,
+		http_reply_sink *sink,skt_ip_t ip_,unsigned int port_)
+	:s(0), ip(ip_), port(port_), method(method_), path(path_), 
+	 reply_sink(sink), reply_status(0), reply_chunked(false), chunks_ok(false),
+	 reply_bytes(0), error(0),
+	 body_length(0), body_left(0), body_chunked(false), body_started(true), body_source(body)
+{
+	for (unsigned int i=0;i<headers.size();i++)
+		header[headers[i].first]=headers[i].second;
+	if (body_source) {
+		std::string len=header["Content-Length"];
+		if (len.size()==0 || 1!=sscanf(len.c_str(),"%lld",&body_length) || body_length<0) {
+			body_length=0;
+			body_chunked=true; /* length unknown until the body ends */
+		}
+	}
+}
+
+osl::http_body_source::~http_body_source() {}
+
+bool osl::http_header_less::operator()(const std::string &a,const std::string &b) const
+{
+	size_t n=a.size()<b.size()?a.size():b.size();
+	for (size_t i=0;i<n;i++) {
+		int ca=tolower((unsigned char)a[i]), cb=tolower((unsigned char)b[i]);
+		if (ca!=cb) return ca<cb;
+	}
+	return a.size()<b.size();
+}
+
+/* Return true if this comma-separated header value contains this token, ignoring case */
+static bool header_has_token(const std::string &value,const std::string &token)
+{
+	osl::http_header_less less;
+	size_t start=0;
+	while (start<value.size()) {
+		size_t end=value.find(',',start);
+		if (end==std::string::npos) end=value.size();
+		size_t b=value.find_first_not_of(" \t",start);
+		size_t e=value.find_last_not_of(" \t",end-1);
+		if (b<end && e!=std::string::npos && e>=b) {
+			std::string t=value.substr(b,e+1-b);
+			if (!less(t,token) && !less(token,t)) return true;
+		}
+		start=end+1;
+	}
+	return false;
+}
+
+bool osl::http_served_client::is_upgrade(const std::string &protocol)
+{
+	return header_has_token(header["Connection"],"Upgrade") &&
+		header_has_token(header["Upgrade"],protocol);
+}
+
+/* Prepare to read more body data; returns bytes available in this chunk. */
+long long osl::http_served_client::body_prepare(void)
+{
+	if (!body_started) {
+		body_started=true;
+		/* Clients like curl wait for permission before sending big uploads. */
+		if (header["Expect"]=="100-continue" && has_body()) {
+			static const char cont[]="HTTP/1.1 100 Continue\r\n\r\n";
+			skt_sendN(s,cont,strlen(cont));
+		}
+		if (body_chunked) body_left=-1; /* need first chunk header */
+	}
+	if (body_chunked && body_left<=0 && !error) {
+		if (body_left==0) { /* end of previous chunk: skip its trailing CRLF */
+			if (skt_recv_line(s).size()!=0) {error="Malformed chunk trailer"; return 0;}
+		}
+		/* Read the next chunk size, in hex (possibly followed by ";extension") */
+		std::string sz=skt_recv_line(s);
+		long long len=0;
+		if (1!=sscanf(sz.c_str(),"%llx",&len) || len<0) 
+			{error="Malformed chunk length"; body_chunked=false; body_left=0; return 0;}
+		body_length+=len;
+		if (len==0) { /* last chunk: skip any trailer headers */
+			while (0!=skt_recv_line(s).size()) {}
+			body_chunked=false; /* no more chunks */
+		}
+		body_left=len;
+	}
+	return body_left;
+}
+
+/* Read up to nMax bytes of the request body into dest. */
+int osl::http_served_client::read_body(char *dest,int nMax)
+{
+	if (body_source) return body_source->read_body(dest,nMax);
+	long long avail=body_prepare();
+	if (avail<=0 || nMax<=0) return 0;
+	int n=nMax;
+	if (n>avail) n=(int)avail;
+	skt_recvN(s,dest,n);
+	body_left-=n;
+	return n;
+}
+
+/* Read the rest of the body into a string. */
+std::string osl::http_served_client::read_body_string(int max_length)
+{
+	std::string ret;
+	enum {chunkSize=16*1024};
+	char buf[chunkSize];
+	int n;
+	while (0<(n=read_body(buf,chunkSize))) {
+		if ((int)ret.size()+n>max_length) {
+			error="Request body too long"; 
+			return "";
+		}
+		ret.append(buf,n);
+	}
+	return ret;
+}
+
+#ifdef __linux__
+#include <fcntl.h> /* for splice */
+#endif
+#ifdef _WIN32
+#include <io.h> /* for write */
+#endif
+#include <errno.h>
+#include <vector>
+
+/* Write all n bytes to this file descriptor.  Returns false on error. */
+static bool write_all(int fd,const char *buf,long n) 
+{
+	while (n>0) {
+		long w=write(fd,buf,n);
+		if (w<0 && errno==EINTR) continue;
+		if (w<=0) return false;
+		buf+=w; n-=w;
+	}
+	return true;
+}
+
+/* Copy the rest of the body into this open file descriptor. */
+long long osl::http_served_client::save_body(int fd)
+{
+	long long total=0;
+	enum {chunkSize=64*1024}; /* <- also the default Linux pipe capacity */
+	std::vector<char> buf(chunkSize);
+#ifdef __linux__
+	/* splice moves socket pages into a pipe, then from the pipe into the file */
+	int pipefd[2];
+	if (!body_source && body_prepare()>0 && 0==pipe(pipefd)) {
+		bool splice_out=true; /* false if fd doesn't accept splice (e.g., O_APPEND) */
+		long long avail;
+		while (0<(avail=body_prepare())) {
+			if (0==skt_select1(s,60*1000)) {error="Timeout on request body"; break;}
+			ssize_t in=splice(s,NULL,pipefd[1],NULL,
+				avail<chunkSize?(size_t)avail:chunkSize,SPLICE_F_MOVE|SPLICE_F_MORE);
+			if (in<0 && (errno==EINTR || errno==EAGAIN)) continue;
+			if (in<0 && errno==EINVAL && total==0) break; /* can't splice this socket: copy instead */
+			if (in<=0) {error="Error splicing request body"; break;}
+			body_left-=in;
+			while (in>0 && !error) { /* drain the pipe into the file */
+				ssize_t out=-1;
+				if (splice_out) {
+					out=splice(pipefd[0],NULL,fd,NULL,in,SPLICE_F_MOVE|SPLICE_F_MORE);
+					if (out<0 && errno==EINTR) continue;
+					if (out<0 && errno==EINVAL) splice_out=false;
+				}
+				if (!splice_out) {
+					out=read(pipefd[0],&buf[0],in);
+					if (out>0 && !write_all(fd,&buf[0],out)) out=-1;
+				}
+				if (out<=0) error="Error writing request body to file";
+				else {in-=out; total+=out;}
+			}
+			if (error) break;
+		}
+		::close(pipefd[0]); ::close(pipefd[1]);
+		if (error) return -1;
+	}
+#endif
+	/* Portable version: copy through a fixed-size buffer */
+	int n;
+	while (0<(n=read_body(&buf[0],chunkSize))) {
+		if (!write_all(fd,&buf[0],n)) {error="Error writing request body to file"; return -1;}
+		total+=n;
+	}
+	return total;
+}
+
+/* Return the standard reason phrase for this HTTP status code */
+const char *osl::http_status_name(int status)
+{
+	switch (status) {
+	case 100: return "Continue";
+	case 101: return "Switching Protocols";
+	case 200: return "OK";
+	case 201: return "Created";
+	case 204: return "No Content";
+	case 206: return "Partial Content";
+	case 301: return "Moved Permanently";
+	case 302: return "Found";
+	case 304: return "Not Modified";
+	case 400: return "Bad Request";
+	case 403: return "Forbidden";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 413: return "Payload Too Large";
+	case 416: return "Range Not Satisfiable";
+	case 429: return "Too Many Requests";
+	case 500: return "Internal Server Error";
+	case 502: return "Bad Gateway";
+	case 503: return "Service Unavailable";
+	case 504: return "Gateway Timeout";
+	default: return status<400?"OK":"error";
+	}
 }
 
 /* Send ONLY an HTTP header indicating these many bytes are coming. */
 void osl::http_served_client::send_header(std::string mime_type,
-	int total_data_length,int status)
+	long long total_data_length,int status)
 {
-	enum {header_len=1000};
-	char header[header_len];
-	if (mime_type.size()>=header_len-200) {error="Ridiculous mime_type length"; return;}
-	sprintf(header,
+	if (reply_sink) {
+		reply_sink->reply_header(status,mime_type,total_data_length,reply_header);
+		reply_header.clear();
+		return;
+	}
+	reply_status=status;
+	char statusline[200];
+	snprintf(statusline,sizeof(statusline),
 		"HTTP/1.1 %d %s\r\n"
-		"Content-Length: %d\r\n"
-		"Connection: close\r\n"
-		"Content-Type: %s\r\n"
-		"\r\n", /* blank line indicates end of HTTP header */
-		status,status==200?"OK":"error",
-		total_data_length,
-		mime_type.c_str()
-		);
-	send_raw(header,strlen(header));
+		"Connection: close\r\n",
+		status,http_status_name(status));
+	std::string h=statusline;
+	if (total_data_length>=0) {
+		snprintf(statusline,sizeof(statusline),"Content-Length: %lld\r\n",total_data_length);
+		h+=statusline;
+	}
+	if (mime_type.size()>0) 
+		h+="Content-Type: "+mime_type+"\r\n";
+	for (unsigned int i=0;i<reply_header.size();i++)
+		h+=reply_header[i].first+": "+reply_header[i].second+"\r\n";
+	reply_header.clear();
+	h+="\r\n"; /* blank line indicates end of HTTP header */
+	send_raw(&h[0],h.size());
 }
 
 /* Send these raw data bytes, which eventually must total total_data_length */
 void osl::http_served_client::send_raw(const char *data,int nData)
 {
-	skt_sendN(s,data,nData);
+	if (reply_sink) reply_sink->reply_data(data,nData);
+	else {
+		skt_sendN(s,data,nData);
+		reply_bytes+=nData;
+	}
+}
+
+/* Send a header for a response of unknown length */
+void osl::http_served_client::send_chunked_header(std::string mime_type,int status)
+{
+	reply_chunked=(chunks_ok && !reply_sink); /* sinks do their own framing */
+	if (reply_chunked) add_header("Transfer-Encoding","chunked");
+	send_header(mime_type,-1,status);
+}
+
+/* Send one chunk: its length in hex, the data, and a CRLF */
+void osl::http_served_client::send_chunk(const char *data,int nData)
+{
+	if (nData<=0) return; /* a zero-length chunk would end the response */
+	if (!reply_chunked) {send_raw(data,nData); return;}
+	char len[20];
+	int n=snprintf(len,sizeof(len),"%x\r\n",nData);
+	std::string chunk;
+	chunk.reserve(n+nData+2);
+	chunk.append(len,n);
+	chunk.append(data,nData);
+	chunk.append("\r\n",2);
+	send_raw(&chunk[0],chunk.size()); /* in one piece, so Nagle doesn't hold back the tail */
+}
+
+void osl::http_served_client::end_chunks(void)
+{
+	if (reply_chunked) send_raw("0\r\n\r\n",5);
+	reply_chunked=false;
+}
+
+osl::http_reply_sink::~http_reply_sink() {}
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+/* Send length bytes from this open file, starting at this offset. */
+bool osl::http_served_client::send_file(int fd,long long offset,long long length)
+{
+#if defined(__linux__)
+	while (length>0 && !reply_sink) { /* the kernel copies file pages straight to the socket */
+		off_t off=offset;
+		ssize_t n=sendfile(s,fd,&off,length<(1<<30)?(size_t)length:(1<<30));
+		if (n<0 && (errno==EINTR || errno==EAGAIN)) continue;
+		if (n<0 && (errno==EINVAL || errno==ENOSYS)) break; /* use the copy loop below */
+		if (n<=0) return false;
+		offset+=n; length-=n;
+		reply_bytes+=n;
+	}
+	if (length<=0) return true;
+#endif
+	/* Portable version: read into a buffer, then send it */
+	enum {chunkSize=64*1024};
+	std::vector<char> buf(chunkSize);
+	while (length>0) {
+		int want=length<chunkSize?(int)length:chunkSize;
+#ifdef _WIN32
+		_lseeki64(fd,offset,SEEK_SET);
+		int n=_read(fd,&buf[0],want);
+#else
+		int n=pread(fd,&buf[0],want,offset);
+		if (n<0 && errno==EINTR) continue;
+#endif
+		if (n<=0) return false;
+		send_raw(&buf[0],n);
+		offset+=n; length-=n;
+	}
+	return true;
 }
@@ -7,6 +7,7 @@
 #define __OSL_WEBSERVER_H
 
 #include "webservice.h"
+#include <vector>
 
 
 /* This macro is handy for quoting long strings of HTML.
@@ -16,14 +17,64 @@
 
 namespace osl {
 
+/** Return the standard reason phrase for this HTTP status code, like "Not Found" for 404. */
+OSL_DLL const char *http_status_name(int status);
+
+/**
+ Compares HTTP header keywords, which are case-insensitive
+ ("Content-Length" and "content-length" are the same header).
+*/
+class OSL_DLL http_header_less {
+public:
+	bool operator()(const std::string &a,const std::string &b) const;
+};
+
+/** A list of names and values, like extra HTTP header lines */
+typedef std::vector<std::pair<std::string,std::string> > http_header_list;
+
+/**
+ Receives the response a responder sends to an http_served_client,
+ instead of the client's socket.  This lets a responder's output 
+ be captured (for caching) or re-encoded (for other protocols).
+*/
+class OSL_DLL http_reply_sink {
+public:
+	/* The responder called send_header with these values. */
+	virtual void reply_header(int status,const std::string &mime_type,
+		long long total_data_length,const http_header_list &headers) =0;
+	/* The responder called send_raw with this data. */
+	virtual void reply_data(const char *data,int nData) =0;
+	virtual ~http_reply_sink();
+};
+
+/**
+ Supplies a request body that doesn't come straight off a socket,
+ like the DATA frames of an HTTP/2 stream.
+*/
+class OSL_DLL http_body_source {
+public:
+	/* Read up to nMax bytes of body into dest.
+	   Returns the number of bytes read, or 0 at the end of the body. */
+	virtual int read_body(char *dest,int nMax) =0;
+	virtual ~http_body_source();
+};
+
 /**
  Represents an HTTP connection from one client to our server.
 */
 class OSL_DLL http_served_client {
 public:
 	http_served_client(SOCKET socket,skt_ip_t ip,unsigned int port);
+	/* Make a client for a request that was already parsed by some other
+	   protocol, like HTTP/2.  The request body comes from body 
+	   (0 if there isn't one), and the reply goes to sink. */
+	http_served_client(const std::string &method,const std::string &path,
+		const http_header_list &headers,http_body_source *body,
+		http_reply_sink *sink,skt_ip_t ip,unsigned int port);
 	~http_served_client() { close();}
 	void close(void) { if (s) skt_close(s); s=0; }
+	/* Take over our socket: we'll no longer use or close it. */
+	SOCKET detach_socket(void) {SOCKET r=s; s=0; return r;}
 
 /* Client and request info access: */
 	/** Return the human-readable connection error code, or 0 if none. */
@@ -34,12 +85,69 @@ public:
 	/** Return the TCP port the client connected from. */
 	unsigned int get_port(void) const {return port;}
 	
+	/** Return the HTTP status we've sent back to the client, or 0 if none yet. */
+	int get_reply_status(void) const {return reply_status;}
+	/** Return the number of bytes we've sent back to the client, including headers. */
+	long long get_reply_bytes(void) const {return reply_bytes;}
+	
+	/** Return the HTTP method the client used, like "GET" or "POST" */
+	const std::string get_method(void) const {return method;}
+	
+	/** Return true if the client is asking to switch this connection
+	   to this protocol, like "websocket" or "h2c", with an Upgrade header. */
+	bool is_upgrade(const std::string &protocol);
+	
 	/** Return the path the client has requested, like "/foo/bar.cgi?baz=3"
 	*/
 	const std::string get_path(void) const {return path;}
 
 	/** Look up the value of the client's HTTP header line with this keyword, or empty string if none. */
 	std::string get_header(const std::string &keyword) {return header[keyword];}
+	/** Return all the client's HTTP header lines, in keyword order. */
+	http_header_list get_headers(void) const {
+		http_header_list l;
+		for (std::map<std::string,std::string,http_header_less>::const_iterator it=header.begin();it!=header.end();++it)
+			if (it->second.size()>0) l.push_back(*it);
+		return l;
+	}
+	
+	/** Return the value of this path parameter, like "id" from the 
+	   osl::http_router pattern "/users/:id", or empty string if none. */
+	std::string get_param(const std::string &name) const {
+		for (unsigned int i=0;i<params.size();i++)
+			if (params[i].first==name) return params[i].second;
+		return "";
+	}
+	/** Set the path parameters and router pattern this request matched. */
+	void set_params(const http_header_list &params_,const std::string &route_)
+		{params=params_; route=route_;}
+	/** Return the router pattern this request matched, or empty string if none. */
+	const std::string &get_route(void) const {return route;}
+	
+/* Request body access, for POST, PUT, etc.
+   The body is only pulled off the socket as you read it, so a slow
+   responder applies TCP backpressure to the client rather than 
+   buffering the whole upload in memory.
+*/
+	/** Return true if the client sent a request body. */
+	bool has_body(void) const {return body_length!=0 || body_chunked;}
+	
+	/** Return the total body length from Content-Length,
+	   or -1 if the body is chunked (and the length isn't known yet). */
+	long long get_body_length(void) const {return body_chunked?-1:body_length;}
+	
+	/** Read up to nMax bytes of the request body into dest.
+	   Returns the number of bytes read, or 0 at the end of the body. */
+	int read_body(char *dest,int nMax);
+	
+	/** Read the rest of the body into a string.  
+	   Sets the error and returns empty if the body is longer than max_length. */
+	std::string read_body_string(int max_length=1024*1024);
+	
+	/** Copy the rest of the body into this open file descriptor.
+	   On Linux this uses splice, so the data never visits user space.
+	   Returns the number of bytes written, or -1 on a write error. */
+	long long save_body(int fd);
 	
 /* Send data back to the client */
 	/* Send a complete HTTP header and this data back to the client */
@@ -56,22 +164,69 @@ public:
 	}
 	
 	
+	/* Add this extra line to the next HTTP header we send, like
+		add_header("Last-Modified","Sat, 29 Oct 1994 19:43:31 GMT");
+	*/
+	void add_header(const std::string &keyword,const std::string &value)
+		{reply_header.push_back(std::make_pair(keyword,value));}
+	/* Return the extra header lines added so far */
+	const http_header_list &get_reply_headers(void) const {return reply_header;}
+	
 	/* Send ONLY an HTTP header indicating:
 		- The data to come has this mime_type ("text/html","image/jpeg", ...)
-		- These many bytes are coming for the total response. 
+		- These many bytes are coming for the total response,
+		  or -1 if you don't know yet (the client reads until we close).
 		- The HTTP response status is this.  The default is 200, OK.  404 would work too.
 	*/
-	void send_header(std::string mime_type,int total_data_length,int status=200);
+	void send_header(std::string mime_type,long long total_data_length,int status=200);
 	/* Send these raw data bytes, which eventually must total total_data_length */
 	void send_raw(const char *data,int nData);
 	
+	/* Send ONLY an HTTP header for a response whose length we don't know yet.
+	   Send the data with send_chunk, and then call end_chunks.  HTTP/1.1 clients
+	   get "Transfer-Encoding: chunked", so they can tell a complete response
+	   from one cut short; others just read until we close. */
+	void send_chunked_header(std::string mime_type,int status=200);
+	/* Send these data bytes as the next chunk of the response. */
+	void send_chunk(const char *data,int nData);
+	/* Finish a response started with send_chunked_header. */
+	void end_chunks(void);
+	
+	/* Send length bytes from this open file, starting at this offset.
+	   Uses zero-copy sendfile where the OS supports it.
+	   Returns false if the file couldn't be read. */
+	bool send_file(int fd,long long offset,long long length);
+	
+	/* Send our response to this sink instead of the socket, or 0 for the socket.
+	   Returns the previous sink. */
+	http_reply_sink *set_reply_sink(http_reply_sink *sink)
+		{http_reply_sink *old=reply_sink; reply_sink=sink; return old;}
+	
 	
 private:
 	SOCKET s;
 	skt_ip_t ip; unsigned int port;
+	std::string method; /* GET, POST, ... */
 	std::string path; /* GET ... HTTP/1.x */
-	std::map<std::string,std::string> header; /**< http header names and values */
+	std::map<std::string,std::string,http_header_less> header; /**< http header names and values */
+	http_header_list params; /**< path parameters, from a router */
+	std::string route; /**< router pattern we matched */
+	http_header_list reply_header; /**< extra headers for our response */
+	http_reply_sink *reply_sink; /**< if nonzero, our response goes here */
+	int reply_status; /**< HTTP status code we sent */
+	bool reply_chunked; /**< our response body is being sent in chunks */
+	bool chunks_ok; /**< client understands chunked responses (HTTP/1.1) */
+	long long reply_bytes; /**< bytes we sent */
 	const char *error;
+	
+	long long body_length; /* Content-Length of request body, or 0 if none */
+	long long body_left; /* bytes remaining in the body (or current chunk) */
+	bool body_chunked; /* body uses "Transfer-Encoding: chunked" */
+	bool body_started; /* we've begun reading the body */
+	http_body_source *body_source; /* if nonzero, the body comes from here */
+	
+	/* Prepare to read more body data; returns bytes available in this chunk. */
+	long long body_prepare(void);
 };
 
 /**
@@ -99,6 +254,11 @@ public:
 	*/
 	http_served_client serve(void) const;
 	
+	/* Accept the waiting client's TCP connection, without reading the request yet.
+	   Returns the new socket, and fills out the client's IP and port. */
+	SOCKET accept_client(skt_ip_t *ip,unsigned int *port) const 
+		{return skt_accept(s,ip,port);}
+	
 private:
 	SERVER_SOCKET s;
 	unsigned int port;
@@ -0,0 +1,129 @@
+/**
+  Admission control for osl/webserver_threaded.
+*/
+#include "webserver_admission.h"
+#include <stdio.h> /* for snprintf */
+
+#if _WIN32
+#define snprintf _snprintf
+#endif
+
+/* Longest run of slots we'll search for an IP.  Keeps both lookups
+   and a full table cheap, at the cost of sometimes not tracking an IP. */
+enum {http_admission_probes=16};
+
+osl::http_admission::http_admission(int max_connections_,int max_per_ip_,
+	double rate_,double burst_,int table_size)
+	:max_connections(max_connections_), max_per_ip(max_per_ip_),
+	 rate(rate_), burst(burst_), connections(0), rejected(0)
+{
+	unsigned int size=16;
+	while (size<(unsigned int)table_size) size*=2;
+	mask=size-1;
+	table=new slot[size];
+	for (unsigned int i=0;i<size;i++) {
+		table[i].ip=0; table[i].connections=0;
+		table[i].tokens=burst; table[i].last=0;
+	}
+}
+osl::http_admission::~http_admission()
+{
+	delete[] table;
+}
+
+/* Add tokens earned since the slot was last touched */
+void osl::http_admission::refill(slot *s,double now)
+{
+	s->tokens+=(now-s->last)*rate;
+	if (s->tokens>burst) s->tokens=burst;
+	s->last=now;
+}
+
+/* Return the slot for this IP, or 0 if it's not there (and add is false,
+   or there's no room).  Slots are never emptied, but an idle slot, 
+   with no connections and a full bucket, is as good as empty and 
+   can be handed to a new IP. */
+osl::http_admission::slot *osl::http_admission::find(unsigned int ip,double now,bool add)
+{
+	unsigned int h=ip*2654435761u; /* Knuth multiplicative hash */
+	h^=h>>15;
+	slot *idle=0;
+	for (int probe=0;probe<http_admission_probes;probe++) {
+		slot *s=&table[(h+probe)&mask];
+		if (s->ip==ip) return s;
+		if (s->ip==0) { /* end of this run: ip isn't in the table */
+			if (!idle) idle=s;
+			break;
+		}
+		if (add && !idle && s->connections==0) {
+			refill(s,now);
+			if (s->tokens>=burst) idle=s;
+		}
+	}
+	if (!add || !idle) return 0;
+	idle->ip=ip;
+	idle->connections=0;
+	idle->tokens=burst;
+	idle->last=now;
+	return idle;
+}
+
+/* Pack an IPv4 address into a nonzero table key */
+static unsigned int http_admission_key(skt_ip_t ip) {
+	unsigned int k=(ip.data[0]<<24)|(ip.data[1]<<16)|(ip.data[2]<<8)|ip.data[3];
+	return k?k:1; /* 0.0.0.0 shares with 0.0.0.1 */
+}
+
+int osl::http_admission::admit(skt_ip_t ip,bool *tracked)
+{
+	double now=porthread_time();
+	porlock_scoped l(&lock);
+	if (max_connections>0 && connections>=max_connections) {
+		rejected++;
+		return 503;
+	}
+	slot *s=find(http_admission_key(ip),now,true);
+	if (s) {
+		if (max_per_ip>0 && s->connections>=max_per_ip) {
+			rejected++;
+			return 429;
+		}
+		if (rate>0) {
+			refill(s,now);
+			if (s->tokens<1.0) {
+				rejected++;
+				return 429;
+			}
+			s->tokens-=1.0;
+		}
+		s->connections++;
+	}
+	*tracked=(s!=0);
+	connections++;
+	return 0;
+}
+
+void osl::http_admission::release(skt_ip_t ip,bool tracked)
+{
+	porlock_scoped l(&lock);
+	connections--;
+	if (!tracked) return; /* never counted against any IP's slot */
+	slot *s=find(http_admission_key(ip),0,false);
+	if (s && s->connections>0) s->connections--;
+}
+
+void osl::http_admission::reject(SOCKET s,int status)
+{
+	char reply[300];
+	int len=snprintf(reply,sizeof(reply),
+		"HTTP/1.1 %d %s\r\n"
+		"Retry-After: 1\r\n"
+		"Content-Length: 0\r\n"
+		"Connection: close\r\n"
+		"\r\n",status,osl::http_status_name(status));
+	/* A fresh socket's send buffer is empty, so this can't block;
+	   and if it fails, we're closing anyway.  skt_try_sendN ignores
+	   the SIGPIPE from a client that has already reset. */
+	skt_try_sendN(s,reply,len);
+	skt_close(s);
+}
@@ -0,0 +1,76 @@
+/**
+  Admission control for osl/webserver_threaded: limits how many
+  connections and requests each client IP address gets.
+
+  A typical usage is
+	server->set_admission(new osl::http_admission(500,16,20.0,40.0));
+  which allows 500 connections total, 16 at once from any one IP,
+  and 20 requests per second per IP with bursts of up to 40.
+
+  Clients over the limit are turned away in the server's accept
+  thread, before we spawn a thread or parse their request, so an
+  overloaded server spends almost nothing on the excess clients.
+*/
+#ifndef __OSL_WEBSERVER_ADMISSION_H
+#define __OSL_WEBSERVER_ADMISSION_H 1
+
+#include "webserver_threaded.h"
+
+namespace osl {
+
+class OSL_DLL http_admission {
+public:
+	/**
+	  Allow at most max_connections clients at once, and at most 
+	  max_per_ip of them from any one IP address.  Each IP address
+	  gets rate new requests per second, with bursts of up to burst.
+	  A limit of 0 disables that check.  Up to table_size IP addresses
+	  are tracked at once; if more than that are active, the newcomers 
+	  are only held to the global connection limit.
+	*/
+	http_admission(int max_connections=1000,int max_per_ip=32,
+		double rate=50.0,double burst=100.0,int table_size=4096);
+	~http_admission();
+
+	/** Decide whether to serve a new connection from this IP.
+	   Returns 0 to admit it (in which case you must call release later),
+	   or the HTTP status to reject it with: 503 if the whole server
+	   is full, or 429 if this IP is over its limits.
+	   If we admit it, tracked is set to whether we counted it 
+	   against its IP address (we can't if the table is full). */
+	int admit(skt_ip_t ip,bool *tracked);
+	/** This admitted connection is finished.  Pass tracked from admit. */
+	void release(skt_ip_t ip,bool tracked);
+
+	/** Turn away this connection, by sending status and closing it.
+	   Never blocks, and never reads the client's request. */
+	static void reject(SOCKET s,int status);
+
+	/* Statistics */
+	int get_connections(void) const {return connections;}
+	long long get_rejected(void) const {return rejected;}
+
+private:
+	/* What we know about one IP address */
+	struct slot {
+		unsigned int ip; /* 0 for an empty slot */
+		int connections; /* currently open */
+		double tokens; /* requests allowed right now */
+		double last; /* porthread_time() tokens were last refilled */
+	};
+	int max_connections, max_per_ip;
+	double rate, burst;
+
+	porlock lock; /* protects everything below */
+	slot *table; /* open-addressed, linear probing */
+	unsigned int mask; /* table size minus one */
+	int connections; /* total open */
+	long long rejected;
+
+	slot *find(unsigned int ip,double now,bool add);
+	void refill(slot *s,double now);
+};
+
+}; /* end namespace osl */
+
+#endif
@@ -0,0 +1,304 @@
+/**
+  Caches the responses of another osl::http_responder in memory.
+*/
+#include "webserver_cache.h"
+#include <stdio.h> /* for snprintf */
+
+#if _WIN32
+#define snprintf _snprintf
+#endif
+
+/* Return true if these are the same HTTP header keyword */
+static bool same_header(const std::string &a,const std::string &b) {
+	osl::http_header_less less;
+	return !less(a,b) && !less(b,a);
+}
+
+/**
+ Captures a responder's reply, so we can cache it.
+ If the reply turns out to be uncacheable (wrong status, or too big),
+ we switch to passing it straight through to the real client.
+*/
+class cached_responder_capture : public osl::http_reply_sink {
+public:
+	osl::http_served_client &client;
+	osl::http_reply_sink *prev; /* where the reply would have gone */
+	long long limit; /* largest body we'll buffer */
+	bool passthrough; /* we've given up capturing */
+	bool have_header, header_sent;
+	int status;
+	std::string mime_type;
+	long long length;
+	osl::http_header_list headers;
+	std::string body;
+
+	cached_responder_capture(osl::http_served_client &client_,long long limit_)
+		:client(client_), limit(limit_), passthrough(false),
+		 have_header(false), header_sent(false), status(0), length(0)
+	{
+		prev=client.set_reply_sink(this);
+	}
+	~cached_responder_capture() {
+		client.set_reply_sink(prev);
+	}
+
+	void reply_header(int status_,const std::string &mime_type_,
+		long long length_,const osl::http_header_list &headers_)
+	{
+		have_header=true;
+		status=status_; mime_type=mime_type_; length=length_; headers=headers_;
+		if (status!=200 || length<0 || length>limit) flush();
+	}
+	void reply_data(const char *data,int nData) {
+		if (passthrough) forward(data,nData);
+		else {
+			body.append(data,nData);
+			if ((long long)body.size()>limit) flush();
+		}
+	}
+
+	/* Stop capturing, and send everything we've got to the real client. */
+	void flush(void) {
+		passthrough=true;
+		if (have_header && !header_sent) {
+			header_sent=true;
+			client.set_reply_sink(prev);
+			for (unsigned int i=0;i<headers.size();i++)
+				client.add_header(headers[i].first,headers[i].second);
+			client.send_header(mime_type,length,status);
+			client.set_reply_sink(this);
+		}
+		if (body.size()>0) forward(&body[0],body.size());
+		body="";
+	}
+	void forward(const char *data,int nData) {
+		client.set_reply_sink(prev);
+		client.send_raw(data,nData);
+		client.set_reply_sink(this);
+	}
+
+	/* Return true if what we captured can be cached,
+	   given the request headers that are part of our key. */
+	bool cacheable(const std::vector<std::string> &vary) const {
+		if (passthrough || !have_header || status!=200 || (long long)body.size()!=length)
+			return false;
+		for (unsigned int i=0;i<headers.size();i++) {
+			const std::string &k=headers[i].first, &v=headers[i].second;
+			if (same_header(k,"Set-Cookie"))
+				return false; /* somebody's session: never hand it to anybody else */
+			if (same_header(k,"Cache-Control") &&
+			    (v.find("no-store")!=std::string::npos || v.find("private")!=std::string::npos ||
+			     v.find("no-cache")!=std::string::npos))
+				return false;
+			if (same_header(k,"Vary") && !varies_within(v,vary))
+				return false;
+		}
+		return true;
+	}
+
+	/* Return true if every header in this comma-separated Vary list
+	   is one we key on (so "*" never is). */
+	static bool varies_within(const std::string &value,const std::vector<std::string> &vary) {
+		size_t start=0;
+		while (start<value.size()) {
+			size_t end=value.find(',',start);
+			if (end==std::string::npos) end=value.size();
+			size_t b=value.find_first_not_of(" \t",start);
+			size_t e=value.find_last_not_of(" \t",end-1);
+			if (b<end && e!=std::string::npos && e>=b) {
+				std::string name=value.substr(b,e+1-b);
+				bool keyed=false;
+				for (unsigned int i=0;i<vary.size();i++)
+					if (same_header(name,vary[i])) keyed=true;
+				if (!keyed) return false;
+			}
+			start=end+1;
+		}
+		return true;
+	}
+};
+
+osl::cached_responder::cached_responder(http_responder *inner_,int ttl_msec,long long max_bytes_)
+	:inner(inner_), ttl(ttl_msec*0.001), max_bytes(max_bytes_), wait_msec(10000), total_bytes(0)
+{}
+
+osl::cached_responder::~cached_responder()
+{
+	while (!lru.empty()) remove_locked(lru.back());
+}
+
+std::string osl::cached_responder::make_key(osl::http_served_client &client)
+{
+	std::string key=client.get_path();
+	for (unsigned int i=0;i<vary.size();i++)
+		key+="\n"+vary[i]+": "+client.get_header(vary[i]);
+	return key;
+}
+
+/* Return true if this request header is part of our key */
+bool osl::cached_responder::keyed_on(const std::string &request_header) const
+{
+	for (unsigned int i=0;i<vary.size();i++)
+		if (same_header(vary[i],request_header)) return true;
+	return false;
+}
+
+/* Take this entry out of the cache.  Senders may still hold references. */
+void osl::cached_responder::remove_locked(entry *e)
+{
+	entries.erase(e->key);
+	lru.erase(e->lru);
+	total_bytes-=e->body.size();
+	release_locked(e);
+}
+void osl::cached_responder::release_locked(entry *e)
+{
+	if (--e->refs==0) delete e;
+}
+
+void osl::cached_responder::invalidate(const std::string &path_prefix)
+{
+	porlock_scoped l(&lock);
+	std::list<entry *>::iterator it=lru.begin();
+	while (it!=lru.end()) {
+		entry *e=*it++; /* advance before remove_locked erases e's list node */
+		if (e->path.compare(0,path_prefix.size(),path_prefix)==0)
+			remove_locked(e);
+	}
+}
+
+/* Send this cached response to this client */
+void osl::cached_responder::send_entry(osl::http_served_client &client,entry *e)
+{
+	std::string inm=client.get_header("If-None-Match");
+	if (inm.size()>0 && (inm==e->etag || inm=="*" || inm=="W/"+e->etag))
+	{ /* client's copy is still good */
+		client.add_header("ETag",e->etag);
+		client.send_header("",e->body.size(),304);
+		return;
+	}
+	for (unsigned int i=0;i<e->headers.size();i++)
+		client.add_header(e->headers[i].first,e->headers[i].second);
+	client.send_header(e->mime_type,e->body.size(),e->status);
+	if (client.get_method()!="HEAD" && e->body.size()>0)
+		client.send_raw(&e->body[0],e->body.size());
+}
+
+/* Run the inner responder as the flight leader, and cache its result if possible. */
+bool osl::cached_responder::fill(osl::http_served_client &client,const std::string &key,flight *f)
+{
+	bool handled=false;
+	entry *e=0;
+	try {
+		cached_responder_capture cap(client,max_bytes/4);
+		handled=inner->respond(client);
+		if (handled && cap.cacheable(vary)) {
+			e=new entry;
+			e->key=key;
+			e->path=client.get_path();
+			e->status=cap.status;
+			e->mime_type=cap.mime_type;
+			e->headers=cap.headers;
+			e->body.swap(cap.body);
+			for (unsigned int i=0;i<e->headers.size();i++)
+				if (same_header(e->headers[i].first,"ETag"))
+					e->etag=e->headers[i].second;
+			if (e->etag.size()==0) { /* make our own validator from the body contents */
+				unsigned long long h=14695981039346656037ULL; /* FNV-1a */
+				for (unsigned int i=0;i<e->body.size();i++)
+					h=(h^(unsigned char)e->body[i])*1099511628211ULL;
+				char tag[100];
+				snprintf(tag,sizeof(tag),"\"c%016llx\"",h);
+				e->etag=tag;
+				e->headers.push_back(std::make_pair(std::string("ETag"),e->etag));
+			}
+		}
+		else cap.flush(); /* send whatever the responder gave us */
+	} catch (...) {
+		delete e;
+		finish(key,f,0);
+		throw;
+	}
+	finish(key,f,e);
+	if (e) { /* capture is finished, so this goes to the client */
+		send_entry(client,e);
+		porlock_scoped l(&lock);
+		release_locked(e);
+	}
+	return handled;
+}
+
+/* The leader is done with this flight: publish entry e (if any), and wake the waiters. */
+void osl::cached_responder::finish(const std::string &key,flight *f,entry *e)
+{
+	porlock_scoped l(&lock);
+	if (e) {
+		e->expires=porthread_time()+ttl;
+		e->refs=2; /* one for the cache, one for the leader to send it */
+		lru.push_front(e);
+		e->lru=lru.begin();
+		entries[key]=e;
+		total_bytes+=e->body.size();
+		while (total_bytes>max_bytes && lru.size()>1) remove_locked(lru.back());
+	}
+	flights.erase(key);
+	f->finished=true;
+	f->cacheable=(e!=0);
+	f->done.broadcast();
+	if (--f->refs==0) delete f;
+}
+
+bool osl::cached_responder::respond(osl::http_served_client &client)
+{
+	std::string method=client.get_method();
+	if (method!="GET" && method!="HEAD") return inner->respond(client);
+	if (client.get_header("Range").size()>0) return inner->respond(client); /* partial content */
+	if ((client.get_header("Authorization").size()>0 && !keyed_on("Authorization")) ||
+	    (client.get_header("Cookie").size()>0 && !keyed_on("Cookie")))
+		return inner->respond(client); /* reply may be just for this user */
+	std::string key=make_key(client);
+
+	lock.lock();
+	while (true) {
+		std::map<std::string,entry *>::iterator it=entries.find(key);
+		if (it!=entries.end()) {
+			entry *e=it->second;
+			if (porthread_time()<e->expires) { /* cache hit */
+				e->refs++;
+				lru.splice(lru.begin(),lru,e->lru); /* move to front */
+				lock.unlock();
+				send_entry(client,e);
+				porlock_scoped l(&lock);
+				release_locked(e);
+				return true;
+			}
+			remove_locked(e); /* stale */
+		}
+		if (method=="HEAD") break; /* HEAD misses don't fill the cache */
+
+		std::map<std::string,flight *>::iterator fit=flights.find(key);
+		if (fit==flights.end()) { /* we're the leader: go fill the cache */
+			flight *f=new flight; /* starts with our reference */
+			flights[key]=f;
+			lock.unlock();
+			return fill(client,key,f);
+		}
+
+		/* Somebody else is already generating this response: wait for it,
+		   but not forever, in case the leader is stuck. */
+		flight *f=fit->second;
+		f->refs++;
+		double deadline=porthread_time()+wait_msec*0.001;
+		bool gave_up=false;
+		while (!f->finished) {
+			int left=(int)((deadline-porthread_time())*1000);
+			if (left<=0) {gave_up=true; break;}
+			f->done.wait(&lock,left);
+		}
+		bool cacheable=f->cacheable && !gave_up;
+		if (--f->refs==0) delete f;
+		if (!cacheable) break; /* their reply was uncacheable or late: run it ourselves */
+	}
+	lock.unlock();
+	return inner->respond(client);
+}
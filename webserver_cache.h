@@ -0,0 +1,105 @@
+/**
+  Caches the responses of another osl::http_responder in memory.
+
+  Wrap any responder whose output only depends on the request path
+  (and a few request headers), and repeated requests are answered
+  straight from memory instead of re-running the responder:
+	server->add_responder(new osl::cached_responder(new my_slow_responder,2000));
+*/
+#ifndef __OSL_WEBSERVER_CACHE_H
+#define __OSL_WEBSERVER_CACHE_H 1
+
+#include "webserver_threaded.h"
+#include <map>
+#include <list>
+
+namespace osl {
+
+/*
+ Caching decorator for an http_responder.
+ Only successful (200) GET responses are cached, and never replies that
+ set a cookie, that Cache-Control says not to store or to revalidate,
+ or that Vary on a header we don't key on.  Requests carrying
+ Authorization or Cookie bypass the cache unless we key on that header.
+ Entries expire after
+ a time-to-live, and the least recently used entries are evicted
+ to stay under a total size limit.  Concurrent misses for the same
+ key are coalesced: one thread runs the responder, and the rest wait
+ for its result.
+*/
+class OSL_DLL cached_responder : public http_responder {
+public:
+	/**
+	  Cache the responses of inner for ttl_msec milliseconds,
+	  using up to max_bytes of memory.  inner is never deleted.
+	*/
+	cached_responder(http_responder *inner,int ttl_msec=1000,
+		long long max_bytes=16*1024*1024);
+	~cached_responder();
+
+	/** Also key cached responses on the value of this request header,
+	   like "Accept-Encoding" or "Cookie". */
+	void vary_on(const std::string &request_header)
+		{vary.push_back(request_header);}
+
+	/** Wait at most this long for another thread generating the same
+	   response, before giving up and running the responder ourselves. */
+	void set_wait(int msec) {wait_msec=msec;}
+
+	/** Throw away all cached responses whose path starts with this prefix.
+	   Call this when the underlying data changes. */
+	void invalidate(const std::string &path_prefix="");
+
+	/* CAUTION: MULTITHREADED CALLS! */
+	bool respond(osl::http_served_client &client);
+
+private:
+	/* One cached response */
+	class entry {
+	public:
+		std::string key;
+		std::string path;
+		int status;
+		std::string mime_type;
+		http_header_list headers;
+		std::string etag; /* validator, from the responder or made by us */
+		std::string body;
+		double expires; /* time this entry goes stale */
+		int refs; /* one for the cache, plus one per client it's being sent to */
+		std::list<entry *>::iterator lru; /* our place in the LRU list */
+	};
+	/* A response some thread is busy generating */
+	class flight {
+	public:
+		porcond done; /* broadcast when the leader finishes */
+		bool finished;
+		bool cacheable; /* false if the leader's response couldn't be cached */
+		int refs; /* the leader, plus any waiting threads */
+		flight() :finished(false), cacheable(true), refs(1) {}
+	};
+
+	http_responder *inner;
+	double ttl;
+	long long max_bytes;
+	std::vector<std::string> vary;
+	int wait_msec; /* longest we'll wait on another thread's flight */
+
+	porlock lock; /* protects everything below */
+	std::map<std::string,entry *> entries;
+	std::list<entry *> lru; /* most recently used at front */
+	long long total_bytes;
+	std::map<std::string,flight *> flights;
+
+	std::string make_key(osl::http_served_client &client);
+	bool keyed_on(const std::string &request_header) const;
+	void send_entry(osl::http_served_client &client,entry *e);
+	void remove_locked(entry *e);
+	void release_locked(entry *e);
+	/* Run the inner responder, and cache its result if possible. */
+	bool fill(osl::http_served_client &client,const std::string &key,flight *f);
+	void finish(const std::string &key,flight *f,entry *e);
+};
+
+}; /* end namespace osl */
+
+#endif
@@ -0,0 +1,983 @@
+/**
+  HTTP/2 over cleartext TCP ("h2c") for osl/webserver_threaded.
+  See RFC 7540 (HTTP/2) and RFC 7541 (HPACK).
+*/
+#include "webserver_http2.h"
+#include "webserver_metrics.h"
+#include <stdio.h> /* for snprintf */
+#include <string.h>
+#include <map>
+#if !defined(_WIN32)
+#include <netinet/tcp.h> /* for TCP_NODELAY */
+#endif
+
+#if _WIN32
+#define snprintf _snprintf
+#endif
+
+/************************ HPACK ***********************/
+
+/* RFC 7541 Appendix A */
+static const char *hpack_static[][2]={
+	{":authority",""},{":method","GET"},{":method","POST"},{":path","/"},
+	{":path","/index.html"},{":scheme","http"},{":scheme","https"},{":status","200"},
+	{":status","204"},{":status","206"},{":status","304"},{":status","400"},
+	{":status","404"},{":status","500"},{"accept-charset",""},{"accept-encoding","gzip, deflate"},
+	{"accept-language",""},{"accept-ranges",""},{"accept",""},{"access-control-allow-origin",""},
+	{"age",""},{"allow",""},{"authorization",""},{"cache-control",""},
+	{"content-disposition",""},{"content-encoding",""},{"content-language",""},{"content-length",""},
+	{"content-location",""},{"content-range",""},{"content-type",""},{"cookie",""},
+	{"date",""},{"etag",""},{"expect",""},{"expires",""},
+	{"from",""},{"host",""},{"if-match",""},{"if-modified-since",""},
+	{"if-none-match",""},{"if-range",""},{"if-unmodified-since",""},{"last-modified",""},
+	{"link",""},{"location",""},{"max-forwards",""},{"proxy-authenticate",""},
+	{"proxy-authorization",""},{"range",""},{"referer",""},{"refresh",""},
+	{"retry-after",""},{"server",""},{"set-cookie",""},{"strict-transport-security",""},
+	{"transfer-encoding",""},{"user-agent",""},{"vary",""},{"via",""},
+	{"www-authenticate",""}
+};
+enum {hpack_n_static=61};
+
+int osl::hpack_table::count(void) const 
+{
+	return hpack_n_static+dynamic.size();
+}
+
+bool osl::hpack_table::get(int i,std::string &name,std::string &value) const
+{
+	if (i<1) return false;
+	if (i<=hpack_n_static) {
+		name=hpack_static[i-1][0]; value=hpack_static[i-1][1];
+		return true;
+	}
+	i-=hpack_n_static+1;
+	if (i>=(int)dynamic.size()) return false;
+	name=dynamic[i].first; value=dynamic[i].second;
+	return true;
+}
+
+int osl::hpack_table::find(const std::string &name,const std::string &value,int *name_index) const
+{
+	if (name_index) *name_index=0;
+	for (int i=0;i<hpack_n_static;i++)
+		if (name==hpack_static[i][0]) {
+			if (value==hpack_static[i][1]) return i+1;
+			if (name_index && *name_index==0) *name_index=i+1;
+		}
+	for (unsigned int i=0;i<dynamic.size();i++)
+		if (name==dynamic[i].first) {
+			if (value==dynamic[i].second) return hpack_n_static+1+i;
+			if (name_index && *name_index==0) *name_index=hpack_n_static+1+i;
+		}
+	return 0;
+}
+
+void osl::hpack_table::add(const std::string &name,const std::string &value)
+{
+	int entry=name.size()+value.size()+32; /* RFC 7541 4.1 */
+	if (entry>max_size) { /* doesn't fit: just empties the table */
+		dynamic.clear(); size=0;
+		return;
+	}
+	dynamic.push_front(std::make_pair(name,value));
+	size+=entry;
+	evict();
+}
+
+void osl::hpack_table::resize(int new_max_size)
+{
+	max_size=new_max_size;
+	evict();
+}
+
+void osl::hpack_table::evict(void)
+{
+	while (size>max_size && dynamic.size()>0) {
+		size-=dynamic.back().first.size()+dynamic.back().second.size()+32;
+		dynamic.pop_back();
+	}
+}
+
+/* Huffman code lengths for each byte, plus EOS (RFC 7541 Appendix B).
+   The code is canonical, so the codes themselves follow from the lengths. */
+static const unsigned char hpack_huffman_len[257]={
+	13,23,28,28,28,28,28,28,28,24,30,28,28,30,28,28,28,28,28,28,28,28,30,28,28,28,28,28,28,28,28,28,
+	6,10,10,12,13,6,8,11,10,10,8,11,8,6,6,6,5,5,5,6,6,6,6,6,6,6,7,8,15,6,12,10,
+	13,6,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,8,7,8,13,19,13,14,6,
+	15,5,6,5,6,5,6,6,6,5,7,7,6,6,6,5,6,7,6,5,5,6,7,7,7,7,7,15,11,14,13,28,
+	20,22,20,20,22,22,22,23,22,23,23,23,23,23,24,23,24,24,22,23,24,23,23,23,23,21,22,23,22,23,23,24,
+	22,21,20,22,22,23,23,21,23,22,22,24,21,22,23,23,21,21,22,21,23,22,23,23,20,22,22,22,23,22,22,23,
+	26,26,20,19,22,23,22,25,26,26,26,27,27,26,24,25,19,21,26,27,27,26,27,24,21,21,26,26,28,27,27,27,
+	20,24,20,21,22,21,21,23,22,22,25,25,24,24,26,23,26,27,26,26,27,27,27,27,27,28,27,27,27,27,27,26,
+	30
+};
+
+/* The canonical Huffman code, built from hpack_huffman_len at startup */
+class hpack_huffman {
+public:
+	unsigned int code[257]; /* code for each symbol, right-aligned */
+	/* For decoding: symbols sorted by code, and per code length 
+	   the first code and its position in that list. */
+	unsigned short sorted[257];
+	unsigned int first[31];
+	int first_index[31], n_with_len[31];
+
+	hpack_huffman() {
+		int n=0;
+		for (int len=1;len<=30;len++) {
+			first_index[len]=n;
+			n_with_len[len]=0;
+			for (int sym=0;sym<257;sym++)
+				if (hpack_huffman_len[sym]==len) {sorted[n++]=sym; n_with_len[len]++;}
+		}
+		unsigned int c=0;
+		for (int len=1;len<=30;len++) {
+			first[len]=c;
+			for (int k=0;k<n_with_len[len];k++) 
+				code[sorted[first_index[len]+k]]=c++;
+			c<<=1;
+		}
+	}
+
+	/* Return the length of this string, Huffman encoded. */
+	int encoded_length(const std::string &s) const {
+		long long bits=0;
+		for (unsigned int i=0;i<s.size();i++) bits+=hpack_huffman_len[(unsigned char)s[i]];
+		return (int)((bits+7)/8);
+	}
+	void encode(const std::string &s,std::string &out) const {
+		unsigned long long acc=0; /* bits waiting to be written */
+		int nbits=0;
+		for (unsigned int i=0;i<s.size();i++) {
+			unsigned char c=s[i];
+			acc=(acc<<hpack_huffman_len[c])|code[c];
+			nbits+=hpack_huffman_len[c];
+			while (nbits>=8) {nbits-=8; out+=(char)(acc>>nbits);}
+		}
+		if (nbits>0) /* pad with the high bits of EOS, which are all ones */
+			out+=(char)((acc<<(8-nbits))|(0xff>>nbits));
+	}
+	bool decode(const unsigned char *data,int len,std::string &out) const {
+		unsigned int c=0; /* code so far */
+		int clen=0; /* bits in c */
+		for (int i=0;i<len;i++)
+			for (int b=7;b>=0;b--) {
+				c=(c<<1)|((data[i]>>b)&1);
+				clen++;
+				if (clen>30) return false;
+				if (c-first[clen]<(unsigned int)n_with_len[clen]) { /* a whole code */
+					int sym=sorted[first_index[clen]+(c-first[clen])];
+					if (sym==256) return false; /* EOS in the string is an error */
+					out+=(char)sym;
+					c=0; clen=0;
+				}
+			}
+		/* Leftovers must be fewer than 8 bits of EOS padding (all ones) */
+		return clen<8 && c==(1u<<clen)-1;
+	}
+};
+static const hpack_huffman hpack_huff;
+
+/* Append this integer, with an n-bit prefix whose high bits are flags. */
+static void hpack_put_int(std::string &out,int flags,int n,unsigned int v)
+{
+	unsigned int limit=(1u<<n)-1;
+	if (v<limit) {out+=(char)(flags|v); return;}
+	out+=(char)(flags|limit);
+	v-=limit;
+	while (v>=128) {out+=(char)(0x80|(v&0x7f)); v>>=7;}
+	out+=(char)v;
+}
+
+/* Read an integer with an n-bit prefix.  Returns false if it's malformed. */
+static bool hpack_get_int(const unsigned char *&p,const unsigned char *end,int n,unsigned int &v)
+{
+	if (p>=end) return false;
+	unsigned int limit=(1u<<n)-1;
+	v=(*p++)&limit;
+	if (v<limit) return true;
+	for (int shift=0;shift<28;shift+=7) {
+		if (p>=end) return false;
+		unsigned char b=*p++;
+		v+=(b&0x7f)<<shift;
+		if (!(b&0x80)) return true;
+	}
+	return false; /* absurdly big */
+}
+
+static void hpack_put_string(std::string &out,const std::string &s)
+{
+	int hlen=hpack_huff.encoded_length(s);
+	if (hlen<(int)s.size()) {
+		hpack_put_int(out,0x80,7,hlen);
+		hpack_huff.encode(s,out);
+	} else {
+		hpack_put_int(out,0,7,s.size());
+		out+=s;
+	}
+}
+
+static bool hpack_get_string(const unsigned char *&p,const unsigned char *end,std::string &s)
+{
+	if (p>=end) return false;
+	bool huffman=(*p&0x80)!=0;
+	unsigned int len;
+	if (!hpack_get_int(p,end,7,len) || len>(unsigned int)(end-p)) return false;
+	s="";
+	if (huffman) {
+		if (!hpack_huff.decode(p,len,s)) return false;
+	}
+	else s.assign((const char *)p,len);
+	p+=len;
+	return true;
+}
+
+bool osl::hpack_decoder::decode(const unsigned char *p,int len,http_header_list &headers)
+{
+	const unsigned char *end=p+len;
+	bool any_header=false;
+	while (p<end) {
+		unsigned char b=*p;
+		unsigned int index;
+		std::string name, value;
+		if (b&0x80) { /* indexed header field */
+			if (!hpack_get_int(p,end,7,index) || !table.get(index,name,value)) return false;
+		}
+		else if ((b&0xe0)==0x20) { /* dynamic table size update */
+			if (any_header) return false; /* only allowed at the start */
+			if (!hpack_get_int(p,end,5,index) || (int)index>max_size) return false;
+			table.resize(index);
+			continue;
+		}
+		else { /* literal: with incremental indexing, without, or never indexed */
+			bool indexing=(b&0xc0)==0x40;
+			if (!hpack_get_int(p,end,indexing?6:4,index)) return false;
+			if (index==0) {
+				if (!hpack_get_string(p,end,name)) return false;
+			}
+			else if (!table.get(index,name,value)) return false;
+			if (!hpack_get_string(p,end,value)) return false;
+			if (indexing) table.add(name,value);
+		}
+		headers.push_back(std::make_pair(name,value));
+		any_header=true;
+	}
+	return true;
+}
+
+void osl::hpack_encoder::set_max_size(int peer_max_size)
+{
+	int size=peer_max_size<4096?peer_max_size:4096;
+	if (size!=table.get_max_size()) pending_resize=size;
+}
+
+/* Return true if this header's value is secret, and should never be
+   put in a compression table (where it could be probed, as in CRIME). */
+static bool hpack_sensitive(const std::string &name) {
+	return name=="set-cookie" || name=="authorization" || name=="cookie";
+}
+/* Return true if this header's value changes with nearly every response,
+   so indexing it would only churn the table. */
+static bool hpack_volatile(const std::string &name) {
+	return name=="content-length" || name=="date" || name=="etag" || 
+		name=="last-modified" || name=="content-range" || name=="expires";
+}
+
+void osl::hpack_encoder::encode(const http_header_list &headers,std::string &out)
+{
+	if (pending_resize>=0) {
+		table.resize(pending_resize);
+		hpack_put_int(out,0x20,5,pending_resize);
+		pending_resize=-1;
+	}
+	for (unsigned int i=0;i<headers.size();i++) {
+		const std::string &name=headers[i].first, &value=headers[i].second;
+		int name_index=0;
+		int index=table.find(name,value,&name_index);
+		if (index>0) { /* whole header is in the table */
+			hpack_put_int(out,0x80,7,index);
+			continue;
+		}
+		if (hpack_sensitive(name)) hpack_put_int(out,0x10,4,name_index); /* never indexed */
+		else if (hpack_volatile(name) || name.size()+value.size()>1024)
+			hpack_put_int(out,0x00,4,name_index); /* without indexing */
+		else {
+			hpack_put_int(out,0x40,6,name_index); /* with incremental indexing */
+			table.add(name,value);
+		}
+		if (name_index==0) hpack_put_string(out,name);
+		hpack_put_string(out,value);
+	}
+}
+
+/************************ HTTP/2 connections ***********************/
+
+/* Frame types (RFC 7540 section 6) */
+enum {
+	h2_DATA=0, h2_HEADERS=1, h2_PRIORITY=2, h2_RST_STREAM=3, h2_SETTINGS=4,
+	h2_PUSH_PROMISE=5, h2_PING=6, h2_GOAWAY=7, h2_WINDOW_UPDATE=8, h2_CONTINUATION=9
+};
+/* Frame flags */
+enum {
+	h2_END_STREAM=0x1, h2_ACK=0x1, h2_END_HEADERS=0x4, h2_PADDED=0x8, h2_PRIORITY_FLAG=0x20
+};
+/* Error codes */
+enum {
+	h2_NO_ERROR=0, h2_PROTOCOL_ERROR=1, h2_INTERNAL_ERROR=2, h2_FLOW_CONTROL_ERROR=3,
+	h2_STREAM_CLOSED=5, h2_FRAME_SIZE_ERROR=6, h2_REFUSED_STREAM=7, h2_COMPRESSION_ERROR=9
+};
+/* Our settings */
+enum {
+	h2_max_streams=100, /* streams each client may have open at once */
+	h2_stream_window=256*1024, /* request body bytes we'll buffer per stream */
+	h2_connection_window=1024*1024, /* ... and for the whole connection */
+	h2_max_frame=16384, /* largest frame we accept (the protocol minimum) */
+	h2_idle_msec=120*1000 /* close connections idle this long */
+};
+
+class http2_session;
+
+/**
+ One request and its response: an HTTP/2 stream.
+ The stream's thread runs the responder, which reads the request body
+ and sends the reply through here.
+*/
+class http2_stream : public osl::http_reply_sink, public osl::http_body_source {
+public:
+	http2_session *session;
+	unsigned int id;
+	std::string method, path;
+	osl::http_header_list headers; /* regular request headers */
+	double started; /* porthread_time() the request arrived */
+
+	/* These are protected by the session's lock: */
+	porcond changed; /* signalled when body data arrives, or windows open */
+	std::string in; /* request body data we've received, but not read */
+	bool in_done; /* the client has finished sending */
+	int in_unacked; /* body bytes read, but not yet given back as window */
+	long long send_window; /* DATA bytes the client will accept */
+	bool reset; /* the stream was cancelled */
+
+	/* These are only touched by the stream's own thread: */
+	bool head_request, headers_sent, ended;
+	int status;
+	long long bytes;
+	std::string out; /* reply data waiting to fill a frame */
+
+	http2_stream(http2_session *session_,unsigned int id_);
+
+	void reply_header(int status,const std::string &mime_type,
+		long long length,const osl::http_header_list &headers);
+	void reply_data(const char *data,int nData);
+	int read_body(char *dest,int nMax);
+
+	/* The responder is done: send anything left, and end the stream. */
+	void finish(void);
+private:
+	/* Send these DATA bytes, as flow control allows.  Returns false if the stream died. */
+	bool send_data(const char *data,int len,bool end);
+};
+
+/**
+ One HTTP/2 client connection.  The connection's original thread reads
+ frames, and starts a new thread for each stream.
+*/
+class http2_session {
+public:
+	http2_session(osl::http_threaded_server *server_,SOCKET s_,skt_ip_t ip_,unsigned int port_);
+
+	osl::http_threaded_server *server;
+	SOCKET s;
+	skt_ip_t ip; unsigned int port;
+
+	porlock lock; /* protects the streams and windows below */
+	std::map<unsigned int,http2_stream *> streams; /* open streams */
+	porcond stream_done; /* signalled whenever a stream ends */
+	unsigned int last_stream; /* highest stream ID the client has used */
+	bool dead; /* the connection has failed: give up on everything */
+	bool goaway; /* the client's going away: take no new streams */
+	long long send_window; /* connection-level DATA bytes the client will accept */
+	long long peer_initial_window; /* client's SETTINGS_INITIAL_WINDOW_SIZE */
+	int peer_max_frame; /* client's SETTINGS_MAX_FRAME_SIZE */
+	int in_unacked; /* connection-level body bytes not yet given back as window */
+
+	porlock write_lock; /* serializes frames onto the socket, and the encoder */
+	osl::hpack_encoder encoder;
+	osl::hpack_decoder decoder; /* only used by the reading thread */
+
+	/* Send one frame.  Returns false if the connection is dead. */
+	bool send_frame(int type,int flags,unsigned int stream,const void *data,int len);
+	bool send_frame_locked(int type,int flags,unsigned int stream,const void *data,int len);
+	/* Send a HEADERS frame (plus CONTINUATIONs) for this header list. */
+	bool send_headers(unsigned int stream,const osl::http_header_list &headers,bool end_stream);
+	bool send_window_update(unsigned int stream,int increment);
+	void send_rst(unsigned int stream,int error);
+
+	/* Start a new stream's thread. */
+	void start_stream(http2_stream *st);
+	/* A stream's thread is finished with it. */
+	void end_stream(http2_stream *st);
+
+	/* Apply this SETTINGS frame payload from the client. */
+	bool apply_settings(const unsigned char *p,int len);
+	/* Read exactly len bytes.  If idle, we may wait a long time for them. */
+	bool read_exact(unsigned char *dest,int len,bool idle);
+	/* Send our connection preface: SETTINGS, and a bigger connection window.
+	   This must go out before any stream's frames. */
+	void send_preface(void);
+	/* Read frames and handle them until the connection closes. */
+	void run(void);
+private:
+	/* Header block being assembled from HEADERS and CONTINUATION frames */
+	std::string header_block;
+	unsigned int header_stream; /* 0 if we're not in a header block */
+	bool header_end_stream;
+
+	int headers_done(void);
+	void shutdown(int error);
+};
+
+
+/********** Streams ***********/
+http2_stream::http2_stream(http2_session *session_,unsigned int id_)
+	:session(session_), id(id_), started(porthread_time()),
+	 in_done(false), in_unacked(0), send_window(session_->peer_initial_window), reset(false),
+	 head_request(false), headers_sent(false), ended(false), status(0), bytes(0)
+{}
+
+/* Return true for headers that only make sense on an HTTP/1.1 connection */
+static bool h2_connection_header(const std::string &name) {
+	return name=="connection" || name=="keep-alive" || name=="proxy-connection" ||
+		name=="transfer-encoding" || name=="upgrade";
+}
+
+void http2_stream::reply_header(int status_,const std::string &mime_type,
+	long long length,const osl::http_header_list &extra)
+{
+	if (headers_sent) return; /* a responder bug: can't send two headers */
+	headers_sent=true;
+	status=status_;
+	osl::http_header_list h;
+	char num[100];
+	snprintf(num,sizeof(num),"%d",status);
+	h.push_back(std::make_pair(std::string(":status"),std::string(num)));
+	if (mime_type.size()>0) h.push_back(std::make_pair(std::string("content-type"),mime_type));
+	if (length>=0) {
+		snprintf(num,sizeof(num),"%lld",length);
+		h.push_back(std::make_pair(std::string("content-length"),std::string(num)));
+	}
+	for (unsigned int i=0;i<extra.size();i++) {
+		std::string name=extra[i].first;
+		for (unsigned int c=0;c<name.size();c++) name[c]=tolower((unsigned char)name[c]);
+		if (!h2_connection_header(name)) h.push_back(std::make_pair(name,extra[i].second));
+	}
+	bool end=head_request || length==0 || status==204 || status==304;
+	if (!session->send_headers(id,h,end) || end) ended=true;
+}
+
+void http2_stream::reply_data(const char *data,int nData)
+{
+	if (!headers_sent || ended) return; /* HEAD, or nothing to attach the data to */
+	bytes+=nData;
+	out.append(data,nData);
+	int frame=session->peer_max_frame;
+	if ((int)out.size()>=frame) { /* send whole frames now, keep the rest */
+		int whole=out.size()-out.size()%frame;
+		if (!send_data(&out[0],whole,false)) ended=true;
+		out.erase(0,whole);
+	}
+}
+
+bool http2_stream::send_data(const char *data,int len,bool end)
+{
+	do {
+		int n=0;
+		if (len>0) { /* wait for the client to have room */
+			porlock_scoped l(&session->lock);
+			while (!reset && !session->dead && (send_window<=0 || session->send_window<=0))
+				changed.wait(&session->lock);
+			if (reset || session->dead) return false;
+			n=len;
+			if (n>session->peer_max_frame) n=session->peer_max_frame;
+			if (n>send_window) n=(int)send_window;
+			if (n>session->send_window) n=(int)session->send_window;
+			send_window-=n;
+			session->send_window-=n;
+		}
+		bool last=end && n==len;
+		if (!session->send_frame(h2_DATA,last?h2_END_STREAM:0,id,data,n)) return false;
+		data+=n; len-=n;
+	} while (len>0);
+	return true;
+}
+
+void http2_stream::finish(void)
+{
+	if (!headers_sent) { /* responder never replied */
+		reply_header(500,"text/plain",0,osl::http_header_list());
+	}
+	if (!ended) {
+		send_data(out.size()>0?&out[0]:"",out.size(),true);
+		ended=true;
+	}
+	out="";
+	/* If the client is still sending us a body we'll never read, stop it. */
+	bool stop=false;
+	{
+		porlock_scoped l(&session->lock);
+		stop=!in_done && !reset;
+	}
+	if (stop) session->send_rst(id,h2_NO_ERROR);
+}
+
+int http2_stream::read_body(char *dest,int nMax)
+{
+	int n=0, window_stream=0;
+	{
+		porlock_scoped l(&session->lock);
+		while (in.size()==0 && !in_done && !reset && !session->dead)
+			changed.wait(&session->lock);
+		n=in.size();
+		if (n>nMax) n=nMax;
+		if (n==0) return 0;
+		memcpy(dest,&in[0],n);
+		in.erase(0,n);
+		/* Give the window back once a good fraction has been read */
+		in_unacked+=n;
+		if (!in_done && in_unacked>=h2_stream_window/2) {
+			window_stream=in_unacked; in_unacked=0;
+		}
+	}
+	if (window_stream) session->send_window_update(id,window_stream);
+	return n;
+}
+
+/* Thread that runs one stream's responder */
+static void http2_stream_main(void *ptr)
+{
+	http2_stream *st=(http2_stream *)ptr;
+	http2_session *sess=st->session;
+	st->head_request=(st->method=="HEAD");
+	bool has_body;
+	{
+		porlock_scoped l(&sess->lock);
+		has_body=!(st->in_done && st->in.size()==0);
+	}
+	std::string route;
+	{
+		osl::http_served_client client(st->method,st->path,st->headers,
+			has_body?st:0,st,sess->ip,sess->port);
+		route=sess->server->dispatch(client);
+		st->finish();
+	}
+	osl::http_metrics *m=sess->server->get_metrics();
+	if (m) m->record(route,st->status,st->bytes,0,porthread_time()-st->started);
+	sess->end_stream(st);
+}
+
+
+/********** Sessions ***********/
+http2_session::http2_session(osl::http_threaded_server *server_,SOCKET s_,skt_ip_t ip_,unsigned int port_)
+	:server(server_), s(s_), ip(ip_), port(port_), last_stream(0), dead(false), goaway(false),
+	 send_window(65535), peer_initial_window(65535), peer_max_frame(16384), in_unacked(0),
+	 header_stream(0), header_end_stream(false)
+{
+	/* HTTP/2 interleaves lots of small frames, so don't let Nagle hold them back */
+	int one=1;
+	setsockopt(s,IPPROTO_TCP,TCP_NODELAY,(const char *)&one,sizeof(one));
+}
+
+bool http2_session::send_frame(int type,int flags,unsigned int stream,const void *data,int len)
+{
+	porlock_scoped l(&write_lock);
+	return send_frame_locked(type,flags,stream,data,len);
+}
+
+bool http2_session::send_frame_locked(int type,int flags,unsigned int stream,const void *data,int len)
+{
+	if (dead) return false;
+	std::string f(9+len,0);
+	f[0]=(char)(len>>16); f[1]=(char)(len>>8); f[2]=(char)len;
+	f[3]=(char)type; f[4]=(char)flags;
+	f[5]=(char)((stream>>24)&0x7f); f[6]=(char)(stream>>16); f[7]=(char)(stream>>8); f[8]=(char)stream;
+	if (len>0) memcpy(&f[9],data,len);
+	if (0!=skt_try_sendN(s,&f[0],f.size())) {
+		porlock_scoped l(&lock);
+		dead=true;
+		for (std::map<unsigned int,http2_stream *>::iterator it=streams.begin();it!=streams.end();++it)
+			it->second->changed.broadcast();
+		return false;
+	}
+	return true;
+}
+
+bool http2_session::send_headers(unsigned int stream,const osl::http_header_list &headers,bool end_stream)
+{
+	/* Encoding and sending happen under one lock, so the client
+	   decodes header blocks in the same order we encoded them. */
+	porlock_scoped l(&write_lock);
+	std::string block;
+	encoder.encode(headers,block);
+	int first=block.size()<(size_t)peer_max_frame?block.size():peer_max_frame;
+	int flags=(end_stream?h2_END_STREAM:0)|(first==(int)block.size()?h2_END_HEADERS:0);
+	if (!send_frame_locked(h2_HEADERS,flags,stream,&block[0],first)) return false;
+	for (size_t off=first;off<block.size();) {
+		int n=block.size()-off;
+		if (n>peer_max_frame) n=peer_max_frame;
+		flags=(off+n==block.size())?h2_END_HEADERS:0;
+		if (!send_frame_locked(h2_CONTINUATION,flags,stream,&block[off],n)) return false;
+		off+=n;
+	}
+	return true;
+}
+
+bool http2_session::send_window_update(unsigned int stream,int increment)
+{
+	unsigned char b[4]={(unsigned char)((increment>>24)&0x7f),(unsigned char)(increment>>16),
+		(unsigned char)(increment>>8),(unsigned char)increment};
+	return send_frame(h2_WINDOW_UPDATE,0,stream,b,4);
+}
+
+void http2_session::send_rst(unsigned int stream,int error)
+{
+	unsigned char b[4]={0,0,0,(unsigned char)error};
+	send_frame(h2_RST_STREAM,0,stream,b,4);
+}
+
+void http2_session::start_stream(http2_stream *st)
+{
+	porlock_scoped l(&lock);
+	streams[st->id]=st;
+	porthread_detach(porthread_create(http2_stream_main,st));
+}
+
+void http2_session::end_stream(http2_stream *st)
+{
+	porlock_scoped l(&lock);
+	streams.erase(st->id);
+	delete st;
+	stream_done.broadcast();
+}
+
+bool http2_session::read_exact(unsigned char *dest,int len,bool idle)
+{
+	while (len>0) {
+		int n=skt_recv_some(s,dest,len,idle?h2_idle_msec:60*1000);
+		if (n<=0) {
+			if (n<0 && idle) { /* timeout: fine if streams are still busy */
+				porlock_scoped l(&lock);
+				if (streams.size()>0 && !dead) continue;
+			}
+			return false;
+		}
+		dest+=n; len-=n;
+		idle=false;
+	}
+	return true;
+}
+
+bool http2_session::apply_settings(const unsigned char *p,int len)
+{
+	if (len%6!=0) return false;
+	for (int i=0;i<len;i+=6) {
+		int id=(p[i]<<8)|p[i+1];
+		unsigned int v=((unsigned int)p[i+2]<<24)|(p[i+3]<<16)|(p[i+4]<<8)|p[i+5];
+		if (id==1) { /* HEADER_TABLE_SIZE */
+			porlock_scoped l(&write_lock);
+			encoder.set_max_size(v>4096?4096:(int)v);
+		}
+		else if (id==4) { /* INITIAL_WINDOW_SIZE: adjusts every open stream */
+			if (v>0x7fffffff) return false;
+			porlock_scoped l(&lock);
+			long long delta=(long long)v-peer_initial_window;
+			peer_initial_window=v;
+			for (std::map<unsigned int,http2_stream *>::iterator it=streams.begin();it!=streams.end();++it) {
+				it->second->send_window+=delta;
+				it->second->changed.broadcast();
+			}
+		}
+		else if (id==5) { /* MAX_FRAME_SIZE */
+			if (v<16384 || v>16777215) return false;
+			peer_max_frame=v;
+		}
+		/* others we don't care about */
+	}
+	return true;
+}
+
+/* A complete header block has arrived: start a stream for it.
+   Returns an error code, or -1 if all is well. */
+int http2_session::headers_done(void)
+{
+	osl::http_header_list h;
+	unsigned int id=header_stream;
+	header_stream=0;
+	if (!decoder.decode((const unsigned char *)header_block.data(),header_block.size(),h))
+		return h2_COMPRESSION_ERROR;
+	header_block="";
+
+	{ /* Trailers on a stream that's already open? */
+		porlock_scoped l(&lock);
+		std::map<unsigned int,http2_stream *>::iterator it=streams.find(id);
+		if (it!=streams.end()) {
+			if (!header_end_stream) return h2_PROTOCOL_ERROR;
+			it->second->in_done=true;
+			it->second->changed.broadcast();
+			return -1;
+		}
+	}
+	if (id<=last_stream) return -1; /* stream we've already closed: ignore it */
+	last_stream=id;
+
+	http2_stream *st=new http2_stream(this,id);
+	st->in_done=header_end_stream;
+	std::string authority;
+	for (unsigned int i=0;i<h.size();i++) {
+		const std::string &k=h[i].first, &v=h[i].second;
+		if (k==":method") st->method=v;
+		else if (k==":path") st->path=v;
+		else if (k==":authority") authority=v;
+		else if (k.size()>0 && k[0]==':') {} /* :scheme, etc */
+		else { /* HTTP/1.1 responders expect repeated headers folded into one */
+			bool merged=false;
+			for (unsigned int j=0;j<st->headers.size();j++)
+				if (st->headers[j].first==k) {
+					st->headers[j].second+=(k=="cookie"?"; ":", ")+v;
+					merged=true;
+				}
+			if (!merged) st->headers.push_back(h[i]);
+		}
+	}
+	if (authority.size()>0) st->headers.push_back(std::make_pair(std::string("host"),authority));
+	if (st->method.size()==0 || st->path.size()==0 || goaway) {
+		send_rst(id,goaway?h2_REFUSED_STREAM:h2_PROTOCOL_ERROR);
+		delete st;
+		return -1;
+	}
+	bool full;
+	{
+		porlock_scoped l(&lock);
+		full=(streams.size()>=h2_max_streams);
+	}
+	if (full) {
+		send_rst(id,h2_REFUSED_STREAM);
+		delete st;
+		return -1;
+	}
+	start_stream(st);
+	return -1;
+}
+
+void http2_session::shutdown(int error)
+{
+	unsigned char b[8]={(unsigned char)((last_stream>>24)&0x7f),(unsigned char)(last_stream>>16),
+		(unsigned char)(last_stream>>8),(unsigned char)last_stream,0,0,0,(unsigned char)error};
+	send_frame(h2_GOAWAY,0,0,b,8);
+}
+
+void http2_session::send_preface(void)
+{
+	/* Our SETTINGS come first; then open up the connection window */
+	unsigned char settings[]={
+		0,3, 0,0,0,h2_max_streams, /* MAX_CONCURRENT_STREAMS */
+		0,4, (h2_stream_window>>24)&0xff,(h2_stream_window>>16)&0xff,
+			(h2_stream_window>>8)&0xff,h2_stream_window&0xff /* INITIAL_WINDOW_SIZE */
+	};
+	send_frame(h2_SETTINGS,0,0,settings,sizeof(settings));
+	send_window_update(0,h2_connection_window-65535);
+}
+
+void http2_session::run(void)
+{
+	int error=h2_NO_ERROR;
+	std::vector<unsigned char> payload(h2_max_frame);
+	unsigned char fh[9];
+	while (!dead && read_exact(fh,9,true)) {
+		int len=(fh[0]<<16)|(fh[1]<<8)|fh[2];
+		int type=fh[3], flags=fh[4];
+		unsigned int id=((fh[5]&0x7f)<<24)|(fh[6]<<16)|(fh[7]<<8)|fh[8];
+		if (len>h2_max_frame) {error=h2_FRAME_SIZE_ERROR; break;}
+		if (len>0 && !read_exact(&payload[0],len,false)) break;
+		unsigned char *p=&payload[0];
+
+		if (header_stream!=0 && (type!=h2_CONTINUATION || id!=header_stream))
+			{error=h2_PROTOCOL_ERROR; break;} /* header blocks can't be interrupted */
+
+		/* Strip padding from DATA and HEADERS */
+		int body=len;
+		if ((type==h2_DATA || type==h2_HEADERS) && (flags&h2_PADDED)) {
+			if (len<1 || p[0]>=len) {error=h2_PROTOCOL_ERROR; break;}
+			body=len-1-p[0];
+			p++;
+		}
+
+		if (type==h2_DATA) {
+			if (id==0) {error=h2_PROTOCOL_ERROR; break;}
+			int window=0;
+			{
+				porlock_scoped l(&lock);
+				std::map<unsigned int,http2_stream *>::iterator it=streams.find(id);
+				if (it!=streams.end() && !it->second->in_done && !it->second->reset) {
+					http2_stream *st=it->second;
+					if ((long long)st->in.size()+body>h2_stream_window) {
+						error=h2_FLOW_CONTROL_ERROR; break;
+					}
+					st->in.append((const char *)p,body);
+					if (flags&h2_END_STREAM) st->in_done=true;
+					st->changed.broadcast();
+				}
+				/* Connection window comes back right away, so one stream
+				   that isn't reading can't stall the others. */
+				in_unacked+=len;
+				if (in_unacked>=h2_connection_window/2) {
+					window=in_unacked; in_unacked=0;
+				}
+			}
+			if (window) send_window_update(0,window);
+		}
+		else if (type==h2_HEADERS) {
+			if (id==0 || (id&1)==0) {error=h2_PROTOCOL_ERROR; break;}
+			if (flags&h2_PRIORITY_FLAG) { /* skip the priority fields */
+				if (body<5) {error=h2_PROTOCOL_ERROR; break;}
+				p+=5; body-=5;
+			}
+			header_block.assign((const char *)p,body);
+			header_stream=id;
+			header_end_stream=(flags&h2_END_STREAM)!=0;
+			if ((flags&h2_END_HEADERS) && (error=headers_done())>=0) break;
+			error=h2_NO_ERROR;
+		}
+		else if (type==h2_CONTINUATION) {
+			if (header_stream==0) {error=h2_PROTOCOL_ERROR; break;}
+			header_block.append((const char *)p,len);
+			if (header_block.size()>256*1024) {error=h2_PROTOCOL_ERROR; break;}
+			if ((flags&h2_END_HEADERS) && (error=headers_done())>=0) break;
+			error=h2_NO_ERROR;
+		}
+		else if (type==h2_RST_STREAM) {
+			if (len!=4 || id==0) {error=h2_PROTOCOL_ERROR; break;}
+			porlock_scoped l(&lock);
+			std::map<unsigned int,http2_stream *>::iterator it=streams.find(id);
+			if (it!=streams.end()) {
+				it->second->reset=true;
+				it->second->changed.broadcast();
+			}
+		}
+		else if (type==h2_SETTINGS) {
+			if (id!=0) {error=h2_PROTOCOL_ERROR; break;}
+			if (flags&h2_ACK) continue;
+			if (!apply_settings(p,len)) {error=h2_PROTOCOL_ERROR; break;}
+			send_frame(h2_SETTINGS,h2_ACK,0,0,0);
+		}
+		else if (type==h2_PING) {
+			if (len!=8 || id!=0) {error=h2_PROTOCOL_ERROR; break;}
+			if (!(flags&h2_ACK)) send_frame(h2_PING,h2_ACK,0,p,8);
+		}
+		else if (type==h2_GOAWAY) {
+			goaway=true; /* finish what we have, but take no more */
+		}
+		else if (type==h2_WINDOW_UPDATE) {
+			if (len!=4) {error=h2_FRAME_SIZE_ERROR; break;}
+			long long inc=((p[0]&0x7f)<<24)|(p[1]<<16)|(p[2]<<8)|p[3];
+			porlock_scoped l(&lock);
+			if (id==0) {
+				send_window+=inc;
+				if (send_window>0x7fffffff) {error=h2_FLOW_CONTROL_ERROR; break;}
+				for (std::map<unsigned int,http2_stream *>::iterator it=streams.begin();it!=streams.end();++it)
+					it->second->changed.broadcast();
+			}
+			else {
+				std::map<unsigned int,http2_stream *>::iterator it=streams.find(id);
+				if (it!=streams.end()) {
+					it->second->send_window+=inc;
+					it->second->changed.broadcast();
+				}
+			}
+		}
+		else if (type==h2_PUSH_PROMISE) {error=h2_PROTOCOL_ERROR; break;} /* clients can't push */
+		/* else PRIORITY, or an unknown type: ignore it */
+	}
+	if (error!=h2_NO_ERROR || !dead) shutdown(error);
+
+	/* Stop all the streams, and wait for their threads to finish */
+	porlock_scoped l(&lock);
+	dead=true;
+	for (std::map<unsigned int,http2_stream *>::iterator it=streams.begin();it!=streams.end();++it)
+		it->second->changed.broadcast();
+	while (streams.size()>0) stream_done.wait(&lock);
+}
+
+
+/* Decode base64url, as used by the HTTP2-Settings header (no padding) */
+static std::string h2_base64url_decode(const std::string &in)
+{
+	std::string out;
+	unsigned int acc=0;
+	int bits=0;
+	for (unsigned int i=0;i<in.size();i++) {
+		char c=in[i];
+		int v;
+		if (c>='A' && c<='Z') v=c-'A';
+		else if (c>='a' && c<='z') v=c-'a'+26;
+		else if (c>='0' && c<='9') v=c-'0'+52;
+		else if (c=='-' || c=='+') v=62;
+		else if (c=='_' || c=='/') v=63;
+		else continue; /* padding, whitespace */
+		acc=(acc<<6)|v;
+		bits+=6;
+		if (bits>=8) {bits-=8; out+=(char)(acc>>bits);}
+	}
+	return out;
+}
+
+bool osl::http2_serve(http_threaded_server *server,http_served_client &client)
+{
+	bool prior=(client.get_method()=="PRI" && client.get_path()=="*");
+	bool upgrading=!prior && client.is_upgrade("h2c") && 
+		client.get_header("HTTP2-Settings").size()>0 && !client.has_body();
+	if (!prior && !upgrading) return false;
+
+	SOCKET s=client.detach_socket();
+	http2_session sess(server,s,client.get_ip(),client.get_port());
+	if (prior) { /* rest of the preface, after "PRI * HTTP/2.0\r\n\r\n" */
+		unsigned char sm[6];
+		if (!sess.read_exact(sm,6,false) || 0!=memcmp(sm,"SM\r\n\r\n",6)) {
+			skt_close(s);
+			return true;
+		}
+	}
+	else {
+		static const char switching[]="HTTP/1.1 101 Switching Protocols\r\n"
+			"Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+		std::string settings=h2_base64url_decode(client.get_header("HTTP2-Settings"));
+		unsigned char preface[24];
+		if (0!=skt_try_sendN(s,switching,strlen(switching)) ||
+		    !sess.apply_settings((const unsigned char *)settings.data(),settings.size()) ||
+		    !sess.read_exact(preface,24,false) ||
+		    0!=memcmp(preface,"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n",24))
+		{
+			skt_close(s);
+			return true;
+		}
+		/* The upgrade request itself becomes stream 1 */
+		http2_stream *st=new http2_stream(&sess,1);
+		st->in_done=true;
+		st->method=client.get_method();
+		st->path=client.get_path();
+		http_header_list h=client.get_headers();
+		std::string connection=client.get_header("Connection");
+		for (unsigned int i=0;i<h.size();i++) {
+			std::string name=h[i].first;
+			for (unsigned int c=0;c<name.size();c++) name[c]=tolower((unsigned char)name[c]);
+			if (!h2_connection_header(name) && name!="http2-settings")
+				st->headers.push_back(std::make_pair(name,h[i].second));
+		}
+		sess.last_stream=1;
+		sess.send_preface(); /* before stream 1 can send anything */
+		sess.start_stream(st);
+	}
+	if (prior) sess.send_preface();
+	sess.run();
+	skt_close(s);
+	return true;
+}
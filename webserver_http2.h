@@ -0,0 +1,92 @@
+/**
+  HTTP/2 over cleartext TCP ("h2c") for osl/webserver_threaded.
+
+  Turn it on with
+	server->enable_h2c();
+  and clients may then speak HTTP/2 to the server, either by
+  prior knowledge (starting the connection with the HTTP/2 preface),
+  or by asking to switch with an "Upgrade: h2c" HTTP/1.1 request.
+  Test it with:
+	curl --http2-prior-knowledge http://localhost:8080/
+	curl --http2 http://localhost:8080/
+
+  Each HTTP/2 stream runs your ordinary http_responders in its own
+  thread, so one slow request doesn't hold up the others on the
+  connection.  Headers are HPACK compressed, and both directions
+  are flow controlled.  Server push and priorities aren't supported.
+*/
+#ifndef __OSL_WEBSERVER_HTTP2_H
+#define __OSL_WEBSERVER_HTTP2_H 1
+
+#include "webserver_threaded.h"
+#include <deque>
+
+namespace osl {
+
+/**
+ The HPACK header table: the 61-entry static table, followed
+ by a size-limited dynamic table of recently sent headers.
+ Indices start at 1, like in RFC 7541.
+*/
+class OSL_DLL hpack_table {
+public:
+	hpack_table(int max_size_=4096) :size(0), max_size(max_size_) {}
+
+	/* Return the number of entries, static plus dynamic. */
+	int count(void) const;
+	/* Look up entry i.  Returns false if there's no such entry. */
+	bool get(int i,std::string &name,std::string &value) const;
+	/* Return the index matching both name and value, or 0 if none.
+	   If name_index is nonzero, it gets an index matching just the name. */
+	int find(const std::string &name,const std::string &value,int *name_index) const;
+	/* Add this entry to the dynamic table, evicting old entries to fit. */
+	void add(const std::string &name,const std::string &value);
+	/* Change the dynamic table size limit, in bytes. */
+	void resize(int new_max_size);
+	int get_max_size(void) const {return max_size;}
+private:
+	std::deque<std::pair<std::string,std::string> > dynamic; /* newest first */
+	int size, max_size; /* bytes used, as counted by RFC 7541 */
+	void evict(void);
+};
+
+/** Decodes HPACK header blocks.  Keep one per connection direction. */
+class OSL_DLL hpack_decoder {
+public:
+	/* max_size is the largest table size we allow the encoder to use
+	   (our SETTINGS_HEADER_TABLE_SIZE). */
+	hpack_decoder(int max_size_=4096) :table(max_size_), max_size(max_size_) {}
+	/* Decode this header block, appending name/value pairs to headers.
+	   Returns false if the block is malformed, which is a connection error. */
+	bool decode(const unsigned char *data,int len,http_header_list &headers);
+private:
+	hpack_table table;
+	int max_size;
+};
+
+/** Encodes HPACK header blocks.  Keep one per connection direction. */
+class OSL_DLL hpack_encoder {
+public:
+	hpack_encoder() :pending_resize(-1) {}
+	/* The decoder allows us a table of this size (its SETTINGS_HEADER_TABLE_SIZE).
+	   We use at most 4096 bytes regardless. */
+	void set_max_size(int peer_max_size);
+	/* Append the HPACK encoding of these headers to out.
+	   Names must already be lowercase. */
+	void encode(const http_header_list &headers,std::string &out);
+private:
+	hpack_table table;
+	int pending_resize; /* table size update to announce, or -1 if none */
+};
+
+/**
+ If this HTTP/1.x client is asking for HTTP/2, by prior knowledge or
+ an "Upgrade: h2c" request, take over its connection and serve HTTP/2
+ streams on it with server's responders, returning true after the
+ connection closes.  Otherwise return false, leaving client untouched.
+*/
+OSL_DLL bool http2_serve(http_threaded_server *server,http_served_client &client);
+
+}; /* end namespace osl */
+
+#endif
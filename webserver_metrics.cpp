@@ -0,0 +1,172 @@
+/**
+  Request counters and latency histograms for osl/webserver_threaded.
+*/
+#include "webserver_metrics.h"
+#include <stdio.h> /* for snprintf */
+
+#if _WIN32
+#define snprintf _snprintf
+#endif
+
+const double osl::http_histogram::bounds[osl::http_histogram::n_buckets]={
+	0.0001,0.00025,0.0005,0.001,0.0025,0.005,0.01,0.025,
+	0.05,0.1,0.25,0.5,1.0,2.5,5.0,10.0};
+
+osl::http_histogram::http_histogram()
+{
+	for (int b=0;b<=n_buckets;b++) count[b]=0;
+	sum_usec=0;
+}
+
+void osl::http_histogram::add(double seconds)
+{
+	int b=0;
+	while (b<n_buckets && seconds>bounds[b]) b++;
+	porthread_atomic_add(&count[b],1);
+	porthread_atomic_add(&sum_usec,(long long)(seconds*1.0e6));
+}
+
+void osl::http_histogram::print(std::string &out,const char *name,const std::string &labels)
+{
+	char line[300];
+	std::string sep=labels.size()?",":"";
+	long long cumulative=0;
+	for (int b=0;b<=n_buckets;b++) {
+		cumulative+=porthread_atomic_load(&count[b]);
+		char le[30];
+		if (b<n_buckets) snprintf(le,sizeof(le),"%g",bounds[b]);
+		else snprintf(le,sizeof(le),"+Inf");
+		snprintf(line,sizeof(line),"le=\"%s\"} %lld\n",le,cumulative);
+		out+=name; out+="_bucket{"+labels+sep+line;
+	}
+	std::string braces=labels.size()?"{"+labels+"}":"";
+	snprintf(line,sizeof(line)," %.6f\n",porthread_atomic_load(&sum_usec)*1.0e-6);
+	out+=name; out+="_sum"+braces+line;
+	snprintf(line,sizeof(line)," %lld\n",cumulative);
+	out+=name; out+="_count"+braces+line;
+}
+
+osl::http_metrics::route_stats::route_stats(const std::string &name_)
+	:name(name_), bytes(0)
+{
+	for (int c=0;c<6;c++) status_class[c]=0;
+}
+
+osl::http_metrics::http_metrics()
+	:overflow(new route_stats("(other)")), connections(0), in_flight(0)
+{
+	for (int i=0;i<table_size;i++) {hashes[i]=0; stats[i]=0;}
+}
+
+osl::http_metrics::~http_metrics()
+{
+	for (int i=0;i<table_size;i++) delete stats[i];
+	delete overflow;
+}
+
+/* Return the statistics for this route, adding it if it's new. */
+osl::http_metrics::route_stats *osl::http_metrics::find(const std::string &route)
+{
+	unsigned long long h=14695981039346656037ULL; /* FNV-1a */
+	for (unsigned int i=0;i<route.size();i++)
+		h=(h^(unsigned char)route[i])*1099511628211ULL;
+	long long key=(long long)(h|1); /* never 0, which marks an empty slot */
+
+	for (int pass=0;pass<2;pass++) {
+		if (pass==1) insert_lock.lock();
+		for (int probe=0;probe<table_size;probe++) {
+			int i=(int)((h+probe)%table_size);
+			long long k=porthread_atomic_load(&hashes[i]);
+			if (k==key && stats[i]->name==route) {
+				if (pass==1) insert_lock.unlock();
+				return stats[i];
+			}
+			if (k==0) {
+				if (pass==0) break; /* not here yet: lock, and look again */
+				stats[i]=new route_stats(route);
+				porthread_atomic_store(&hashes[i],key); /* publishes stats[i] */
+				insert_lock.unlock();
+				return stats[i];
+			}
+		}
+	}
+	/* Table is full: lump everything else together */
+	insert_lock.unlock();
+	return overflow;
+}
+
+void osl::http_metrics::record(const std::string &route,int status,long long bytes,
+	double queue_wait_,double service_time)
+{
+	route_stats *r=find(route);
+	int c=status/100;
+	if (c<1 || c>5) c=0;
+	porthread_atomic_add(&r->status_class[c],1);
+	porthread_atomic_add(&r->bytes,bytes);
+	r->service.add(service_time);
+	queue_wait.add(queue_wait_);
+}
+
+/* Escape a Prometheus label value */
+static std::string metrics_escape(const std::string &s)
+{
+	std::string r;
+	for (unsigned int i=0;i<s.size();i++) {
+		if (s[i]=='\\' || s[i]=='"') {r+='\\'; r+=s[i];}
+		else if (s[i]=='\n') r+="\\n";
+		else r+=s[i];
+	}
+	return r;
+}
+
+std::string osl::http_metrics::text(void)
+{
+	std::string out;
+	char line[300];
+	out+="# HELP osl_http_connections_total Client connections accepted.\n"
+	     "# TYPE osl_http_connections_total counter\n";
+	snprintf(line,sizeof(line),"osl_http_connections_total %lld\n",porthread_atomic_load(&connections));
+	out+=line;
+	out+="# HELP osl_http_in_flight Client connections being served right now.\n"
+	     "# TYPE osl_http_in_flight gauge\n";
+	snprintf(line,sizeof(line),"osl_http_in_flight %lld\n",porthread_atomic_load(&in_flight));
+	out+=line;
+
+	/* Snapshot the routes that exist so far */
+	std::vector<route_stats *> routes;
+	for (int i=0;i<table_size;i++)
+		if (porthread_atomic_load(&hashes[i])!=0) routes.push_back((route_stats *)stats[i]);
+	routes.push_back(overflow);
+
+	static const char *classes[6]={"other","1xx","2xx","3xx","4xx","5xx"};
+	out+="# HELP osl_http_requests_total HTTP requests served, by route and status.\n"
+	     "# TYPE osl_http_requests_total counter\n";
+	for (unsigned int r=0;r<routes.size();r++)
+		for (int c=0;c<6;c++) {
+			long long n=porthread_atomic_load(&routes[r]->status_class[c]);
+			if (n==0) continue;
+			snprintf(line,sizeof(line),"\",code=\"%s\"} %lld\n",classes[c],n);
+			out+="osl_http_requests_total{route=\""+metrics_escape(routes[r]->name)+line;
+		}
+	out+="# HELP osl_http_response_bytes_total Bytes sent back to clients, by route.\n"
+	     "# TYPE osl_http_response_bytes_total counter\n";
+	for (unsigned int r=0;r<routes.size();r++) {
+		snprintf(line,sizeof(line),"\"} %lld\n",porthread_atomic_load(&routes[r]->bytes));
+		out+="osl_http_response_bytes_total{route=\""+metrics_escape(routes[r]->name)+line;
+	}
+	out+="# HELP osl_http_service_seconds Time spent handling requests, by route.\n"
+	     "# TYPE osl_http_service_seconds histogram\n";
+	for (unsigned int r=0;r<routes.size();r++)
+		routes[r]->service.print(out,"osl_http_service_seconds",
+			"route=\""+metrics_escape(routes[r]->name)+"\"");
+	out+="# HELP osl_http_queue_wait_seconds Time from accepting a connection to starting its request.\n"
+	     "# TYPE osl_http_queue_wait_seconds histogram\n";
+	queue_wait.print(out,"osl_http_queue_wait_seconds","");
+	return out;
+}
+
+bool osl::http_metrics::respond(osl::http_served_client &client)
+{
+	client.send("text/plain; version=0.0.4",text());
+	return true;
+}
@@ -0,0 +1,92 @@
+/**
+  Request counters and latency histograms for osl/webserver_threaded,
+  served in the Prometheus text exposition format.
+
+  A typical usage is
+	server->enable_metrics("/metrics");
+  and then point Prometheus (or curl) at http://yourserver/metrics
+
+  Everything on the request path is lock-free atomic adds, so it's
+  cheap enough to leave enabled all the time.
+*/
+#ifndef __OSL_WEBSERVER_METRICS_H
+#define __OSL_WEBSERVER_METRICS_H 1
+
+#include "webserver_threaded.h"
+
+namespace osl {
+
+/**
+ A latency histogram with fixed buckets, from 100us to 10s.
+ Safe to update from many threads at once.
+*/
+class OSL_DLL http_histogram {
+public:
+	enum {n_buckets=16}; /* plus one for +Inf */
+	/* Upper bound of each bucket, in seconds */
+	static const double bounds[n_buckets];
+
+	http_histogram();
+	/* Add one observation, in seconds */
+	void add(double seconds);
+	/* Append Prometheus histogram lines for this metric name and label text
+	   (like "route=\"/\"", or empty) to out. */
+	void print(std::string &out,const char *name,const std::string &labels);
+private:
+	porthread_atomic_t count[n_buckets+1]; /* per bucket, not cumulative */
+	porthread_atomic_t sum_usec;
+};
+
+/**
+ Collects statistics on the requests served by an http_threaded_server,
+ and serves them as a web page.
+*/
+class OSL_DLL http_metrics : public http_responder {
+public:
+	http_metrics();
+	~http_metrics();
+
+	/* A client connected, or finished. */
+	void connection_opened(void) {porthread_atomic_add(&connections,1); porthread_atomic_add(&in_flight,1);}
+	void connection_closed(void) {porthread_atomic_add(&in_flight,-1);}
+
+	/* We served a request on this route (or responder name),
+	   sending back this status and this many bytes.
+	   queue_wait is seconds from accept to starting the request,
+	   service_time is seconds spent handling it. */
+	void record(const std::string &route,int status,long long bytes,
+		double queue_wait,double service_time);
+
+	/* Return all our statistics, in Prometheus text format. */
+	std::string text(void);
+
+	/* Serve our statistics page. */
+	bool respond(osl::http_served_client &client);
+
+private:
+	/* Statistics for one route */
+	class route_stats {
+	public:
+		std::string name;
+		porthread_atomic_t status_class[6]; /* index 1-5: 1xx-5xx; 0 for anything else */
+		porthread_atomic_t bytes;
+		http_histogram service;
+		route_stats(const std::string &name_);
+	};
+	/* Lock-free open-addressed table of route_stats, keyed by name hash.
+	   Slots are only ever added, never removed, so readers need no lock. */
+	enum {table_size=256};
+	porthread_atomic_t hashes[table_size]; /* 0 for an empty slot */
+	route_stats *volatile stats[table_size];
+	porlock insert_lock; /* serializes adding new routes */
+	route_stats *overflow; /* used if the table fills up */
+
+	porthread_atomic_t connections, in_flight;
+	http_histogram queue_wait;
+
+	route_stats *find(const std::string &route);
+};
+
+}; /* end namespace osl */
+
+#endif
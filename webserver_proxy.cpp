@@ -0,0 +1,409 @@
+/**
+  Reverse proxy for osl/webserver_threaded.
+*/
+#include "webserver_proxy.h"
+#include <stdio.h> /* for snprintf */
+#include <stdlib.h> /* for strtoll */
+
+#if _WIN32
+#define snprintf _snprintf
+#define strtoll _strtoi64
+#endif
+
+/* Return true if these are the same HTTP header keyword */
+static bool same_header(const std::string &a,const std::string &b) {
+	osl::http_header_less less;
+	return !less(a,b) && !less(b,a);
+}
+
+/* Return true if this comma-separated header value contains this token,
+   ignoring case, like "close" in "Connection: Keep-Alive, close". */
+static bool proxy_has_token(const std::string &value,const std::string &token) {
+	size_t start=0;
+	while (start<value.size()) {
+		size_t end=value.find(',',start);
+		if (end==std::string::npos) end=value.size();
+		size_t b=value.find_first_not_of(" \t",start);
+		size_t e=value.find_last_not_of(" \t",end-1);
+		if (b<end && e!=std::string::npos && e>=b && same_header(value.substr(b,e+1-b),token))
+			return true;
+		start=end+1;
+	}
+	return false;
+}
+
+/* Return true if this is a hop-by-hop header, which describes one
+   connection rather than the message, so we must not pass it on.
+   Content-Length and friends are also dropped, since we reframe the body. */
+static bool proxy_hop_header(const std::string &keyword,const std::string &connection) {
+	static const char *hop[]={"Connection","Keep-Alive","Proxy-Connection",
+		"TE","Trailer","Transfer-Encoding","Upgrade","Content-Length",
+		"Host","Expect",0};
+	for (int i=0;hop[i];i++)
+		if (same_header(keyword,hop[i])) return true;
+	return proxy_has_token(connection,keyword); /* "Connection: X-Foo" makes X-Foo hop-by-hop */
+}
+
+/* Return true if this idle socket has something to read:
+   for a pooled connection, that means the upstream closed it. */
+static bool proxy_stale(SOCKET s) {
+	fd_set rfds;
+	struct timeval tmo;
+	FD_ZERO(&rfds);
+	FD_SET(s,&rfds);
+	tmo.tv_sec=0; tmo.tv_usec=0;
+	return select(1+s,&rfds,NULL,NULL,&tmo)!=0;
+}
+
+/**
+ Buffered reading from an upstream socket, with a timeout,
+ that reports failures instead of aborting.
+*/
+class proxy_reader {
+public:
+	proxy_reader(SOCKET s_,int timeout_msec_)
+		:s(s_), timeout_msec(timeout_msec_), start(0), end(0), eof(false),
+		 timed_out(false), got_any(false) {}
+
+	/* Return true if the upstream closed or reset the connection
+	   before sending us a single byte, so it never saw the request.
+	   A slow upstream doesn't count: it may be working on it. */
+	bool stale(void) const {return !timed_out && !got_any;}
+
+	/* Read one line, without the CR/LF.  Returns false on error or EOF. */
+	bool read_line(std::string &line) {
+		line="";
+		while (true) {
+			for (int i=start;i<end;i++)
+				if (buf[i]=='\n') {
+					line.append(&buf[start],i-start);
+					start=i+1;
+					if (line.size()>0 && line[line.size()-1]=='\r')
+						line.resize(line.size()-1);
+					return true;
+				}
+			line.append(&buf[start],end-start);
+			start=end;
+			if (line.size()>64*1024) return false; /* silly long line */
+			if (!fill()) return false;
+		}
+	}
+
+	/* Point data at up to nMax buffered bytes, reading more if needed.
+	   Returns the number of bytes, 0 at EOF, or -1 on error. */
+	int read_some(const char **data,long long nMax) {
+		if (start==end && !fill()) return eof?0:-1;
+		int n=end-start;
+		if (n>nMax) n=(int)nMax;
+		*data=&buf[start];
+		start+=n;
+		return n;
+	}
+private:
+	SOCKET s;
+	int timeout_msec;
+	enum {size=16*1024};
+	char buf[size];
+	int start,end; /* buffered data lives in buf[start..end) */
+	bool eof; /* the upstream closed the connection */
+	bool timed_out; /* the upstream took too long to send anything */
+	bool got_any; /* the upstream has sent us at least one byte */
+
+	bool fill(void) {
+		if (0==skt_select1(s,timeout_msec)) {timed_out=true; return false;}
+		int n=skt_recv_some(s,buf,size,timeout_msec);
+		if (n<=0) {eof=(n==0); return false;}
+		got_any=true;
+		start=0; end=n;
+		return true;
+	}
+};
+
+
+osl::proxy_responder::proxy_responder(const std::string &prefix_,balance_t balance_,bool strip_prefix_)
+	:prefix(prefix_), balance(balance_), strip_prefix(strip_prefix_),
+	 timeout_msec(10000), max_fails(3), retry(5.0), max_idle(8), idle_time(4.0),
+	 next(0)
+{}
+
+osl::proxy_responder::~proxy_responder()
+{
+	for (unsigned int i=0;i<upstreams.size();i++) {
+		for (unsigned int c=0;c<upstreams[i]->idle.size();c++)
+			skt_close(upstreams[i]->idle[c]);
+		delete upstreams[i];
+	}
+}
+
+void osl::proxy_responder::add_upstream(const std::string &host,int port)
+{
+	upstream *u=new upstream;
+	u->ip=skt_lookup_ip(host.c_str());
+	u->port=port;
+	char portstr[20];
+	snprintf(portstr,sizeof(portstr),":%d",port);
+	u->host=host+(port==80?"":portstr);
+	u->outstanding=0;
+	u->fails=0;
+	u->down_until=0;
+	porlock_scoped l(&lock);
+	upstreams.push_back(u);
+}
+
+/* Choose an upstream we haven't tried yet, that isn't down.
+   Returns 0 if there aren't any. */
+osl::proxy_responder::upstream *osl::proxy_responder::pick(const std::vector<upstream *> &skip)
+{
+	double now=porthread_time();
+	porlock_scoped l(&lock);
+	upstream *best=0;
+	unsigned int n=upstreams.size();
+	for (unsigned int i=0;i<n;i++) {
+		upstream *u=upstreams[(next+i)%n];
+		bool tried=false;
+		for (unsigned int k=0;k<skip.size();k++) if (skip[k]==u) tried=true;
+		if (tried || u->down_until>now) continue;
+		if (best==0 || (balance==least_outstanding && u->outstanding<best->outstanding))
+			best=u;
+		if (balance==round_robin) break;
+	}
+	if (best) {
+		next++;
+		best->outstanding++;
+	}
+	return best;
+}
+
+/* Return a connection to this upstream, from the pool if possible,
+   or INVALID_SOCKET if we can't connect. */
+SOCKET osl::proxy_responder::get_connection(upstream *u,bool *reused)
+{
+	double now=porthread_time();
+	lock.lock();
+	while (u->idle.size()>0) {
+		SOCKET s=u->idle.back();
+		double since=u->idle_since.back();
+		u->idle.pop_back(); u->idle_since.pop_back();
+		if (now-since>idle_time || proxy_stale(s)) {
+			skt_close(s); /* upstream has probably closed it */
+			continue;
+		}
+		lock.unlock();
+		*reused=true;
+		return s;
+	}
+	lock.unlock();
+	*reused=false;
+	return skt_try_connect(u->ip,u->port,timeout_msec);
+}
+
+/* Keep this connection for the next request, if there's room. */
+void osl::proxy_responder::put_connection(upstream *u,SOCKET s)
+{
+	porlock_scoped l(&lock);
+	if ((int)u->idle.size()<max_idle) {
+		u->idle.push_back(s);
+		u->idle_since.push_back(porthread_time());
+	}
+	else skt_close(s);
+}
+
+/* We're done with this upstream for this request. */
+void osl::proxy_responder::finished(upstream *u,bool ok)
+{
+	porlock_scoped l(&lock);
+	u->outstanding--;
+	if (ok) u->fails=0;
+	else if (++u->fails>=max_fails)
+		u->down_until=porthread_time()+retry;
+}
+
+/* Send this request to this upstream over s, and relay the reply. */
+osl::proxy_responder::outcome_t osl::proxy_responder::forward(
+	osl::http_served_client &client,const std::string &request,
+	upstream *u,SOCKET s,bool reused)
+{
+	/* POST and PATCH might not be safe to repeat, so once any of the
+	   request has been written, we never send it again. */
+	const std::string &method=client.get_method();
+	bool retryable=(method!="POST" && method!="PATCH");
+	if (0!=skt_try_sendN(s,&request[0],request.size())) {
+		if (!retryable) return failed_late;
+		return reused?retry_fresh:failed_early;
+	}
+
+	/* Stream the request body, if any */
+	bool body_used=false;
+	if (client.has_body()) {
+		body_used=true;
+		bool chunked=client.get_body_length()<0;
+		char buf[16*1024];
+		int n;
+		while (0<(n=client.read_body(buf,sizeof(buf)))) {
+			char chunk[20];
+			if (chunked) {
+				int len=snprintf(chunk,sizeof(chunk),"%x\r\n",n);
+				if (0!=skt_try_sendN(s,chunk,len)) return failed_late;
+			}
+			if (0!=skt_try_sendN(s,buf,n)) return failed_late;
+			if (chunked && 0!=skt_try_sendN(s,"\r\n",2)) return failed_late;
+		}
+		if (chunked && 0!=skt_try_sendN(s,"0\r\n\r\n",5)) return failed_late;
+	}
+
+	/* Read the reply status line and headers */
+	proxy_reader r(s,timeout_msec);
+	std::string line, version;
+	int status=0;
+	http_header_list headers;
+	do { /* skip over any "100 Continue" replies */
+		if (!r.read_line(line)) {
+			if (body_used || !retryable || !r.stale())
+				return failed_late; /* upstream may have acted on it */
+			return reused?retry_fresh:failed_early;
+		}
+		size_t sp=line.find(' ');
+		version=line.substr(0,sp);
+		if (sp==std::string::npos || version.compare(0,5,"HTTP/")!=0 ||
+		    1!=sscanf(line.c_str()+sp,"%d",&status))
+			return failed_late;
+		headers.clear();
+		while (true) {
+			if (!r.read_line(line)) return failed_late;
+			if (line.size()==0) break; /* end of headers */
+			size_t colon=line.find(':');
+			if (colon==std::string::npos) continue;
+			size_t vstart=line.find_first_not_of(" \t",colon+1);
+			headers.push_back(std::make_pair(line.substr(0,colon),
+				vstart==std::string::npos?std::string(""):line.substr(vstart)));
+		}
+	} while (status>=100 && status<200);
+
+	/* Figure out how the reply body is framed */
+	std::string connection, mime_type;
+	long long length=-1; /* -1: read until the upstream closes */
+	bool chunked=false;
+	for (unsigned int i=0;i<headers.size();i++) {
+		const std::string &k=headers[i].first, &v=headers[i].second;
+		if (same_header(k,"Connection")) connection=v;
+		else if (same_header(k,"Content-Type")) mime_type=v;
+		else if (same_header(k,"Content-Length")) length=strtoll(v.c_str(),0,10);
+		else if (same_header(k,"Transfer-Encoding")) chunked=proxy_has_token(v,"chunked");
+	}
+	if (chunked) length=-1;
+	bool no_body=(client.get_method()=="HEAD" || status==204 || status==304);
+	bool keepalive=(version=="HTTP/1.1") && !proxy_has_token(connection,"close");
+
+	/* Pass the reply header on to our client */
+	for (unsigned int i=0;i<headers.size();i++)
+		if (!proxy_hop_header(headers[i].first,connection) &&
+		    !same_header(headers[i].first,"Content-Type"))
+			client.add_header(headers[i].first,headers[i].second);
+	client.send_header(mime_type,length,status);
+
+	/* Relay the reply body as it arrives */
+	const char *data;
+	int n;
+	if (no_body) {}
+	else if (chunked) {
+		while (true) {
+			if (!r.read_line(line)) return failed_relay;
+			long long left=strtoll(line.c_str(),0,16); /* ignores ";extensions" */
+			if (left<0) return failed_relay;
+			if (left==0) { /* last chunk: skip any trailer lines */
+				do {
+					if (!r.read_line(line)) return failed_relay;
+				} while (line.size()>0);
+				break;
+			}
+			while (left>0) {
+				if (0>=(n=r.read_some(&data,left))) return failed_relay;
+				client.send_raw(data,n);
+				left-=n;
+			}
+			if (!r.read_line(line) || line.size()!=0) return failed_relay;
+		}
+	}
+	else if (length>=0) {
+		long long left=length;
+		while (left>0) {
+			if (0>=(n=r.read_some(&data,left))) return failed_relay;
+			client.send_raw(data,n);
+			left-=n;
+		}
+	}
+	else { /* body runs until the upstream closes */
+		keepalive=false;
+		while (0<(n=r.read_some(&data,16*1024)))
+			client.send_raw(data,n);
+		if (n<0) return failed_relay;
+	}
+
+	if (keepalive) put_connection(u,s);
+	else skt_close(s);
+	return sent;
+}
+
+bool osl::proxy_responder::respond(osl::http_served_client &client)
+{
+	std::string path=client.get_path();
+	if (path.compare(0,prefix.size(),prefix)!=0) return false;
+	if (strip_prefix) {
+		path=path.substr(prefix.size());
+		if (path.size()==0 || path[0]!='/') path="/"+path;
+	}
+
+	/* Build the request header (minus Host, which depends on the upstream) */
+	std::string headers=" "+path+" HTTP/1.1\r\n";
+	http_header_list in=client.get_headers();
+	std::string connection=client.get_header("Connection");
+	std::string forwarded_for;
+	for (unsigned int i=0;i<in.size();i++) {
+		if (same_header(in[i].first,"X-Forwarded-For")) forwarded_for=in[i].second+", ";
+		else if (!proxy_hop_header(in[i].first,connection))
+			headers+=in[i].first+": "+in[i].second+"\r\n";
+	}
+	headers+="X-Forwarded-For: "+forwarded_for+skt_print_ip(client.get_ip())+"\r\n";
+	if (client.get_header("Host").size()>0)
+		headers+="X-Forwarded-Host: "+client.get_header("Host")+"\r\n";
+	if (client.get_body_length()>0) {
+		char len[100];
+		snprintf(len,sizeof(len),"Content-Length: %lld\r\n",client.get_body_length());
+		headers+=len;
+	}
+	else if (client.get_body_length()<0)
+		headers+="Transfer-Encoding: chunked\r\n";
+
+	/* Try each healthy upstream until one answers */
+	std::vector<upstream *> tried;
+	upstream *u;
+	while (0!=(u=pick(tried))) {
+		std::string request=client.get_method()+headers+"Host: "+u->host+"\r\n\r\n";
+		bool reused;
+		SOCKET s=get_connection(u,&reused);
+		outcome_t o=failed_early;
+		if (s!=INVALID_SOCKET) {
+			o=forward(client,request,u,s,reused);
+			if (o==retry_fresh) { /* stale pooled connection: one more go, on a new one */
+				skt_close(s);
+				s=skt_try_connect(u->ip,u->port,timeout_msec);
+				o=failed_early;
+				if (s!=INVALID_SOCKET) o=forward(client,request,u,s,false);
+			}
+			if (o!=sent) skt_close(s);
+		}
+		finished(u,o==sent);
+		if (o==sent) return true;
+		if (o==failed_relay) return true; /* client has a partial reply: nothing more we can do */
+		if (o==failed_late) break; /* upstream may have acted on it, so we can't retry */
+		tried.push_back(u);
+	}
+
+	/* Couldn't get an answer. */
+	client.send_error("text/html",
+		"<HTML><HEAD><TITLE>Bad Gateway</TITLE></HEAD>\n"
+		"<BODY><H1>Bad Gateway</H1>\n"
+		"The upstream server could not be reached.\n"
+		"</BODY></HTML>\n",502);
+	return true;
+}
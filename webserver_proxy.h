@@ -0,0 +1,107 @@
+/**
+  Reverse proxy for osl/webserver_threaded: forwards requests
+  to other HTTP servers, and streams their replies back.
+
+  A typical usage is
+	osl::proxy_responder *p=new osl::proxy_responder("/api");
+	p->add_upstream("backend1",8000);
+	p->add_upstream("backend2",8000);
+	server->add_responder(p);
+  which sends "/api/users" to one of the backends, and passes
+  whatever it says back to the client.
+
+  Upstream connections are kept alive and reused, so a forwarded
+  request normally costs no DNS lookup or TCP connect.  Response bodies
+  are relayed as they arrive, never buffered whole.  An upstream that
+  keeps failing is taken out of rotation for a while (passive health
+  checking), then given another chance.
+*/
+#ifndef __OSL_WEBSERVER_PROXY_H
+#define __OSL_WEBSERVER_PROXY_H 1
+
+#include "webserver_threaded.h"
+
+namespace osl {
+
+class OSL_DLL proxy_responder : public http_responder {
+public:
+	/* How to pick an upstream for each request */
+	typedef enum {
+		round_robin=0, /* take turns */
+		least_outstanding=1 /* whichever has the fewest requests in progress */
+	} balance_t;
+
+	/**
+	  Forward requests whose path starts with prefix.
+	  If strip_prefix is true, the prefix is removed before forwarding,
+	  so "/api/users" goes upstream as "/users".
+	*/
+	proxy_responder(const std::string &prefix,balance_t balance=round_robin,
+		bool strip_prefix=false);
+	~proxy_responder();
+
+	/** Also forward requests to this server.  The host name is looked
+	   up once, right now. */
+	void add_upstream(const std::string &host,int port=80);
+
+	/** Give up on an upstream that doesn't connect or answer within
+	   this many milliseconds.  Default is 10000. */
+	void set_timeout(int msec) {timeout_msec=msec;}
+	/** After max_fails failures in a row, skip an upstream for
+	   retry_msec milliseconds.  Defaults are 3 and 5000. */
+	void set_health(int max_fails_,int retry_msec)
+		{max_fails=max_fails_; retry=retry_msec*0.001;}
+	/** Keep up to max_idle idle connections to each upstream,
+	   for up to idle_msec milliseconds.  Defaults are 8 and 4000. */
+	void set_pool(int max_idle_,int idle_msec)
+		{max_idle=max_idle_; idle_time=idle_msec*0.001;}
+
+	/* CAUTION: MULTITHREADED CALLS! */
+	bool respond(osl::http_served_client &client);
+
+private:
+	/* One server we forward to */
+	class upstream {
+	public:
+		std::string host; /* for the Host: header */
+		skt_ip_t ip;
+		int port;
+		/* Idle keep-alive connections, most recently used at the back */
+		std::vector<SOCKET> idle;
+		std::vector<double> idle_since;
+		int outstanding; /* requests in progress */
+		int fails; /* consecutive failures */
+		double down_until; /* porthread_time() we'll try it again */
+	};
+	std::string prefix;
+	balance_t balance;
+	bool strip_prefix;
+	int timeout_msec;
+	int max_fails;
+	double retry;
+	int max_idle;
+	double idle_time;
+
+	porlock lock; /* protects everything below */
+	std::vector<upstream *> upstreams;
+	unsigned int next; /* round-robin position */
+
+	upstream *pick(const std::vector<upstream *> &skip);
+	SOCKET get_connection(upstream *u,bool *reused);
+	void put_connection(upstream *u,SOCKET s);
+	void finished(upstream *u,bool ok);
+	/* Outcome of one try at forwarding a request */
+	typedef enum {
+		sent=0, /* upstream answered, and we passed it on */
+		retry_fresh, /* a pooled connection was closed before answering: try again */
+		failed_early, /* upstream failed before it could have acted on the request */
+		failed_late, /* upstream may have acted on the request, or used up its body */
+		failed_relay /* upstream failed after we'd started our reply */
+	} outcome_t;
+	outcome_t forward(osl::http_served_client &client,const std::string &request,
+		upstream *u,SOCKET s,bool reused);
+};
+
+}; /* end namespace osl */
+
+#endif
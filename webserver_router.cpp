@@ -0,0 +1,140 @@
+/**
+  Dispatches web requests to responders by path, using a radix trie.
+*/
+#include "webserver_router.h"
+#include <string.h>
+
+/**
+ One node of the radix trie.  The edge into a node is labeled with
+ a run of literal path text, or is a ":name" segment.
+*/
+class osl::http_router::node {
+public:
+	std::string label; /* literal text on our incoming edge */
+	std::vector<node *> children; /* literal children: labels start with distinct characters */
+	node *param; /* child matching one ":name" path segment, or 0 */
+
+	/* A pattern ending exactly here */
+	http_responder *handler;
+	std::string pattern;
+	std::vector<std::string> names; /* parameter names, in path order */
+
+	/* A pattern ending here with "*" */
+	http_responder *rest_handler;
+	std::string rest_pattern;
+	std::vector<std::string> rest_names;
+
+	node(const std::string &label_="") 
+		:label(label_), param(0), handler(0), rest_handler(0) {}
+	~node() {
+		for (unsigned int i=0;i<children.size();i++) delete children[i];
+		delete param;
+	}
+
+	/* Split our label after k characters, pushing everything else down into a new child. */
+	void split(size_t k) {
+		node *n=new node(label.substr(k));
+		n->children.swap(children);
+		n->param=param; param=0;
+		n->handler=handler; handler=0;
+		n->pattern.swap(pattern);
+		n->names.swap(names);
+		n->rest_handler=rest_handler; rest_handler=0;
+		n->rest_pattern.swap(rest_pattern);
+		n->rest_names.swap(rest_names);
+		label.erase(k);
+		children.push_back(n);
+	}
+
+	/* Add the rest of this pattern below us. */
+	void insert(const char *p,const std::string &full,std::vector<std::string> &pnames,http_responder *r) {
+		if (*p==0) { handler=r; pattern=full; names=pnames; return; }
+		if (*p=='*' && p[1]==0) { rest_handler=r; rest_pattern=full; rest_names=pnames; return; }
+		if (*p==':') { /* parameter segment */
+			size_t len=strcspn(p,"/");
+			pnames.push_back(std::string(p+1,len-1));
+			if (!param) param=new node;
+			param->insert(p+len,full,pnames,r);
+			return;
+		}
+		/* Literal text runs up to the next ":name" segment or trailing "*" */
+		size_t len=0;
+		while (p[len]!=0 && !(p[len]==':' && len>0 && p[len-1]=='/') && 
+		       !(p[len]=='*' && p[len+1]==0)) len++;
+		for (unsigned int i=0;i<children.size();i++) {
+			node *c=children[i];
+			if (c->label[0]!=p[0]) continue;
+			size_t k=0; /* length of common prefix */
+			while (k<len && k<c->label.size() && c->label[k]==p[k]) k++;
+			if (k<c->label.size()) c->split(k);
+			c->insert(p+k,full,pnames,r);
+			return;
+		}
+		node *c=new node(std::string(p,len));
+		children.push_back(c);
+		c->insert(p+len,full,pnames,r);
+	}
+
+	/* Find the node matching the rest of this path.  Sets rest if it was a "*" match. 
+	   Appends parameter values to vals. */
+	const node *match(const char *p,std::vector<std::string> &vals,bool &rest) const {
+		if (*p==0 && handler) {rest=false; return this;}
+		for (unsigned int i=0;i<children.size();i++) {
+			const node *c=children[i];
+			if (c->label[0]==*p && 0==strncmp(p,c->label.c_str(),c->label.size())) {
+				const node *m=c->match(p+c->label.size(),vals,rest);
+				if (m) return m;
+				break; /* only one child can start with this character */
+			}
+		}
+		if (param && *p!=0 && *p!='/') {
+			size_t len=strcspn(p,"/");
+			vals.push_back(std::string(p,len));
+			const node *m=param->match(p+len,vals,rest);
+			if (m) return m;
+			vals.pop_back();
+		}
+		if (rest_handler) {
+			vals.push_back(p);
+			rest=true;
+			return this;
+		}
+		return 0;
+	}
+};
+
+osl::http_router::http_router() :root(new node) {}
+osl::http_router::~http_router() { delete root; }
+
+void osl::http_router::add(const std::string &pattern,http_responder *responder)
+{
+	std::vector<std::string> names;
+	root->insert(pattern.c_str(),pattern,names,responder);
+}
+
+osl::http_responder *osl::http_router::lookup(const std::string &path,
+	http_header_list *params,std::string *pattern) const
+{
+	std::vector<std::string> vals;
+	bool rest=false;
+	const node *n=root->match(path.substr(0,path.find('?')).c_str(),vals,rest);
+	if (!n) return 0;
+	if (params) {
+		const std::vector<std::string> &names=rest?n->rest_names:n->names;
+		for (unsigned int i=0;i<names.size();i++)
+			params->push_back(std::make_pair(names[i],vals[i]));
+		if (rest) params->push_back(std::make_pair(std::string("*"),vals.back()));
+	}
+	if (pattern) *pattern=rest?n->rest_pattern:n->pattern;
+	return rest?n->rest_handler:n->handler;
+}
+
+bool osl::http_router::respond(osl::http_served_client &client)
+{
+	http_header_list params;
+	std::string pattern;
+	http_responder *r=lookup(client.get_path(),&params,&pattern);
+	if (!r) return false;
+	client.set_params(params,pattern);
+	return r->respond(client);
+}
@@ -0,0 +1,50 @@
+/**
+  Dispatches web requests to responders by path, using a radix trie.
+
+  Instead of asking every responder in turn whether it wants a request,
+  the router compiles path patterns into a trie, and finds the right
+  responder in time proportional to the length of the path.
+  Patterns can be:
+	"/about.html"       exact path
+	"/users/:id/posts"  ":id" matches any one path segment
+	"/files*"           "*" matches the whole rest of the path
+  Matched ":name" segments (and "*", under the name "*") are available
+  to the responder via client.get_param("name").
+
+  Query strings ("?foo=bar") are ignored while matching.
+  Exact text wins over ":name" segments, which win over "*".
+*/
+#ifndef __OSL_WEBSERVER_ROUTER_H
+#define __OSL_WEBSERVER_ROUTER_H 1
+
+#include "webserver_threaded.h"
+
+namespace osl {
+
+class OSL_DLL http_router : public http_responder {
+public:
+	http_router();
+	~http_router();
+
+	/** Send requests matching this path pattern to this responder.
+	   The responder is never deleted. */
+	void add(const std::string &pattern,http_responder *responder);
+
+	/** Return the responder for this path, or 0 if no pattern matches.
+	   If params is nonzero, matched parameters are appended there,
+	   and the matching pattern is stored in pattern. */
+	http_responder *lookup(const std::string &path,
+		http_header_list *params=0,std::string *pattern=0) const;
+
+	/* Call the matching responder, and return its result.
+	   CAUTION: MULTITHREADED CALLS! */
+	bool respond(osl::http_served_client &client);
+
+private:
+	class node;
+	node *root;
+};
+
+}; /* end namespace osl */
+
+#endif
@@ -0,0 +1,330 @@
+/**
+  Serves plain files from a directory, for use with osl/webserver_threaded.
+*/
+#include "webserver_static.h"
+#include <stdio.h> /* for snprintf, sscanf */
+#include <string.h>
+#include <ctype.h> /* for tolower */
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#  include <io.h>
+#  define snprintf _snprintf
+#  define open _open
+#  define close _close
+#  define O_RDONLY (_O_RDONLY|_O_BINARY)
+#else
+#  include <unistd.h>
+#endif
+#ifndef O_NONBLOCK
+#  define O_NONBLOCK 0
+#endif
+
+static const char *month_names[]={
+	"Jan","Feb","Mar","Apr","May","Jun",
+	"Jul","Aug","Sep","Oct","Nov","Dec"};
+static const char *day_names[]={
+	"Sun","Mon","Tue","Wed","Thu","Fri","Sat"};
+
+/* Return the number of days since 1970-01-01 for this (proleptic Gregorian) date. */
+static long long days_from_civil(int y,int m,int d) {
+	y-=(m<=2);
+	long long era=(y>=0?y:y-399)/400;
+	int yoe=(int)(y-era*400);
+	int doy=(153*(m+(m>2?-3:9))+2)/5+d-1;
+	int doe=yoe*365+yoe/4-yoe/100+doy;
+	return era*146097+doe-719468;
+}
+
+/* Print this time as an HTTP date, like "Sun, 06 Nov 1994 08:49:37 GMT" */
+static std::string http_date(long long t) {
+	long long days=t/86400, secs=t%86400;
+	/* Invert days_from_civil */
+	long long z=days+719468;
+	long long era=(z>=0?z:z-146096)/146097;
+	int doe=(int)(z-era*146097);
+	int yoe=(doe-doe/1460+doe/36524-doe/146096)/365;
+	int doy=doe-(365*yoe+yoe/4-yoe/100);
+	int mp=(5*doy+2)/153;
+	int d=doy-(153*mp+2)/5+1;
+	int m=mp+(mp<10?3:-9);
+	long long y=yoe+era*400+(m<=2);
+	char buf[100];
+	snprintf(buf,sizeof(buf),"%s, %02d %s %04d %02d:%02d:%02d GMT",
+		day_names[(days%7+11)%7],d,month_names[m-1],(int)y,
+		(int)(secs/3600),(int)(secs/60%60),(int)(secs%60));
+	return buf;
+}
+
+/* Parse an HTTP date, or return -1 if it's not one. */
+static long long parse_http_date(const std::string &s) {
+	char mon[4]={0};
+	int d,y,hh,mm,ss;
+	if (6!=sscanf(s.c_str(),"%*[A-Za-z], %d %3s %d %d:%d:%d",&d,mon,&y,&hh,&mm,&ss))
+		return -1;
+	for (int m=0;m<12;m++)
+		if (0==strcmp(mon,month_names[m]))
+			return days_from_civil(y,m+1,d)*86400+hh*3600+mm*60+ss;
+	return -1;
+}
+
+/* Return true if this If-None-Match list includes our etag (weak comparison). */
+static bool etag_listed(const std::string &list,const std::string &etag) {
+	if (list=="*") return true;
+	size_t start=0;
+	while (start<list.size()) {
+		size_t end=list.find(',',start);
+		if (end==std::string::npos) end=list.size();
+		std::string tag=list.substr(start,end-start);
+		size_t b=tag.find_first_not_of(" \t"), e=tag.find_last_not_of(" \t");
+		if (b!=std::string::npos) {
+			tag=tag.substr(b,e+1-b);
+			if (tag.compare(0,2,"W/")==0) tag=tag.substr(2);
+			if (tag==etag) return true;
+		}
+		start=end+1;
+	}
+	return false;
+}
+
+/* Decode %xx escapes in this URL path.  Returns false for escaped NULs. */
+static bool decode_url_path(const std::string &src,std::string &dest) {
+	dest="";
+	for (unsigned int i=0;i<src.size();i++) {
+		char c=src[i];
+		if (c=='%' && i+2<src.size()) {
+			int v=0;
+			if (1!=sscanf(src.substr(i+1,2).c_str(),"%x",&v) || v==0) return false;
+			dest+=(char)v;
+			i+=2;
+		}
+		else dest+=c;
+	}
+	return true;
+}
+
+/* Return true if this relative path could escape from the served directory */
+static bool path_escapes(const std::string &rel) {
+	if (rel.find('\\')!=std::string::npos) return true;
+	size_t start=0;
+	while (start<=rel.size()) {
+		size_t end=rel.find('/',start);
+		if (end==std::string::npos) end=rel.size();
+		if (rel.compare(start,end-start,"..")==0) return true;
+		start=end+1;
+	}
+	return false;
+}
+
+const char *osl::static_file_responder::mime_type(const std::string &filename)
+{
+	static const char *types[]={
+		"html","text/html", "htm","text/html",
+		"txt","text/plain", "css","text/css",
+		"js","application/javascript", "json","application/json",
+		"xml","application/xml", "svg","image/svg+xml",
+		"png","image/png", "jpg","image/jpeg", "jpeg","image/jpeg",
+		"gif","image/gif", "ico","image/x-icon", "webp","image/webp",
+		"wasm","application/wasm", "pdf","application/pdf",
+		"zip","application/zip", "gz","application/gzip",
+		"mp4","video/mp4", "webm","video/webm", "mp3","audio/mpeg",
+		0,0
+	};
+	size_t dot=filename.find_last_of("./");
+	if (dot!=std::string::npos && filename[dot]=='.') {
+		std::string ext=filename.substr(dot+1);
+		for (unsigned int i=0;i<ext.size();i++) ext[i]=tolower(ext[i]);
+		for (int t=0;types[t];t+=2)
+			if (ext==types[t]) return types[t+1];
+	}
+	return "application/octet-stream";
+}
+
+osl::static_file_responder::static_file_responder(const std::string &url_prefix,
+	const std::string &directory_,int cache_files_,int recheck_msec)
+	:prefix(url_prefix), directory(directory_),
+	 cache_files(cache_files_<1?1:cache_files_), recheck(recheck_msec*0.001),
+	 use_count(0)
+{
+	while (directory.size()>1 && directory[directory.size()-1]=='/')
+		directory.erase(directory.size()-1);
+}
+
+osl::static_file_responder::~static_file_responder()
+{
+	for (std::map<std::string,file_entry *>::iterator it=cache.begin();it!=cache.end();++it)
+		release_locked(it->second);
+}
+
+/* Drop a reference to this entry, with our lock held. */
+void osl::static_file_responder::release_locked(file_entry *f)
+{
+	if (--f->refs==0) {
+		close(f->fd);
+		delete f;
+	}
+}
+void osl::static_file_responder::release(file_entry *f)
+{
+	porlock_scoped l(&lock);
+	release_locked(f);
+}
+
+/* Return an open file_entry for this path, or 0 if it isn't a readable file. */
+osl::static_file_responder::file_entry *osl::static_file_responder::open_file(const std::string &filename)
+{
+	double now=porthread_time();
+	{ /* Fast path: recently checked cache hit, no system calls */
+		porlock_scoped l(&lock);
+		std::map<std::string,file_entry *>::iterator it=cache.find(filename);
+		if (it!=cache.end() && now-it->second->checked<recheck) {
+			file_entry *f=it->second;
+			f->refs++;
+			f->last_used=++use_count;
+			return f;
+		}
+	}
+
+	struct stat st;
+	bool exists=(0==stat(filename.c_str(),&st)) && S_ISREG(st.st_mode);
+
+	porlock_scoped l(&lock);
+	std::map<std::string,file_entry *>::iterator it=cache.find(filename);
+	if (it!=cache.end()) {
+		file_entry *f=it->second;
+		if (exists && f->size==st.st_size && f->mtime==st.st_mtime && f->inode==(long long)st.st_ino)
+		{ /* unchanged: just note that we checked */
+			f->checked=now;
+			f->refs++;
+			f->last_used=++use_count;
+			return f;
+		}
+		/* File changed or vanished: drop the stale entry */
+		cache.erase(it);
+		release_locked(f);
+	}
+	if (!exists) return 0;
+
+	/* The path may have changed since we looked at it, so describe
+	   the file we actually opened.  O_NONBLOCK keeps a FIFO that
+	   turned up in the meantime from hanging us in open. */
+	int fd=open(filename.c_str(),O_RDONLY|O_NONBLOCK);
+	if (fd<0) return 0;
+	if (0!=fstat(fd,&st) || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return 0;
+	}
+	file_entry *f=new file_entry;
+	f->fd=fd;
+	f->size=st.st_size;
+	f->mtime=st.st_mtime;
+	f->inode=st.st_ino;
+	char etag[100];
+	snprintf(etag,sizeof(etag),"\"%llx-%llx-%llx\"",f->inode,f->size,f->mtime);
+	f->etag=etag;
+	f->last_modified=http_date(f->mtime);
+	f->checked=now;
+	f->last_used=++use_count;
+	f->refs=2; /* one for the cache, one for our caller */
+
+	if (cache.size()>=cache_files) { /* evict the least recently used file */
+		std::map<std::string,file_entry *>::iterator oldest=cache.begin();
+		for (it=cache.begin();it!=cache.end();++it)
+			if (it->second->last_used<oldest->second->last_used) oldest=it;
+		release_locked(oldest->second);
+		cache.erase(oldest);
+	}
+	cache[filename]=f;
+	return f;
+}
+
+bool osl::static_file_responder::respond(osl::http_served_client &client)
+{
+	std::string method=client.get_method();
+	if (method!="GET" && method!="HEAD") return false;
+	std::string path=client.get_path();
+	if (path.compare(0,prefix.size(),prefix)!=0) return false;
+
+	/* Find the file's path relative to our directory */
+	std::string rel=path.substr(prefix.size());
+	rel=rel.substr(0,rel.find_first_of("?#"));
+	if (rel.size()==0 || rel[0]!='/') {
+		if (rel.size()>0 && prefix.size()>0 && prefix[prefix.size()-1]!='/')
+			return false; /* e.g., "/foobar" doesn't match prefix "/foo" */
+		rel="/"+rel;
+	}
+	std::string decoded;
+	if (!decode_url_path(rel,decoded) || path_escapes(decoded)) {
+		client.send_error("text/plain","Forbidden path\n",403);
+		return true;
+	}
+	if (decoded.size()==0 || decoded[decoded.size()-1]=='/') decoded+="index.html";
+	std::string filename=directory+decoded;
+
+	file_entry *f=open_file(filename);
+	if (f==0) return false; /* let another responder (or the 404 page) handle it */
+
+	client.add_header("ETag",f->etag);
+	client.add_header("Last-Modified",f->last_modified);
+	client.add_header("Accept-Ranges","bytes");
+
+	/* Conditional requests: the client already has this version. */
+	std::string inm=client.get_header("If-None-Match");
+	long long ims=parse_http_date(client.get_header("If-Modified-Since"));
+	if ((inm.size()>0 && etag_listed(inm,f->etag)) ||
+	    (inm.size()==0 && ims>=0 && f->mtime<=ims))
+	{
+		client.send_header("",f->size,304);
+		release(f);
+		return true;
+	}
+
+	/* Range requests: the client only wants part of the file. */
+	long long start=0, end=f->size-1;
+	int status=200;
+	std::string range=client.get_header("Range");
+	std::string if_range=client.get_header("If-Range");
+	if (if_range.size()>0 && if_range!=f->etag && if_range!=f->last_modified)
+		range=""; /* file changed since their partial copy: send the whole thing */
+	if (range.compare(0,6,"bytes=")==0 && range.find(',')==std::string::npos)
+	{ /* we only do single ranges; multiple ranges get the whole file */
+		long long a=-1, b=-1;
+		const char *r=range.c_str()+6;
+		bool ok=true;
+		if (r[0]=='-') { /* suffix range: the last b bytes */
+			if (1==sscanf(r+1,"%lld",&b) && b>0) {
+				a=f->size-b; if (a<0) a=0; b=f->size-1;
+			}
+			else ok=false;
+		}
+		else {
+			int n=sscanf(r,"%lld-%lld",&a,&b);
+			if (n<1 || (n==2 && b<a)) ok=false; /* syntax error: ignore the range */
+			if (n==1 || b>=f->size) b=f->size-1;
+		}
+		if (ok) {
+			if (a>=f->size) { /* range starts past end of file */
+				char cr[100];
+				snprintf(cr,sizeof(cr),"bytes */%lld",f->size);
+				client.add_header("Content-Range",cr);
+				client.send_error("text/plain","Range not satisfiable\n",416);
+				release(f);
+				return true;
+			}
+			start=a; end=b; status=206;
+			char cr[200];
+			snprintf(cr,sizeof(cr),"bytes %lld-%lld/%lld",start,end,f->size);
+			client.add_header("Content-Range",cr);
+		}
+	}
+
+	long long length=end+1-start;
+	client.send_header(mime_type(filename),length,status);
+	if (method!="HEAD")
+		client.send_file(f->fd,start,length);
+	release(f);
+	return true;
+}
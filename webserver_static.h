@@ -0,0 +1,72 @@
+/**
+  Serves plain files from a directory, for use with osl/webserver_threaded.
+
+  Files go out via zero-copy sendfile, with Range requests for partial
+  content, and ETag/Last-Modified validators so browsers can revalidate
+  with a cheap 304 instead of downloading the file again.
+
+  A typical usage is
+	server->add_responder(new osl::static_file_responder("/images/","/var/www/images"));
+*/
+#ifndef __OSL_WEBSERVER_STATIC_H
+#define __OSL_WEBSERVER_STATIC_H 1
+
+#include "webserver_threaded.h"
+#include <map>
+
+namespace osl {
+
+/*
+ Maps URLs starting with a prefix onto files in a directory.
+ Keeps a small cache of open file descriptors and stat results,
+ so hot files are served without repeated open and stat calls.
+*/
+class OSL_DLL static_file_responder : public http_responder {
+public:
+	/**
+	  Serve URLs like url_prefix+"foo/bar.txt" from directory+"/foo/bar.txt".
+	  Up to cache_files open files are kept, and each file is re-checked
+	  with stat at most every recheck_msec milliseconds.
+	*/
+	static_file_responder(const std::string &url_prefix,const std::string &directory,
+		int cache_files=64,int recheck_msec=1000);
+	~static_file_responder();
+
+	/* CAUTION: MULTITHREADED CALLS! */
+	bool respond(osl::http_served_client &client);
+
+	/* Return the MIME type we send for this filename, like "text/html" */
+	static const char *mime_type(const std::string &filename);
+
+private:
+	/* One open file, possibly shared by several client threads. */
+	class file_entry {
+	public:
+		int fd; /* open read-only file descriptor */
+		long long size; /* file length, in bytes */
+		long long mtime; /* last modification time, seconds since 1970 */
+		long long inode; /* to notice files replaced by rename */
+		std::string etag; /* quoted entity tag, like "\"1a2b-400-5f00\"" */
+		std::string last_modified; /* HTTP date string */
+		double checked; /* time we last stat'd the file */
+		unsigned long last_used; /* for least-recently-used eviction */
+		int refs; /* cache reference, plus one per client sending it */
+	};
+	std::string prefix, directory;
+	unsigned int cache_files;
+	double recheck;
+
+	porlock lock; /* protects everything below */
+	std::map<std::string,file_entry *> cache;
+	unsigned long use_count;
+
+	/* Return an open file_entry for this filesystem path, or 0 if it doesn't exist. */
+	file_entry *open_file(const std::string &filename);
+	/* Drop our reference to this entry; closes it if it was evicted. */
+	void release(file_entry *f);
+	void release_locked(file_entry *f);
+};
+
+}; /* end namespace osl */
+
+#endif
@@ -5,19 +5,60 @@
   Dr. Orion Sky Lawlor, lawlor@alaska.edu, 2012-01-03 (Public Domain)
 */
 #include "webserver_threaded.h"
+#include "webserver_router.h"
+#include "webserver_metrics.h"
+#include "webserver_admission.h"
+#include "webserver_http2.h"
+#include <stdio.h> /* for snprintf */
 	
 /* Service the currently connected client 
 	   CAUTION: MULTITHREADED CALLS!*/
 void osl::http_threaded_server::service_client(void)
 {
-	osl::http_served_client client=serve();
+	skt_ip_t ip; unsigned int port;
+	SOCKET s=accept_client(&ip,&port);
+	double accepted=porthread_time();
+	service_client(s,ip,port,accepted);
+}
+
+/* Service this already-accepted client */
+void osl::http_threaded_server::service_client(SOCKET s,skt_ip_t ip,unsigned int port,double accepted)
+{
+	double start=porthread_time();
+	if (metrics) metrics->connection_opened();
+	{
+		osl::http_served_client client(s,ip,port);
+		if (h2c && osl::http2_serve(this,client)) 
+		{ /* HTTP/2 streams record their own metrics */ }
+		else {
+			std::string route=dispatch(client);
+			if (metrics) metrics->record(route,client.get_reply_status(),client.get_reply_bytes(),
+				start-accepted,porthread_time()-start);
+		}
+	}
+	if (metrics) metrics->connection_closed();
+}
+
+/* Hand this client to the right responder */
+std::string osl::http_threaded_server::dispatch(osl::http_served_client &client)
+{
 	/* FUTURE: add client authentication layer here? */
-	for (unsigned int i=0;i<responders.size();i++)
-		if (responders[i]->respond(client)) 
-			return;
+	unsigned int i=0;
+	for (;i<responders.size() && responders[i]->passes_through();i++)
+		responders[i]->respond(client); /* loggers come before routes */
+	if (router && router->respond(client))
+		return client.get_route();
+	for (;i<responders.size();i++)
+		if (responders[i]->respond(client)) {
+			char name[100];
+			snprintf(name,sizeof(name),"responder_%d",i);
+			return name;
+		}
 	/* else nobody wants to handle it... */
 	no_responder(client);
+	return "(none)";
 }
+
 void osl::http_threaded_server::no_responder(osl::http_served_client &client)
 {
 	client.send_error("text/html",
@@ -29,13 +70,25 @@ void osl::http_threaded_server::no_responder(osl::http_served_client &client)
 "</HTML>");
 }
 
+/* A client connection we've accepted, but not yet serviced */
+struct osl_http_accepted {
+	osl::http_threaded_server *server;
+	SOCKET s;
+	skt_ip_t ip;
+	unsigned int port;
+	double accepted; /* porthread_time() when we accepted it */
+	bool tracked; /* admission control counted us against our IP */
+};
+
 /*
  Service one HTTP client, then exit.
 */
-void osl_http_service_client(void *thisp)
+void osl_http_service_client(void *acceptedp)
 {
-	osl::http_threaded_server *thisc=(osl::http_threaded_server *)thisp;
-	thisc->service_client();
+	osl_http_accepted *a=(osl_http_accepted *)acceptedp;
+	a->server->service_client(a->s,a->ip,a->port,a->accepted);
+	if (a->server->get_admission()) a->server->get_admission()->release(a->ip,a->tracked);
+	delete a;
 }
 
 /*
@@ -45,17 +98,46 @@ void osl_http_run_server(void *thisp)
 {
 	osl::http_threaded_server *thisc=(osl::http_threaded_server *)thisp;
 	while (thisc->ready(0)) { /* here's another client--make a thread for him */
-		porthread_detach(porthread_create(osl_http_service_client,thisc));
+		osl_http_accepted *a=new osl_http_accepted;
+		a->server=thisc;
+		a->s=thisc->accept_client(&a->ip,&a->port);
+		a->accepted=porthread_time();
+		osl::http_admission *admission=thisc->get_admission();
+		if (admission) {
+			int status=admission->admit(a->ip,&a->tracked);
+			if (status!=0) { /* turn them away, cheaply */
+				osl::http_admission::reject(a->s,status);
+				delete a;
+				continue;
+			}
+		}
+		porthread_detach(porthread_create(osl_http_service_client,a));
 	}
 }
 
 osl::http_threaded_server::http_threaded_server(unsigned int port)
-	:http_server(port) 
+	:http_server(port), router(0), metrics(0), admission(0), h2c(false)
 { }
+osl::http_threaded_server::~http_threaded_server()
+{
+	delete router;
+	delete metrics;
+}
 void osl::http_threaded_server::add_responder(http_responder *responder)
 {
 	responders.push_back(responder);
 }
+void osl::http_threaded_server::add_route(const std::string &pattern,http_responder *responder)
+{
+	if (!router) router=new http_router;
+	router->add(pattern,responder);
+}
+
+void osl::http_threaded_server::enable_metrics(const std::string &path)
+{
+	if (!metrics) metrics=new http_metrics;
+	add_route(path,metrics);
+}
 
 void osl::http_threaded_server::start(void) {
 	server_thread=porthread_create(osl_http_run_server,this);
@@ -70,12 +152,9 @@ void osl::http_threaded_server::start(void) {
 #define localtime_r localtime_s
 #endif
 
-/* Logs the requests of clients, as they go by. */
-bool osl::html_logger::respond(osl::http_served_client &client) {
-	char ip_string[100]; skt_print_ip(ip_string,client.get_ip());
-
-	char date_string[100]; 
-	time_t t; time(&t);
+/* Print this time like "18/Oct/2026:11:59:00 LOCALTIME", as Apache does */
+static void osl_http_log_date(char *date_string,time_t t)
+{
 	const static char *month_names[]={
 		"Jan","Feb","Mar","Apr","May","Jun",
 		"Jul","Aug","Sep","Oct","Nov","Dec"};
@@ -89,8 +168,169 @@ bool osl::html_logger::respond(osl::http_served_client &client) {
 		"%02d/%s/%d:%02d:%02d:%02d LOCALTIME",
 		lt.tm_mday,month_names[lt.tm_mon],lt.tm_year+1900,
 		lt.tm_hour,lt.tm_min,lt.tm_sec);
+}
+
+/* Logs the requests of clients, as they go by. */
+bool osl::html_logger::respond(osl::http_served_client &client) {
+	char ip_string[100]; skt_print_ip(ip_string,client.get_ip());
+
+	char date_string[100]; 
+	time_t t; time(&t);
+	osl_http_log_date(date_string,t);
+
+	out<<ip_string<<" - - ["<<date_string<<"] \""<<client.get_method()<<" "<<client.get_path()<<" HTTP/1.1\" 200 1 \""<<client.get_header("Referer")<<"\" \""<<client.get_header("User-Agent")<<"\"\n";
 
-	out<<ip_string<<" - - ["<<date_string<<"] \"GET "<<client.get_path()<<" HTTP/1.1\" 200 1 \""<<client.get_header("Referer")<<"\" \""<<client.get_header("User-Agent")<<"\"\n";
+	return false; /* we don't service clients, just log them */
+}
+
+/*************** Asynchronous logging *****************/
+#ifndef _WIN32
+#include <unistd.h> /* for write */
+#include <errno.h>
+#else
+#include <io.h>
+#include <errno.h>
+#define write _write
+#endif
+
+/* Copy this string into a fixed-size record field, truncating if needed */
+static void osl_http_log_copy(char *dest,int destlen,const std::string &src)
+{
+	int n=src.size();
+	if (n>destlen-1) n=destlen-1;
+	memcpy(dest,src.c_str(),n);
+	dest[n]=0;
+}
+
+/* Background logging thread */
+static void osl_http_log_thread(void *thisp) 
+{
+	((osl::html_async_logger *)thisp)->run();
+}
+
+osl::html_async_logger::html_async_logger(std::ostream &out_,int ring_records,bool drop_when_full_)
+	:out(&out_), fd(-1), drop_when_full(drop_when_full_)
+{ init(ring_records); }
+osl::html_async_logger::html_async_logger(int fd_,int ring_records,bool drop_when_full_)
+	:out(0), fd(fd_), drop_when_full(drop_when_full_)
+{ init(ring_records); }
+
+void osl::html_async_logger::init(int ring_records)
+{
+	long long n=2; 
+	while (n<ring_records) n*=2;
+	mask=n-1;
+	ring=new slot[n];
+	for (long long i=0;i<n;i++) ring[i].seq=i; /* slot i is ready for position i */
+	enqueue_pos=0;
+	dequeue_pos=0;
+	dropped=0;
+	dropped_reported=0;
+	stopping=0;
+	thread=porthread_create(osl_http_log_thread,this);
+}
+
+osl::html_async_logger::~html_async_logger()
+{
+	porthread_atomic_store(&stopping,1);
+	porthread_wait(thread);
+	delete[] ring;
+}
+
+/* Copy this client's request into the ring.  No locks, no formatting. */
+bool osl::html_async_logger::respond(osl::http_served_client &client)
+{
+	long long pos=porthread_atomic_load(&enqueue_pos);
+	slot *s;
+	while (true) { /* claim a slot (Vyukov's bounded queue) */
+		s=&ring[pos&mask];
+		long long dif=porthread_atomic_load(&s->seq)-pos;
+		if (dif==0) {
+			if (porthread_atomic_cas(&enqueue_pos,pos,pos+1)) break; /* got it */
+		}
+		else if (dif<0) { /* ring is full */
+			if (drop_when_full) {
+				porthread_atomic_add(&dropped,1);
+				return false;
+			}
+			porthread_yield(1); /* wait for the logging thread to catch up */
+		}
+		pos=porthread_atomic_load(&enqueue_pos);
+	}
+	record &r=s->rec;
+	r.time=time(0);
+	r.ip=client.get_ip();
+	osl_http_log_copy(r.method,sizeof(r.method),client.get_method());
+	osl_http_log_copy(r.path,sizeof(r.path),client.get_path());
+	osl_http_log_copy(r.referer,sizeof(r.referer),client.get_header("Referer"));
+	osl_http_log_copy(r.agent,sizeof(r.agent),client.get_header("User-Agent"));
+	porthread_atomic_store(&s->seq,pos+1); /* publish to the consumer */
 
 	return false; /* we don't service clients, just log them */
 }
+
+/* Format and write out all records in the ring. */
+int osl::html_async_logger::drain(std::string &buf)
+{
+	enum {write_size=64*1024}; /* write whenever we've got this much */
+	long long cached_time=-1;
+	char date_string[100];
+	char ip_string[100];
+	int count=0;
+	buf.clear();
+	while (true) {
+		slot *s=&ring[dequeue_pos&mask];
+		if (porthread_atomic_load(&s->seq)!=dequeue_pos+1) break; /* empty */
+		record &r=s->rec;
+		if (r.time!=cached_time) { /* only reformat the date once per second */
+			cached_time=r.time;
+			osl_http_log_date(date_string,(time_t)r.time);
+		}
+		skt_print_ip(ip_string,r.ip);
+		buf+=ip_string; buf+=" - - ["; buf+=date_string; buf+="] \"";
+		buf+=r.method; buf+=' '; buf+=r.path; buf+=" HTTP/1.1\" 200 1 \"";
+		buf+=r.referer; buf+="\" \""; buf+=r.agent; buf+="\"\n";
+		porthread_atomic_store(&s->seq,dequeue_pos+mask+1); /* hand slot back to producers */
+		dequeue_pos++;
+		count++;
+		if (buf.size()>=write_size) {
+			write_out(buf);
+			buf.clear();
+		}
+	}
+	long long d=porthread_atomic_load(&dropped);
+	if (d>dropped_reported) {
+		char msg[100];
+		snprintf(msg,sizeof(msg),"[html_async_logger dropped %lld records: ring full]\n",d-dropped_reported);
+		buf+=msg;
+		dropped_reported=d;
+	}
+	if (buf.size()>0) write_out(buf);
+	if (out && count>0) out->flush();
+	return count;
+}
+
+/* Write this formatted text to our destination */
+void osl::html_async_logger::write_out(const std::string &buf)
+{
+	if (out) out->write(&buf[0],buf.size());
+	else for (size_t done=0;done<buf.size();) {
+		long w=write(fd,&buf[done],buf.size()-done);
+		if (w<0 && errno==EINTR) continue;
+		if (w<=0) break; /* nowhere to report errors, since we are the log... */
+		done+=w;
+	}
+}
+
+/* Background thread: wake up periodically, and write out whatever's arrived. */
+void osl::html_async_logger::run(void)
+{
+	std::string buf;
+	buf.reserve(128*1024);
+	int idle=0; /* number of recent empty passes */
+	while (!porthread_atomic_load(&stopping)) {
+		if (drain(buf)>0) idle=0;
+		else porthread_yield(idle++<10?1:10); /* poll fast while busy, slower when idle */
+	}
+	drain(buf); /* final records */
+}
@@ -15,6 +15,10 @@
 
 namespace osl {
 
+class http_router;
+class http_metrics;
+class http_admission;
+
 /*
  Responds to web clients' requests.
 */
@@ -24,6 +28,11 @@ public:
 	   CAUTION: MULTITHREADED CALLS!
 	*/
 	virtual bool respond(osl::http_served_client &client) =0;
+	
+	/* Return true if we only watch requests go by (like a logger),
+	   and never handle them.  These see routed requests too. */
+	virtual bool passes_through(void) const {return false;}
+	virtual ~http_responder() {}
 };
 
 
@@ -35,6 +44,61 @@ class OSL_DLL html_logger : public http_responder {
 public:
 	html_logger(std::ostream &out_) :out(out_) {}
 	bool respond(osl::http_served_client &client);
+	bool passes_through(void) const {return true;}
+};
+
+/* Like html_logger, but worker threads never wait on the output stream.
+   Each request is copied into a fixed-size record in a lock-free ring buffer,
+   and a background thread formats the records in batches and writes
+   them out with a few large writes.  Long fields are truncated.
+   If the ring fills up, we either drop records (and later log how many
+   were dropped), or make the worker wait for space.
+*/
+class OSL_DLL html_async_logger : public http_responder {
+public:
+	/* Log to this stream, buffering up to ring_records requests. */
+	html_async_logger(std::ostream &out,int ring_records=4096,bool drop_when_full=true);
+	/* Log to this open file descriptor, using plain write calls. */
+	html_async_logger(int fd,int ring_records=4096,bool drop_when_full=true);
+	/* Writes out any records still in the ring. */
+	~html_async_logger();
+	
+	bool respond(osl::http_served_client &client);
+	bool passes_through(void) const {return true;}
+	
+	/* Return the total number of records dropped because the ring was full */
+	long long get_dropped(void) {return porthread_atomic_load(&dropped);}
+	
+	/* Background thread's main loop.  Don't call this yourself. */
+	void run(void);
+	
+	/* One request's worth of log data */
+	struct record {
+		long long time;
+		skt_ip_t ip;
+		char method[12];
+		char path[244];
+		char referer[128];
+		char agent[128];
+	};
+private:
+	struct slot {
+		porthread_atomic_t seq; /* ring position this slot is ready for */
+		record rec;
+	};
+	std::ostream *out; int fd; /* destination: stream, or fd if out==0 */
+	bool drop_when_full;
+	slot *ring; long long mask; /* ring has mask+1 slots, a power of two */
+	porthread_atomic_t enqueue_pos; /* next slot for producers */
+	long long dequeue_pos; /* next slot for the consumer thread */
+	porthread_atomic_t dropped;
+	long long dropped_reported; /* drops we've already logged */
+	porthread_atomic_t stopping;
+	porthread_t thread;
+	void init(int ring_records);
+	/* Format and write out all records in the ring.  Returns the number written. */
+	int drain(std::string &buf);
+	void write_out(const std::string &buf);
 };
 
 
@@ -49,14 +113,27 @@ public:
 class OSL_DLL http_threaded_server : public http_server {
 	porthread_t server_thread;
 	std::vector<http_responder *> responders;
+	http_router *router; /* responders added by path, or 0 if none */
+	http_metrics *metrics; /* request statistics, or 0 if not enabled */
+	http_admission *admission; /* connection limits, or 0 if none */
+	bool h2c; /* accept HTTP/2 over cleartext */
 public:
 	http_threaded_server(unsigned int port=8080);
+	~http_threaded_server();
 	
 	/* Add a responder into the HTTP namespace.
 	   Responders are tried one at a time, in order.
 	*/
 	void add_responder(http_responder *responder);
 	
+	/* Send requests matching this path pattern, like "/users/:id" or 
+	   "/files*", to this responder.  See osl/webserver_router.h.
+	   Routes are looked up in a trie before trying any add_responder responders,
+	   except that pass-through responders (like html_logger) added before
+	   the first real responder see every request, routed or not.
+	*/
+	void add_route(const std::string &pattern,http_responder *responder);
+	
 	/* If no responders are found, send back this error page.  
 	   CAUTION: MULTITHREADED CALLS!
 	*/
@@ -66,9 +143,34 @@ public:
 	   Once this is running, the class can't be deleted. */
 	void start(void); 
 	
+	/* Keep statistics on every request, and serve them at this path
+	   in Prometheus text format.  See osl/webserver_metrics.h. */
+	void enable_metrics(const std::string &path="/metrics");
+	/* Return our request statistics, or 0 if they're not enabled. */
+	http_metrics *get_metrics(void) {return metrics;}
+	
+	/* Limit the connections we accept, using this object.
+	   See osl/webserver_admission.h.  Call before start(). */
+	void set_admission(http_admission *a) {admission=a;}
+	http_admission *get_admission(void) {return admission;}
+	
+	/* Let clients speak HTTP/2 (without TLS) to this server.
+	   See osl/webserver_http2.h. */
+	void enable_h2c(bool enable=true) {h2c=enable;}
+	
 	/* Service the currently connected client 
 	   CAUTION: MULTITHREADED CALLS!*/
 	void service_client(void);
+	
+	/* Service this client, whose connection we accepted at 
+	   porthread_time() accepted.
+	   CAUTION: MULTITHREADED CALLS!*/
+	void service_client(SOCKET s,skt_ip_t ip,unsigned int port,double accepted);
+	
+	/* Hand this client to the right responder.  Returns a name for
+	   the responder used, like the route pattern, for statistics. 
+	   CAUTION: MULTITHREADED CALLS!*/
+	std::string dispatch(osl::http_served_client &client);
 };
 
 
@@ -0,0 +1,250 @@
+/**
+  WebSockets for osl/webserver_threaded.  See RFC 6455.
+*/
+#include "webserver_websocket.h"
+#include "sha1.h"
+#include <string.h>
+
+#if defined(_WIN32)
+#  define SHUT_RDWR SD_BOTH
+#endif
+#if !defined(MSG_NOSIGNAL)
+#  define MSG_NOSIGNAL 0
+#endif
+
+/* Return the base64 encoding of these bytes */
+static std::string websocket_base64(const unsigned char *data,int len)
+{
+	static const char digits[]=
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	for (int i=0;i<len;i+=3) {
+		unsigned int v=data[i]<<16;
+		if (i+1<len) v|=data[i+1]<<8;
+		if (i+2<len) v|=data[i+2];
+		out+=digits[(v>>18)&63];
+		out+=digits[(v>>12)&63];
+		out+=(i+1<len)?digits[(v>>6)&63]:'=';
+		out+=(i+2<len)?digits[v&63]:'=';
+	}
+	return out;
+}
+
+osl::websocket::websocket(http_served_client &client,const std::string &protocol)
+	:s(0), ip(client.get_ip()), closing(false), ping_msec(0), max_message(1024*1024)
+{
+	std::string key=client.get_header("Sec-WebSocket-Key");
+	if (!requested(client) || key.size()==0 || client.get_method()!="GET") {
+		client.send_error("text/plain","This is a WebSocket endpoint.\n",400);
+		return;
+	}
+	if (client.get_header("Sec-WebSocket-Version")!="13") {
+		client.add_header("Sec-WebSocket-Version","13");
+		client.send_error("text/plain","Unsupported WebSocket version.\n",426);
+		return;
+	}
+
+	/* Prove we understood the handshake, by hashing their key with a magic GUID */
+	std::string magic=key+"258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	SHA1_hash_t h=SHA1_hash(magic.data(),magic.size());
+	std::string reply="HTTP/1.1 101 Switching Protocols\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: "+websocket_base64(h.data,sizeof(h.data))+"\r\n";
+	if (protocol.size()>0) {
+		std::string offered=","+client.get_header("Sec-WebSocket-Protocol")+",";
+		for (size_t i=0;i<offered.size();i++) if (offered[i]==' ') offered.erase(i--,1);
+		if (offered.find(","+protocol+",")!=std::string::npos)
+			reply+="Sec-WebSocket-Protocol: "+protocol+"\r\n";
+	}
+	reply+="\r\n";
+	s=client.detach_socket();
+	if (0!=skt_try_sendN(s,&reply[0],reply.size())) closing=true;
+}
+
+osl::websocket::~websocket()
+{
+	if (s) skt_close(s);
+}
+
+std::string osl::websocket::encode_frame(int opcode,const void *data,int len)
+{
+	std::string f;
+	f+=(char)(0x80|opcode); /* FIN: we never fragment */
+	if (len<126) f+=(char)len;
+	else if (len<65536) {
+		f+=(char)126;
+		f+=(char)(len>>8); f+=(char)len;
+	} else {
+		f+=(char)127;
+		for (int shift=56;shift>=0;shift-=8) f+=(char)(((long long)len>>shift)&0xff);
+	}
+	f.append((const char *)data,len); /* servers don't mask */
+	return f;
+}
+
+/* Give up on this connection.  The receiving thread sees it closed. */
+void osl::websocket::drop(void)
+{
+	closing=true;
+	if (s) shutdown(s,SHUT_RDWR);
+}
+
+bool osl::websocket::send_encoded(const std::string &frame,bool nonblocking)
+{
+	porlock_scoped l(&send_lock);
+	if (s==0 || closing) return false;
+	if (!nonblocking) {
+		if (0==skt_try_sendN(s,frame.data(),frame.size())) return true;
+		drop();
+		return false;
+	}
+#if defined(MSG_DONTWAIT)
+	int n=send(s,frame.data(),frame.size(),MSG_DONTWAIT|MSG_NOSIGNAL);
+	if (n==(int)frame.size()) return true;
+	drop(); /* full, or worse: a partial frame can't be taken back, so we're done */
+	return false;
+#else
+	if (0==skt_try_sendN(s,frame.data(),frame.size())) return true;
+	drop();
+	return false;
+#endif
+}
+
+void osl::websocket::close(int code,const std::string &reason)
+{
+	std::string payload;
+	payload+=(char)(code>>8); payload+=(char)code;
+	payload+=reason.substr(0,123); /* control frames max out at 125 bytes */
+	send_frame(0x8,payload.data(),payload.size());
+	closing=true;
+}
+
+/* Read exactly len bytes, waiting at most msec (0 for forever) for each piece. */
+bool osl::websocket::read_exact(void *dest,int len,int msec)
+{
+	char *d=(char *)dest;
+	while (len>0) {
+		int n=skt_recv_some(s,d,len,msec);
+		if (n<=0) return false;
+		d+=n; len-=n;
+	}
+	return true;
+}
+
+bool osl::websocket::receive(std::string &msg,bool *is_text)
+{
+	msg="";
+	int msg_opcode=-1; /* opcode of the message being assembled, or -1 */
+	bool pinged=false;
+	while (s!=0) {
+		/* Frame header: FIN/opcode, MASK/length */
+		unsigned char h[2];
+		if (ping_msec>0 && 0==skt_select1(s,ping_msec)) { /* client is quiet */
+			if (pinged || !ping()) {drop(); return false;}
+			pinged=true;
+			continue;
+		}
+		if (!read_exact(h,2,ping_msec)) break; /* 0: an idle client may wait forever */
+		pinged=false;
+		bool fin=(h[0]&0x80)!=0;
+		int opcode=h[0]&0x0f;
+		long long len=h[1]&0x7f;
+		if (!(h[1]&0x80)) {close(1002,"unmasked frame"); break;} /* clients must mask */
+		/* Once a frame starts, the rest of it shouldn't be a minute behind */
+		if (len>=126) {
+			unsigned char ext[8];
+			int n=(len==126)?2:8;
+			if (!read_exact(ext,n,60*1000)) break;
+			len=0;
+			for (int i=0;i<n;i++) len=(len<<8)|ext[i];
+		}
+		unsigned char mask[4];
+		if (!read_exact(mask,4,60*1000)) break;
+		if (len<0 || (long long)msg.size()+len>max_message) {close(1009,"message too big"); break;}
+
+		std::string payload((size_t)len,0);
+		if (len>0 && !read_exact(&payload[0],(int)len,60*1000)) break;
+		for (size_t i=0;i<payload.size();i++) payload[i]^=mask[i&3];
+
+		if (opcode>=0x8) { /* control frame: may arrive in the middle of a message */
+			if (!fin || len>125) {close(1002,"bad control frame"); break;}
+			if (opcode==0x8) { /* close: echo their code back, and we're done */
+				if (!closing) send_frame(0x8,payload.data(),payload.size()<2?payload.size():2);
+				closing=true;
+				break;
+			}
+			if (opcode==0x9) send_frame(0xA,payload.data(),payload.size()); /* ping: pong */
+			continue; /* pong, or unknown */
+		}
+		if (opcode==0x0) { /* continuation */
+			if (msg_opcode<0) {close(1002,"unexpected continuation"); break;}
+		}
+		else if (opcode==0x1 || opcode==0x2) {
+			if (msg_opcode>=0) {close(1002,"expected continuation"); break;}
+			msg_opcode=opcode;
+		}
+		else {close(1003,"unknown opcode"); break;}
+		msg+=payload;
+		if (fin) {
+			if (is_text) *is_text=(msg_opcode==0x1);
+			return true;
+		}
+	}
+	closing=true;
+	return false;
+}
+
+
+/************* Hub **************/
+void osl::websocket_hub::add(websocket *ws)
+{
+	porlock_scoped l(&lock);
+	sockets.push_back(ws);
+}
+
+void osl::websocket_hub::remove(websocket *ws)
+{
+	porlock_scoped l(&lock);
+	for (unsigned int i=0;i<sockets.size();i++)
+		if (sockets[i]==ws) {
+			sockets[i]=sockets.back();
+			sockets.pop_back();
+			return;
+		}
+}
+
+int osl::websocket_hub::size(void)
+{
+	porlock_scoped l(&lock);
+	return sockets.size();
+}
+
+int osl::websocket_hub::broadcast(int opcode,const void *data,int len)
+{
+	std::string frame=websocket::encode_frame(opcode,data,len);
+	int sent=0;
+	porlock_scoped l(&lock);
+	for (unsigned int i=0;i<sockets.size();i++)
+		if (sockets[i]->send_encoded(frame,true)) sent++;
+	return sent;
+}
+
+
+/************* Responder **************/
+bool osl::websocket_responder::respond(osl::http_served_client &client)
+{
+	if (!websocket::requested(client)) return false;
+	websocket ws(client,protocol);
+	if (!ws.is_open()) return true; /* handshake failed, and we've said so */
+	ws.set_ping_interval(ping_msec);
+	hub.add(&ws);
+	on_open(ws);
+	std::string msg;
+	bool is_text;
+	while (ws.receive(msg,&is_text))
+		on_message(ws,msg,is_text);
+	hub.remove(&ws);
+	on_close(ws);
+	return true;
+}
@@ -0,0 +1,146 @@
+/**
+  WebSockets for osl/webserver_threaded: keep a connection open,
+  and push messages both ways.
+
+  A typical usage is to subclass websocket_responder:
+	class status_feed : public osl::websocket_responder {
+	public:
+		void on_message(osl::websocket &ws,const std::string &msg,bool text) {
+			ws.send_text("you said "+msg);
+		}
+	};
+	status_feed *feed=new status_feed;
+	server->add_route("/live",feed);
+	...
+	feed->get_hub().broadcast_text("{\"temperature\":23.5}");
+  and in the browser:
+	var ws=new WebSocket("ws://yourserver/live");
+	ws.onmessage=function(e) { ... e.data ... };
+
+  Each open WebSocket keeps its server thread, as usual for
+  osl::http_threaded_server, waiting for messages from the client.
+*/
+#ifndef __OSL_WEBSERVER_WEBSOCKET_H
+#define __OSL_WEBSERVER_WEBSOCKET_H 1
+
+#include "webserver_threaded.h"
+
+namespace osl {
+
+/**
+ One open WebSocket connection (RFC 6455).
+ Sending is thread-safe; receiving should be done by one thread only.
+*/
+class OSL_DLL websocket {
+public:
+	/**
+	  Accept this client's WebSocket upgrade request, and take over
+	  its connection.  If protocol is nonempty and the client offered
+	  it in Sec-WebSocket-Protocol, we agree to use it.
+	  Check is_open() to see if the handshake worked.
+	*/
+	websocket(http_served_client &client,const std::string &protocol="");
+	~websocket();
+
+	/** Return true if this client is asking for a WebSocket. */
+	static bool requested(http_served_client &client)
+		{return client.is_upgrade("websocket");}
+
+	/** Return true until the connection closes. */
+	bool is_open(void) const {return s!=0 && !closing;}
+	skt_ip_t get_ip(void) const {return ip;}
+
+	/** Send a text (UTF-8) or binary message.  Returns false if the connection is closed. */
+	bool send_text(const std::string &msg) {return send_frame(0x1,msg.data(),msg.size());}
+	bool send_binary(const void *data,int len) {return send_frame(0x2,data,len);}
+	/** Send a ping; the client answers with a pong. */
+	bool ping(const std::string &payload="") {return send_frame(0x9,payload.data(),payload.size());}
+
+	/** Wait for the next whole message from the client.  Pings and
+	   pongs are handled for you.  Returns false once the connection
+	   closes, or if the client goes quiet for too long (see set_ping_interval). */
+	bool receive(std::string &msg,bool *is_text=0);
+
+	/** If the client sends nothing for this many milliseconds, ping it;
+	   if it doesn't answer within another interval, give up on it.
+	   0 (the default) waits forever. */
+	void set_ping_interval(int msec) {ping_msec=msec;}
+	/** Close the connection if the client sends a message bigger than this.
+	   The default is 1MB. */
+	void set_max_message(int bytes) {max_message=bytes;}
+
+	/** Start closing the connection, with this status code and reason. */
+	void close(int code=1000,const std::string &reason="");
+
+	/** Send this already-encoded frame (see encode_frame), without
+	   blocking: if the client isn't keeping up, we drop the connection.
+	   Used for broadcasts, so one slow client can't stall the rest. */
+	bool send_encoded(const std::string &frame,bool nonblocking);
+	/** Build a server-to-client frame with this opcode and payload. */
+	static std::string encode_frame(int opcode,const void *data,int len);
+
+private:
+	SOCKET s;
+	skt_ip_t ip;
+	porlock send_lock; /* keeps frames from different threads whole */
+	bool closing; /* we've sent or received a close frame */
+	int ping_msec, max_message;
+
+	bool send_frame(int opcode,const void *data,int len)
+		{return send_encoded(encode_frame(opcode,data,len),false);}
+	bool read_exact(void *dest,int len,int msec);
+	void drop(void);
+};
+
+/**
+ A set of open WebSockets that all get the same messages.
+*/
+class OSL_DLL websocket_hub {
+public:
+	void add(websocket *ws);
+	void remove(websocket *ws);
+	/** Return the number of sockets in the hub. */
+	int size(void);
+
+	/** Send this message to every socket in the hub.  The message is
+	   framed once, and sockets that can't take it right away are dropped.
+	   Returns the number of sockets it was sent to. */
+	int broadcast_text(const std::string &msg) {return broadcast(0x1,msg.data(),msg.size());}
+	int broadcast_binary(const void *data,int len) {return broadcast(0x2,data,len);}
+private:
+	porlock lock; /* protects sockets */
+	std::vector<websocket *> sockets;
+	int broadcast(int opcode,const void *data,int len);
+};
+
+/**
+ Accepts WebSocket connections, and calls your on_ methods with
+ each one's traffic.  Every connection is in our hub while it's open.
+ Requests that aren't WebSocket upgrades are left for other responders.
+*/
+class OSL_DLL websocket_responder : public http_responder {
+public:
+	websocket_responder(const std::string &protocol_="",int ping_msec_=30000)
+		:protocol(protocol_), ping_msec(ping_msec_) {}
+
+	/* This socket just opened. */
+	virtual void on_open(websocket &ws) {}
+	/* This socket got a message. */
+	virtual void on_message(websocket &ws,const std::string &msg,bool is_text) {}
+	/* This socket is closing. */
+	virtual void on_close(websocket &ws) {}
+
+	/* All currently open sockets */
+	websocket_hub &get_hub(void) {return hub;}
+
+	/* CAUTION: MULTITHREADED CALLS! */
+	bool respond(osl::http_served_client &client);
+private:
+	websocket_hub hub;
+	std::string protocol;
+	int ping_msec;
+};
+
+}; /* end namespace osl */
+
+#endif
@@ -5,6 +5,15 @@
  Orion Sky Lawlor, olawlor@acm.org, 2006/07/11 (Public Domain)
 */
 #include "webservice.h"
+#include <stdio.h> /* for sscanf, sprintf */
+#include <ctype.h> /* for isspace */
+#include <string.h> /* for memchr, memcpy */
+#include <errno.h>
+#ifdef _WIN32
+#  include <io.h> /* for write */
+#else
+#  include <unistd.h>
+#endif
 
 osl::network_progress::~network_progress() {}
 
@@ -35,19 +44,66 @@ osl::url_parser::url_parser(std::string URL) {
 */
 std::string osl::download_url(std::string URL,network_progress &p) {
 	osl::url_parser pu(URL);
-	http_connection c(pu.host,p,pu.port);
+	http_connection c(pu.host,p,pu.port,60,&http_connection_pool::global());
 	c.send_get(pu.path);
 	return c.receive();
 }
 
+std::string int2str(int i) {
+	char buf[100];
+	sprintf(buf,"%d",i);
+	return buf;
+}
+
 /** Initiate an HTTP connection */
-osl::http_connection::http_connection(std::string host_,network_progress &p_,int port,int timeout)
-	:host(host_), p(p_), s(0)
+osl::http_connection::http_connection(std::string host_,network_progress &p_,int port_,int timeout,
+		http_connection_pool *pool_)
+	:host(host_), p(p_), s(0), port(port_), timeout_msec(timeout*1000), pool(pool_), reused(false),
+	 in(64*1024,0), in_start(0), in_end(0)
+{
+	connect(true);
+}
+
+/** Open our connection, or take one from the pool. */
+void osl::http_connection::connect(bool allow_reuse)
+{
+	in_start=in_end=0;
+	if (pool) {
+		s=pool->checkout(host,port,allow_reuse,timeout_msec);
+		reused=(s!=0);
+		if (reused) {
+			p.status(1,"Reusing connection to "+host);
+			return;
+		}
+	}
+	try {
+		p.status(1,"Looking up IP address for "+host);
+		skt_ip_t hostIP=skt_lookup_ip(host.c_str());
+		p.status(1,"Connecting to "+host);
+		s=skt_connect(hostIP,port,timeout_msec/1000);
+	} catch (...) { /* give back our place in the pool */
+		if (pool) pool->discard(host,port);
+		throw;
+	}
+	if (s==INVALID_SOCKET) s=0; /* abort routine returned */
+	if (s==0 && pool) pool->discard(host,port);
+}
+
+void osl::http_connection::close(void)
+{
+	if (s==0) return;
+	skt_close(s); 
+	s=0;
+	if (pool) pool->discard(host,port);
+}
+
+void osl::http_connection::release(void)
 {
-	p.status(1,"Looking up IP address for "+host);
-	skt_ip_t hostIP=skt_lookup_ip(host.c_str());
-	p.status(1,"Connecting to "+host);
-	s=skt_connect(hostIP,port,timeout);
+	if (s && pool && keep_alive() && in_start==in_end) {
+		pool->checkin(host,port,s);
+		s=0;
+	}
+	else close();
 }
 
 /** Send a complete HTTP request, with all HTTP headers prebuilt.
@@ -57,27 +113,45 @@ int osl::http_connection::send(const std::string &data)
 {
 	p.status(1,"Sending HTTP request to "+host);
 	p.status(3,"HTTP request data: "+data);
-	skt_sendN(s,&data[0],data.size());
+	response.reset(data.compare(0,5,"HEAD ")==0);
+	if (reused) { /* the server may have closed this idle connection while it sat in the pool */
+		reused=false;
+		in_start=0;
+		in_end=0;
+		bool sent=(0==skt_try_sendN(s,&data[0],data.size()));
+		if (sent) {
+			if (0==skt_select1(s,timeout_msec)) { /* slow, not closed: it may be working on it */
+				close();
+				skt_call_abort("Timeout waiting for HTTP response");
+				return 0;
+			}
+			in_end=skt_recv_some(s,&in[0],in.size(),timeout_msec);
+		}
+		if (!sent || in_end<=0) { /* closed or reset before any response */
+			bool retryable=(data.compare(0,5,"POST ")!=0 && data.compare(0,6,"PATCH ")!=0);
+			if (!retryable) { /* the server might have acted on it: don't send it twice */
+				close();
+				skt_call_abort("Pooled connection closed before the HTTP response");
+				return 0;
+			}
+			p.status(1,"Pooled connection to "+host+" was closed; reconnecting");
+			close();
+			connect(false);
+			skt_sendN(s,&data[0],data.size());
+		}
+	}
+	else skt_sendN(s,&data[0],data.size());
 	
 	p.status(1,"Waiting for HTTP response from "+host);
-	std::string status=skt_recv_line(s);
-	p.status(2,"HTTP response status: "+status);
-	unsigned int i=0; while (status[i]!=' ' && i<status.size()) i++;
-	std::string codeDesc=status.substr(i,std::string::npos);
-	int code=0;
-	sscanf(codeDesc.c_str(),"%d",&code);
-	
-	std::string l;
-	while (0!=(l=skt_recv_line(s)).size()) 
-	{   /* ^ a zero-length line indicates the end of the HTTP headers */
-		p.status(3,"HTTP response header line: "+l);
-		int firstColon=l.find_first_of(":");
-		std::string keyword=l.substr(0,firstColon);
-		std::string value=l.substr(firstColon+2,std::string::npos);
-		header[keyword]=value;
-	}
+	decode(0); /* just the headers */
+	if (!response.headers_done()) 
+		skt_call_abort("Connection closed before HTTP response headers");
+	p.status(2,"HTTP response status: "+int2str(response.get_status()));
+	const std::map<std::string,std::string> &h=response.get_headers();
+	for (std::map<std::string,std::string>::const_iterator it=h.begin();it!=h.end();++it)
+		p.status(3,"HTTP response header line: "+it->first+": "+it->second);
 	
-	return code;
+	return response.get_status();
 }
 /** Send a simple HTTP GET request for this path name. */
 int osl::http_connection::send_get(const std::string &path,std::string agent)
@@ -87,37 +161,423 @@ int osl::http_connection::send_get(const std::string &path,std::string agent)
 		"User-Agent: "+agent+"\r\n"
 		"\r\n");
 }
-std::string int2str(int i) {
-	char buf[100];
-	sprintf(buf,"%d",i);
-	return buf;
+
+/** Receive more data into our input buffer.  Returns false at end of file. */
+bool osl::http_connection::fill(void)
+{
+	if (s==0) return false;
+	in_start=0;
+	in_end=skt_recv_some(s,&in[0],in.size(),timeout_msec);
+	if (in_end<0) {
+		in_end=0;
+		skt_call_abort("Error or timeout receiving HTTP response");
+		return false;
+	}
+	return in_end>0;
+}
+
+/** Run received data through the response decoder until it's done 
+  (or, if sink is 0, until the headers are done). */
+void osl::http_connection::decode(http_download_sink *sink)
+{
+	long long next_report=1024*1024;
+	while (!response.done()) {
+		if (sink==0 && response.headers_done()) return;
+		if (in_start==in_end && !fill()) { /* server closed the connection */
+			close();
+			if (!response.finish()) skt_call_abort("Connection closed in the middle of an HTTP response");
+			return;
+		}
+		int used=response.feed(&in[in_start],in_end-in_start,sink);
+		if (used<0) {
+			close(); /* the rest of this response is still coming: can't reuse */
+			if (!response.stopped()) skt_call_abort(response.get_error());
+			return;
+		}
+		in_start+=used;
+		if (response.get_body_bytes()>=next_report) {
+			p.status(2,"Retrieved "+int2str((int)(response.get_body_bytes()/1024))+" KiB so far from "+host);
+			next_report+=1024*1024;
+		}
+	}
 }
-int my_min(int a,int b) { if (a<b) return a; else return b; }
 
 /** Receive all HTTP content as a single std::string */
 std::string osl::http_connection::receive(void) 
 {
-	std::string lengthStr=receive_header("Content-Length");
-	int length=0;
-	sscanf(lengthStr.c_str(),"%d",&length);
-	
-	p.status(1,"Retrieving "+int2str(length/1024)+" KiB of HTTP data from "+host);
-	std::string data(length,0x00);
-	enum {chunkSize=8*1024};
-	for (int start=0;start<length;start+=chunkSize) {
-		int amt=my_min(data.size()-start,chunkSize);
-		skt_recvN(s,&data[start],amt);
-		p.status(2,"Retrieved "+int2str((start+amt)/1024)+" KiB so far from "+host);
-	}
-	if (length<1024)
+	std::string data;
+	long long length=response.get_content_length();
+	if (length>0) {
+		p.status(1,"Retrieving "+int2str((int)(length/1024))+" KiB of HTTP data from "+host);
+		data.reserve(length);
+	}
+	http_string_sink sink(data);
+	receive(sink);
+	if (data.size()<1024)
 		p.status(3,"Incoming data: "+data);
 	return data;
 }
+/** Stream all HTTP content into this sink */
+long long osl::http_connection::receive(http_download_sink &sink)
+{
+	decode(&sink);
+	return response.get_body_bytes();
+}
 /** Receive the data on the line with this HTTP header keyword */
 std::string osl::http_connection::receive_header(const std::string &keyword)
 {
-	const std::string &value=header[keyword];
+	std::string value=response.get_header(keyword);
 	p.status(2,"HTTP header keyword "+keyword+" has value "+value);
 	return value;
 }
 
+
+/************* Download sinks **************/
+osl::http_download_sink::~http_download_sink() {}
+
+bool osl::http_fd_sink::write(const char *data,int len)
+{
+	while (len>0) {
+		int w=::write(fd,data,len);
+		if (w<0 && errno==EINTR) continue;
+		if (w<=0) return false;
+		data+=w; len-=w;
+	}
+	return true;
+}
+
+bool osl::http_buffer_sink::write(const char *data,int n)
+{
+	if (n>max-len) {
+		n=max-len;
+		overflow=true;
+	}
+	memcpy(buf+len,data,n);
+	len+=n;
+	return !overflow;
+}
+
+
+/************* Response decoder **************/
+void osl::http_response_decoder::reset(bool head_request)
+{
+	state=s_status;
+	head=head_request;
+	http10=until_close=false;
+	status=0;
+	header.clear();
+	line="";
+	header_bytes=0;
+	content_length=-1;
+	body_bytes=remaining=0;
+	error=0;
+}
+
+static std::string lowercase(std::string s)
+{
+	for (unsigned int i=0;i<s.size();i++) s[i]=tolower((unsigned char)s[i]);
+	return s;
+}
+
+std::string osl::http_response_decoder::get_header(const std::string &name) const
+{
+	std::map<std::string,std::string>::const_iterator it=header.find(lowercase(name));
+	if (it==header.end()) return "";
+	return it->second;
+}
+
+bool osl::http_response_decoder::keep_alive(void) const
+{
+	if (state!=s_done || until_close) return false;
+	std::string c=","+lowercase(get_header("Connection"))+",";
+	for (size_t i=0;i<c.size();i++) if (c[i]==' ') c.erase(i--,1);
+	if (c.find(",close,")!=std::string::npos) return false;
+	return !http10 || c.find(",keep-alive,")!=std::string::npos;
+}
+
+/* Parse this number in base 10 or 16.  Returns -1 if there are no digits or it's too big. */
+static long long parse_length(const std::string &s,int base)
+{
+	size_t i=0;
+	while (i<s.size() && (s[i]==' ' || s[i]=='\t')) i++;
+	long long v=0;
+	int ndigits=0;
+	for (;i<s.size();i++) {
+		int c=tolower((unsigned char)s[i]), d;
+		if (c>='0' && c<='9') d=c-'0';
+		else if (base==16 && c>='a' && c<='f') d=c-'a'+10;
+		else break;
+		if (v>((1LL<<62)-d)/base) return -1;
+		v=v*base+d;
+		ndigits++;
+	}
+	return ndigits>0?v:-1;
+}
+
+/* We've read a whole line: act on it. */
+bool osl::http_response_decoder::end_line(void)
+{
+	size_t n=line.size();
+	while (n>0 && (line[n-1]=='\n' || line[n-1]=='\r')) n--;
+	line.resize(n);
+	switch (state) {
+	case s_status: {
+		if (n==0) return true; /* tolerate blank lines before the status */
+		if (line.compare(0,5,"HTTP/")!=0) {fail("Bad HTTP response status line"); return false;}
+		http10=(line.compare(0,8,"HTTP/1.0")==0);
+		size_t sp=line.find(' ');
+		status=(sp==std::string::npos)?-1:(int)parse_length(line.substr(sp+1),10);
+		if (status<100 || status>999) {fail("Bad HTTP response status code"); return false;}
+		state=s_header;
+		return true;
+	}
+	case s_header: {
+		if (n==0) return end_headers();
+		size_t colon=line.find(':');
+		if (colon==std::string::npos || colon==0) {fail("Bad HTTP response header line"); return false;}
+		size_t v=colon+1;
+		while (v<n && (line[v]==' ' || line[v]=='\t')) v++;
+		size_t e=n;
+		while (e>v && (line[e-1]==' ' || line[e-1]=='\t')) e--;
+		std::string &value=header[lowercase(line.substr(0,colon))];
+		if (value.size()>0) value+=", "; /* repeated header: combine them */
+		value+=line.substr(v,e-v);
+		return true;
+	}
+	case s_chunk_size:
+		remaining=parse_length(line,16); /* ignores any ;extensions */
+		if (remaining<0) {fail("Bad HTTP chunk size"); return false;}
+		state=(remaining==0)?s_trailer:s_chunk_data;
+		return true;
+	case s_chunk_end:
+		if (n!=0) {fail("Missing CRLF after HTTP chunk"); return false;}
+		state=s_chunk_size;
+		return true;
+	case s_trailer:
+		if (n==0) state=s_done; /* trailer headers are ignored */
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* The headers just ended: figure out how the body is sent. */
+bool osl::http_response_decoder::end_headers(void)
+{
+	if (status<200) { /* 100 Continue and friends: the real response follows */
+		header.clear();
+		state=s_status;
+		return true;
+	}
+	std::string cl=get_header("Content-Length");
+	if (cl.size()>0) {
+		content_length=parse_length(cl,10);
+		if (content_length<0) {fail("Bad HTTP Content-Length"); return false;}
+	}
+	if (head || status==204 || status==304) state=s_done; /* never a body */
+	else if (lowercase(get_header("Transfer-Encoding")).find("chunked")!=std::string::npos) {
+		content_length=-1; /* chunking wins */
+		state=s_chunk_size;
+	}
+	else if (content_length>=0) {
+		remaining=content_length;
+		state=(remaining==0)?s_done:s_body_length;
+	}
+	else {
+		until_close=true;
+		state=s_body_close;
+	}
+	return true;
+}
+
+int osl::http_response_decoder::feed(const char *data,int len,http_download_sink *sink)
+{
+	enum {max_header_bytes=256*1024};
+	int used=0;
+	while (used<len) {
+		switch (state) {
+		case s_done: 
+			return used;
+		case s_stopped: case s_error:
+			return -1;
+		case s_body_length: case s_body_close: case s_chunk_data: {
+			if (sink==0) return used; /* caller wanted just the headers */
+			int n=len-used;
+			if (state!=s_body_close && remaining<n) n=(int)remaining;
+			body_bytes+=n;
+			if (!sink->write(data+used,n)) {state=s_stopped; error="Download stopped"; return -1;}
+			used+=n;
+			if (state!=s_body_close) {
+				remaining-=n;
+				if (remaining==0) state=(state==s_chunk_data)?s_chunk_end:s_done;
+			}
+			break;
+		}
+		default: { /* a line of text */
+			const char *nl=(const char *)memchr(data+used,'\n',len-used);
+			int n=nl?(int)(nl-(data+used))+1:len-used;
+			header_bytes+=n;
+			if (header_bytes>max_header_bytes) return fail("HTTP response headers too long");
+			line.append(data+used,n);
+			used+=n;
+			if (nl) {
+				if (!end_line()) return -1;
+				line="";
+			}
+		}
+		}
+	}
+	if (state==s_stopped || state==s_error) return -1;
+	return used;
+}
+
+bool osl::http_response_decoder::finish(void)
+{
+	if (state==s_body_close) state=s_done;
+	else if (state!=s_done) fail("Connection closed in the middle of an HTTP response");
+	return state==s_done;
+}
+
+
+/************* Connection pool **************/
+static osl::http_connection_pool global_pool;
+osl::http_connection_pool &osl::http_connection_pool::global(void) {return global_pool;}
+
+osl::http_connection_pool::http_connection_pool(int max_idle_per_host,int idle_msec_,int max_per_host_)
+	:max_idle(max_idle_per_host), idle_msec(idle_msec_), max_per_host(max_per_host_) {}
+
+osl::http_connection_pool::~http_connection_pool()
+{
+	clear();
+}
+
+void osl::http_connection_pool::set_max_idle_per_host(int n) {porlock_scoped l(&lock); max_idle=n;}
+void osl::http_connection_pool::set_idle_timeout(int msec) {porlock_scoped l(&lock); idle_msec=msec;}
+void osl::http_connection_pool::set_max_per_host(int n) {porlock_scoped l(&lock); max_per_host=n; returned.broadcast();}
+
+static std::string pool_key(const std::string &host,int port)
+{
+	char buf[20];
+	sprintf(buf,":%d",port);
+	return host+buf;
+}
+
+/* Return true if this idle connection still looks usable: the
+   server hasn't closed it, or sent anything we didn't ask for. */
+static bool idle_socket_alive(SOCKET s)
+{
+	fd_set rfds;
+	FD_ZERO(&rfds);
+	FD_SET(s,&rfds);
+	struct timeval tv;
+	tv.tv_sec=tv.tv_usec=0;
+	return 0==select(1+s,&rfds,NULL,NULL,&tv); /* readable means EOF or junk */
+}
+
+/* Close idle connections that have sat too long.  Call with lock held. */
+void osl::http_connection_pool::expire(double now)
+{
+	for (std::map<std::string,host_sockets>::iterator it=hosts.begin();it!=hosts.end();) {
+		std::vector<idle_socket> &idle=it->second.idle;
+		unsigned int n=0;
+		while (n<idle.size() && idle[n].expires<=now) skt_close(idle[n++].s);
+		idle.erase(idle.begin(),idle.begin()+n);
+		if (idle.size()==0 && it->second.active==0) hosts.erase(it++);
+		else ++it;
+	}
+}
+
+SOCKET osl::http_connection_pool::checkout(const std::string &host,int port,bool allow_reuse,int wait_msec)
+{
+	std::string key=pool_key(host,port);
+	porlock_scoped l(&lock);
+	double now=porthread_time(), give_up=now+wait_msec*0.001;
+	expire(now);
+	SOCKET s;
+	while (!take(hosts[key],allow_reuse,now>=give_up,&s)) {
+		returned.wait(&lock,(int)((give_up-now)*1000)+1);
+		now=porthread_time();
+	}
+	return s;
+}
+
+bool osl::http_connection_pool::try_checkout(const std::string &host,int port,bool allow_reuse,SOCKET *s)
+{
+	porlock_scoped l(&lock);
+	expire(porthread_time());
+	return take(hosts[pool_key(host,port)],allow_reuse,false,s);
+}
+
+/* Check out a connection from h into *s, like checkout, and return true;
+   or return false if h is at its limit and over_limit is false.
+   Call with lock held. */
+bool osl::http_connection_pool::take(host_sockets &h,bool allow_reuse,bool over_limit,SOCKET *s)
+{
+	while (allow_reuse && h.idle.size()>0) { /* newest first: least likely to be stale */
+		*s=h.idle.back().s;
+		h.idle.pop_back();
+		if (idle_socket_alive(*s)) {
+			h.active++;
+			return true;
+		}
+		skt_close(*s);
+	}
+	if (max_per_host>0 && h.idle.size()>0 && h.active+(int)h.idle.size()>=max_per_host) {
+		skt_close(h.idle[0].s); /* make room for the new one */
+		h.idle.erase(h.idle.begin());
+	}
+	if (max_per_host<=0 || h.active+(int)h.idle.size()<max_per_host || over_limit) {
+		h.active++;
+		*s=0; /* caller opens a new connection */
+		return true;
+	}
+	return false;
+}
+
+void osl::http_connection_pool::checkin(const std::string &host,int port,SOCKET s)
+{
+	porlock_scoped l(&lock);
+	double now=porthread_time();
+	host_sockets &h=hosts[pool_key(host,port)];
+	h.active--;
+	if (max_idle>0 && idle_msec>0) {
+		if ((int)h.idle.size()>=max_idle) { /* full: replace the oldest */
+			skt_close(h.idle[0].s);
+			h.idle.erase(h.idle.begin());
+		}
+		idle_socket i;
+		i.s=s;
+		i.expires=now+idle_msec*0.001;
+		h.idle.push_back(i);
+	}
+	else skt_close(s);
+	expire(now);
+	returned.broadcast();
+}
+
+void osl::http_connection_pool::discard(const std::string &host,int port)
+{
+	porlock_scoped l(&lock);
+	hosts[pool_key(host,port)].active--;
+	returned.broadcast();
+}
+
+void osl::http_connection_pool::clear(void)
+{
+	porlock_scoped l(&lock);
+	for (std::map<std::string,host_sockets>::iterator it=hosts.begin();it!=hosts.end();++it) {
+		std::vector<idle_socket> &idle=it->second.idle;
+		for (unsigned int i=0;i<idle.size();i++) skt_close(idle[i].s);
+		idle.clear();
+	}
+	returned.broadcast();
+}
+
+int osl::http_connection_pool::idle_count(void)
+{
+	porlock_scoped l(&lock);
+	int n=0;
+	for (std::map<std::string,host_sockets>::iterator it=hosts.begin();it!=hosts.end();++it)
+		n+=it->second.idle.size();
+	return n;
+}
@@ -9,7 +9,9 @@
 
 #include "osl_dll.h"
 #include "socket.h"
+#include "porthread.h"
 #include <string>
+#include <vector>
 #include <map>
 
 namespace osl {
@@ -31,6 +33,123 @@ public:
 	virtual ~network_progress();
 };
 
+/**
+ Receives the body of an HTTP response a piece at a time, 
+ so big downloads never need to fit in memory.
+*/
+class OSL_DLL http_download_sink {
+public:
+	/** Here's the next piece of the body.  Return false to stop the download. */
+	virtual bool write(const char *data,int len) =0;
+	virtual ~http_download_sink();
+};
+
+/** Appends the body onto a std::string. */
+class OSL_DLL http_string_sink : public http_download_sink {
+public:
+	http_string_sink(std::string &dest_) :dest(dest_) {}
+	bool write(const char *data,int len) {dest.append(data,len); return true;}
+private:
+	std::string &dest;
+};
+
+/** Writes the body to a file descriptor, like an open file or pipe. */
+class OSL_DLL http_fd_sink : public http_download_sink {
+public:
+	http_fd_sink(int fd_) :fd(fd_) {}
+	bool write(const char *data,int len);
+private:
+	int fd;
+};
+
+/** Copies the body into a fixed-size buffer.  If the body doesn't fit,
+   the download stops once the buffer is full, and overflowed() returns true. */
+class OSL_DLL http_buffer_sink : public http_download_sink {
+public:
+	http_buffer_sink(void *buf_,int max_) :buf((char *)buf_), max(max_), len(0), overflow(false) {}
+	bool write(const char *data,int n);
+	/** Return the number of bytes in the buffer so far. */
+	int length(void) const {return len;}
+	bool overflowed(void) const {return overflow;}
+private:
+	char *buf;
+	int max, len;
+	bool overflow;
+};
+
+/** Calls your function with each piece of the body. */
+class OSL_DLL http_callback_sink : public http_download_sink {
+public:
+	/* Return false to stop the download. */
+	typedef bool (*callback_t)(void *user,const char *data,int len);
+	http_callback_sink(callback_t fn_,void *user_=0) :fn(fn_), user(user_) {}
+	bool write(const char *data,int len) {return fn(user,data,len);}
+private:
+	callback_t fn;
+	void *user;
+};
+
+/**
+ Decodes an HTTP/1.x response as its bytes arrive: the status line,
+ the header lines, and then a body sent with a Content-Length, with
+ chunked Transfer-Encoding, or by closing the connection.
+ It never touches the network, so the bytes can come from anywhere.
+*/
+class OSL_DLL http_response_decoder {
+public:
+	http_response_decoder() {reset();}
+	/** Get ready for the next response.  Replies to HEAD requests have no body. */
+	void reset(bool head_request=false);
+
+	/** Decode these len bytes of response.  Body data goes to sink; 
+	  if sink is 0, we stop as soon as the headers are complete.
+	  Returns the number of bytes used, which can be less than len 
+	  if the response (or its headers) ended partway through,
+	  or -1 if the response is malformed or the sink stopped it.
+	*/
+	int feed(const char *data,int len,http_download_sink *sink);
+	/** The connection closed.  Returns true if that ended the response properly. */
+	bool finish(void);
+
+	bool headers_done(void) const {return state>=s_body_length;}
+	bool done(void) const {return state==s_done;}
+	/** Return true if the sink asked us to stop. */
+	bool stopped(void) const {return state==s_stopped;}
+	/** Return a description of what was wrong with the response, or 0 if nothing. */
+	const char *get_error(void) const {return error;}
+
+	/** Return the HTTP status code, like 200. */
+	int get_status(void) const {return status;}
+	/** Return the value of this response header (any case), or empty string if none. */
+	std::string get_header(const std::string &name) const;
+	/** All the response headers, with lowercase names. */
+	const std::map<std::string,std::string> &get_headers(void) const {return header;}
+	/** Return the Content-Length, or -1 if the response didn't give one. */
+	long long get_content_length(void) const {return content_length;}
+	/** Return the number of body bytes sent to the sink so far. */
+	long long get_body_bytes(void) const {return body_bytes;}
+	/** Return true if the connection can carry another request after this response. */
+	bool keep_alive(void) const;
+private:
+	enum state_t {
+		s_status, s_header, /* reading lines */
+		s_body_length, s_body_close, s_chunk_size, s_chunk_data, s_chunk_end, s_trailer,
+		s_done, s_stopped, s_error
+	} state;
+	bool head, http10;
+	bool until_close; /* the body ends when the connection closes */
+	int status;
+	std::map<std::string,std::string> header; /* lowercase names */
+	std::string line; /* incomplete line so far */
+	int header_bytes;
+	long long content_length, body_bytes, remaining;
+	const char *error;
+
+	int fail(const char *why) {error=why; state=s_error; return -1;}
+	bool end_line(void);
+	bool end_headers(void);
+};
+
 /**
  Retrieve HTTP content data from this URL.  
  You only need the more complicated classes below for more complex
@@ -53,14 +172,81 @@ public:
 	int port; /** e.g., 80 */
 };
 
+/**
+ Keeps idle keep-alive connections to web servers, so repeated
+ requests to the same host and port skip the DNS lookup and TCP
+ handshake.  http_connection uses one if you pass it in;
+ download_url always uses the process-wide global() pool.
+ Thread-safe.
+*/
+class OSL_DLL http_connection_pool {
+public:
+	/** Keep up to max_idle_per_host idle connections to each host,
+	  for at most idle_msec milliseconds each.  If max_per_host is 
+	  nonzero, at most that many connections to one host are open
+	  at once; more requests wait for one to come back. */
+	http_connection_pool(int max_idle_per_host=8,int idle_msec=30000,int max_per_host=0);
+	/** Closes all idle connections. */
+	~http_connection_pool();
+	
+	/** The pool shared by everything in this process. */
+	static http_connection_pool &global(void);
+	
+	void set_max_idle_per_host(int n);
+	void set_idle_timeout(int msec);
+	void set_max_per_host(int n);
+	
+	/** Return a live idle connection to this host and port, 
+	  or 0 if you should open a new one (or allow_reuse is false).
+	  Either way, the connection counts against max_per_host
+	  until you checkin or discard it.  If the host is at its limit, 
+	  we wait up to wait_msec for a connection to come back. */
+	SOCKET checkout(const std::string &host,int port,bool allow_reuse=true,int wait_msec=60000);
+	/** Like checkout, but never waits: if the host is at its limit, 
+	  returns false.  Otherwise returns true, and sets *s like checkout. */
+	bool try_checkout(const std::string &host,int port,bool allow_reuse,SOCKET *s);
+	/** This checked-out connection is ready for another request: keep it. */
+	void checkin(const std::string &host,int port,SOCKET s);
+	/** This checked-out connection is gone (you closed it). */
+	void discard(const std::string &host,int port);
+	
+	/** Close all idle connections. */
+	void clear(void);
+	/** Return the number of idle connections, to all hosts. */
+	int idle_count(void);
+private:
+	struct idle_socket {
+		SOCKET s;
+		double expires; /* porthread_time() we close it */
+	};
+	struct host_sockets {
+		std::vector<idle_socket> idle; /* oldest first */
+		int active; /* checked out right now */
+		host_sockets() :active(0) {}
+	};
+	porlock lock; /* protects everything below */
+	porcond returned; /* signaled when a connection is checked in or discarded */
+	std::map<std::string,host_sockets> hosts; /* keyed by "host:port" */
+	int max_idle, idle_msec, max_per_host;
+	
+	void expire(double now);
+	bool take(host_sockets &h,bool allow_reuse,bool over_limit,SOCKET *s);
+};
+
 /**
  Manage the details of an HTTP client connection.
  HTTP is the protocol used on the web.
 */
 class OSL_DLL http_connection {
 public:
-	http_connection(std::string host,network_progress &p,int port=80,int timeoutSeconds=60);
-	~http_connection() { close();}
+	/** Connect to this host.  If pool is nonzero, we reuse an idle
+	  connection from it if possible, and give our connection back
+	  to it when we're destroyed (if it's still usable).  
+	  If the server closed a reused connection, send will 
+	  reconnect and resend the request once. */
+	http_connection(std::string host,network_progress &p,int port=80,int timeoutSeconds=60,
+		http_connection_pool *pool=0);
+	~http_connection() { release();}
 	
 	/** Send a complete HTTP request, with all HTTP headers prebuilt.
 	  Returns HTTP status code, like 200 (OK).
@@ -71,17 +257,38 @@ public:
 	
 	/** Receive all HTTP content as a single std::string */
 	std::string receive(void);
-	/** Look up the value of the HTTP header line with this keyword */
+	/** Stream the HTTP content into this sink, in constant memory.
+	  Chunked and close-delimited replies are decoded for you.
+	  Returns the number of body bytes delivered.  If the sink stops
+	  the download early, we close the connection. */
+	long long receive(http_download_sink &sink);
+	/** Look up the value of the HTTP header line with this keyword (any case) */
 	std::string receive_header(const std::string &keyword);
+	/** Return the decoder for the last response, with all its headers */
+	const http_response_decoder &get_response(void) const {return response;}
+	/** Return true if we can send another request on this connection */
+	bool keep_alive(void) const {return s!=0 && response.keep_alive();}
 	
 	/** Close our TCP connection.  Happens automatically when object is destroyed,
 	  and can safely be repeated. */
-	void close(void) { if (s) skt_close(s); s=0; }
+	void close(void);
+	/** Give our connection back to the pool if it's reusable, else close it. */
+	void release(void);
 private:
 	std::string host; /**< DNS hostname we will connect to */
 	network_progress &p; /**< progress indicator */
 	SOCKET s; /**< connected TCP/IP socket we talk on */
-	std::map<std::string,std::string> header; /**< http header names and values */
+	int port; /**< TCP port we connect to */
+	int timeout_msec; /**< longest we wait for the server to send anything */
+	http_connection_pool *pool; /**< where our connection comes from and goes back to, or 0 */
+	bool reused; /**< our connection came from the pool, and hasn't answered yet */
+	http_response_decoder response; /**< status, headers, and body decoding */
+	std::string in; /**< bytes received but not yet decoded */
+	int in_start, in_end; /**< range of in that's still waiting */
+	
+	void connect(bool allow_reuse);
+	bool fill(void);
+	void decode(http_download_sink *sink);
 };
 
 };
@@ -0,0 +1,526 @@
+/**
+ Asynchronous HTTP client, on one select-based event-loop thread.
+*/
+#include "webservice_async.h"
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#if !defined(MSG_NOSIGNAL)
+#  define MSG_NOSIGNAL 0
+#endif
+
+osl::download_callback::~download_callback() {}
+
+/* Return true if the last non-blocking socket call failed only
+   because it would have had to wait. */
+static bool async_would_block(void)
+{
+#if defined(_WIN32) && !defined(__CYGWIN__)
+	return WSAGetLastError()==WSAEWOULDBLOCK;
+#else
+	return errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR;
+#endif
+}
+
+/* Seconds we keep using a hostname's IP address before looking it up again */
+static const double async_dns_seconds=300.0;
+
+/* One request, shared by the client and any http_futures.
+   Everything but the lock-protected fields belongs to the event loop. */
+class osl::http_async_call {
+public:
+	enum {s_queued, s_resolving, s_waiting, s_connecting, s_sending, s_receiving} state;
+	porthread_atomic_t refs; /* we're deleted when this hits zero */
+	porthread_atomic_t cancelled;
+
+	porlock lock; /* protects done, client, and (once done) result */
+	porcond finished;
+	bool done;
+	osl::http_async_client *client; /* 0 once we're done */
+	osl::download_result result;
+	osl::download_callback *cb;
+
+	std::string method, host; int port;
+	bool retryable; /* safe to send again, if a pooled connection was dead */
+	SOCKET s;
+	bool reused; /* s came from the pool, and hasn't answered yet */
+	bool retried; /* we already reconnected once */
+	std::string request;
+	unsigned int sent;
+	osl::http_response_decoder response;
+	double deadline;
+
+	http_async_call() :state(s_queued), refs(1), cancelled(0), done(false), client(0), cb(0),
+		port(80), retryable(true), s(0), reused(false), retried(false), sent(0), deadline(0) {}
+	void ref(void) {porthread_atomic_add(&refs,1);}
+	void unref(void) {if (0==porthread_atomic_add(&refs,-1)) delete this;}
+};
+
+
+/************* Future **************/
+osl::http_future::http_future(http_async_call *c) :call(c) {if (call) call->ref();}
+osl::http_future::http_future(const http_future &f) :call(f.call) {if (call) call->ref();}
+osl::http_future &osl::http_future::operator=(const http_future &f)
+{
+	if (f.call) f.call->ref();
+	if (call) call->unref();
+	call=f.call;
+	return *this;
+}
+osl::http_future::~http_future() {if (call) call->unref();}
+
+bool osl::http_future::ready(void) const
+{
+	if (!call) return false;
+	porlock_scoped l(&call->lock);
+	return call->done;
+}
+
+bool osl::http_future::wait(int msec) const
+{
+	if (!call) return false;
+	double give_up=porthread_time()+msec*0.001;
+	porlock_scoped l(&call->lock);
+	while (!call->done) {
+		if (msec<=0) call->finished.wait(&call->lock);
+		else {
+			double left=give_up-porthread_time();
+			if (left<=0) return false;
+			call->finished.wait(&call->lock,(int)(left*1000)+1);
+		}
+	}
+	return true;
+}
+
+osl::download_result &osl::http_future::get(void)
+{
+	static download_result invalid;
+	if (!call) return invalid;
+	wait(0);
+	return call->result;
+}
+
+void osl::http_future::cancel(void)
+{
+	if (!call) return;
+	porthread_atomic_store(&call->cancelled,1);
+	porlock_scoped l(&call->lock);
+	if (call->client) call->client->wake();
+}
+
+
+/************* Client **************/
+osl::http_async_client::http_async_client(int max_parallel_,http_connection_pool *pool_)
+	:max_parallel(max_parallel_<1?1:max_parallel_), pool(pool_), resolvers(0), quit(false), buf(64*1024,0)
+{
+	if (max_parallel>FD_SETSIZE/2) max_parallel=FD_SETSIZE/2;
+	/* A loopback connection to ourselves, so other threads can interrupt select */
+	unsigned int port=0;
+	skt_ip_t loopback=skt_lookup_ip("127.0.0.1");
+	SERVER_SOCKET server=skt_server_ip(&port,&loopback);
+	wake_send=skt_connect(loopback,port,10);
+	wake_recv=skt_accept(server,0,0);
+	skt_close(server);
+	skt_set_blocking(wake_send,0);
+	skt_set_blocking(wake_recv,0);
+	thread=porthread_create(run,this);
+}
+
+osl::http_async_client::~http_async_client()
+{
+	{
+		porlock_scoped l(&lock);
+		quit=true;
+	}
+	wake();
+	porthread_wait(thread);
+	while (active.size()>0) finish(active[0],"Cancelled");
+	while (true) {
+		http_async_call *c;
+		{
+			porlock_scoped l(&lock);
+			if (queue.size()==0) break;
+			c=queue.front();
+			queue.pop_front();
+		}
+		finish(c,"Cancelled");
+	}
+	{
+		porlock_scoped l(&lock);
+		while (resolvers>0) resolvers_done.wait(&lock);
+	}
+	skt_close(wake_send);
+	skt_close(wake_recv);
+}
+
+static porlock shared_lock;
+static osl::http_async_client *shared_client=0;
+osl::http_async_client &osl::http_async_client::shared(void)
+{
+	porlock_scoped l(&shared_lock);
+	if (!shared_client) shared_client=new http_async_client; /* lives until exit */
+	return *shared_client;
+}
+
+void osl::http_async_client::wake(void)
+{
+	char c=0;
+	send(wake_send,&c,1,MSG_NOSIGNAL); /* if the socket's full, select will wake anyway */
+}
+
+osl::http_future osl::http_async_client::get(const std::string &url,int timeout_msec,download_callback *cb)
+{
+	return request("GET",url,"","",timeout_msec,cb);
+}
+
+osl::http_future osl::http_async_client::request(const std::string &method,const std::string &url,
+	const std::string &headers,const std::string &body,int timeout_msec,download_callback *cb)
+{
+	http_async_call *c=new http_async_call;
+	c->client=this;
+	c->cb=cb;
+	c->result.url=url;
+	c->method=method;
+	c->retryable=(method!="POST" && method!="PATCH");
+	c->deadline=porthread_time()+timeout_msec*0.001;
+	url_parser u(url);
+	c->host=u.host;
+	c->port=u.port;
+	if (u.protocol=="http") {
+		std::string path=u.path.size()>0?u.path:"/";
+		char extra[100];
+		sprintf(extra,":%d",u.port);
+		c->request=method+" "+path+" HTTP/1.1\r\n"
+			"Host: "+u.host+(u.port!=80?extra:"")+"\r\n"
+			"User-Agent: Mozilla/5.0 (compatible; OSL web service)\r\n"+headers;
+		if (body.size()>0 || method=="POST" || method=="PUT") {
+			sprintf(extra,"Content-Length: %d\r\n",(int)body.size());
+			c->request+=extra;
+		}
+		c->request+="\r\n"+body;
+	}
+	http_future f(c);
+	{
+		porlock_scoped l(&lock);
+		queue.push_back(c);
+	}
+	wake();
+	return f;
+}
+
+int osl::http_async_client::pending(void)
+{
+	porlock_scoped l(&lock);
+	return queue.size()+active.size();
+}
+
+void osl::http_async_client::run(void *client)
+{
+	((http_async_client *)client)->loop();
+}
+
+void osl::http_async_client::loop(void)
+{
+	while (true) {
+		{
+			porlock_scoped l(&lock);
+			if (quit) return;
+		}
+		step();
+	}
+}
+
+/* Start working on this call, which just left the queue */
+void osl::http_async_client::start(http_async_call *c)
+{
+	{
+		porlock_scoped l(&lock);
+		active.push_back(c);
+	}
+	if (c->request.size()==0) {finish(c,"Only http:// URLs are supported"); return;}
+	c->state=http_async_call::s_resolving;
+	if (resolved(c,true)) connect_or_finish(c);
+}
+
+/* Return true if we know c's host's IP address (or that it has none).
+   Otherwise start looking it up, unless somebody already is.
+   If fresh, an old address, or an old failure, doesn't count. */
+bool osl::http_async_client::resolved(http_async_call *c,bool fresh)
+{
+	bool known, lookup=false;
+	{
+		porlock_scoped l(&lock);
+		std::map<std::string,dns_entry>::iterator it=ips.find(c->host);
+		if (fresh && it!=ips.end() && it->second.expires<=porthread_time()) {
+			ips.erase(it);
+			it=ips.end();
+		}
+		known=(it!=ips.end());
+		if (!known && !resolving[c->host]) {
+			resolving[c->host]=lookup=true;
+			resolvers++;
+		}
+	}
+	if (lookup) { /* a blocking DNS lookup, on a thread of its own */
+		std::pair<http_async_client *,std::string> *arg=new std::pair<http_async_client *,std::string>(this,c->host);
+		porthread_detach(porthread_create(resolve,arg));
+	}
+	return known;
+}
+
+void osl::http_async_client::resolve(void *arg)
+{
+	std::pair<http_async_client *,std::string> *a=(std::pair<http_async_client *,std::string> *)arg;
+	dns_entry e;
+	e.ip=skt_lookup_invalid(a->second.c_str());
+	/* A failure only goes to the calls waiting on it now */
+	e.expires=skt_ip_match(e.ip,_skt_invalid_ip)?0:porthread_time()+async_dns_seconds;
+	http_async_client *client=a->first;
+	{
+		porlock_scoped l(&client->lock);
+		client->ips[a->second]=e;
+		client->resolving.erase(a->second);
+		client->wake();
+		client->resolvers--;
+		client->resolvers_done.broadcast();
+	}
+	delete a;
+}
+
+/* Get a socket for c, pooled or newly connecting, or leave it waiting
+   for the pool to have room.  Returns an error, or 0. */
+const char *osl::http_async_client::connect(http_async_call *c,bool allow_reuse)
+{
+	c->sent=0;
+	c->response.reset(c->method=="HEAD");
+	c->s=0;
+	if (!resolved(c,false)) { /* forgotten since: wait for a new lookup */
+		c->state=http_async_call::s_resolving;
+		return 0;
+	}
+	if (pool && !pool->try_checkout(c->host,c->port,allow_reuse,&c->s)) {
+		c->state=http_async_call::s_waiting; /* host is at max_per_host: try again later */
+		return 0;
+	}
+	c->reused=(c->s!=0);
+	if (c->reused) {
+		skt_set_blocking(c->s,0);
+		c->state=http_async_call::s_sending;
+		return 0;
+	}
+	skt_ip_t ip;
+	{
+		porlock_scoped l(&lock);
+		ip=ips[c->host].ip;
+	}
+	const char *error=0;
+	if (skt_ip_match(ip,_skt_invalid_ip)) error="Invalid domain name";
+	else {
+		c->s=skt_start_connect(ip,c->port);
+		if (c->s==INVALID_SOCKET) {c->s=0; error="Could not connect";}
+	}
+	if (error) {
+		if (pool) pool->discard(c->host,c->port);
+		return error;
+	}
+	c->state=http_async_call::s_connecting;
+	return 0;
+}
+
+void osl::http_async_client::connect_or_finish(http_async_call *c)
+{
+	const char *error=connect(c,true);
+	if (error) finish(c,error);
+}
+
+void osl::http_async_client::close(http_async_call *c)
+{
+	if (c->s==0) return;
+	skt_close(c->s);
+	c->s=0;
+	if (pool) pool->discard(c->host,c->port);
+}
+
+/* This call is over: report it, and forget it. */
+void osl::http_async_client::finish(http_async_call *c,const char *error)
+{
+	download_result &r=c->result;
+	if (error) {
+		r.error=error;
+		close(c);
+	}
+	else if (c->s && pool && c->response.keep_alive()) {
+		skt_set_blocking(c->s,1);
+		pool->checkin(c->host,c->port,c->s);
+		c->s=0;
+	}
+	else close(c);
+	r.status=c->response.get_status();
+	r.headers=c->response.get_headers();
+	{
+		porlock_scoped l(&lock);
+		for (unsigned int i=0;i<active.size();i++)
+			if (active[i]==c) {
+				active.erase(active.begin()+i);
+				break;
+			}
+	}
+	if (c->cb) c->cb->downloaded(r);
+	{
+		porlock_scoped l(&c->lock);
+		c->done=true;
+		c->client=0;
+		c->finished.broadcast();
+	}
+	c->unref();
+}
+
+/* The connection failed.  If it was an idle pooled connection the server
+   had already closed, try again on a new connection; otherwise give up. */
+void osl::http_async_client::retry_or_fail(http_async_call *c,const char *why)
+{
+	bool retry=c->reused && !c->retried && c->retryable;
+	close(c);
+	if (retry) {
+		c->retried=true;
+		c->result.body="";
+		why=connect(c,false);
+		if (!why) return;
+	}
+	finish(c,why);
+}
+
+void osl::http_async_client::do_send(http_async_call *c)
+{
+	int n=send(c->s,&c->request[c->sent],c->request.size()-c->sent,MSG_NOSIGNAL);
+	if (n<0 && async_would_block()) return;
+	if (n<=0) {retry_or_fail(c,"Error sending HTTP request"); return;}
+	c->sent+=n;
+	if (c->sent==c->request.size()) c->state=http_async_call::s_receiving;
+}
+
+void osl::http_async_client::do_receive(http_async_call *c)
+{
+	int n=recv(c->s,&buf[0],buf.size(),0);
+	if (n<0 && async_would_block()) return;
+	if (n<=0) { /* closed or broken */
+		if (c->reused) retry_or_fail(c,"Connection closed before HTTP response");
+		else if (n==0 && c->response.finish()) finish(c,0);
+		else finish(c,n==0?"Connection closed in the middle of an HTTP response":"Error receiving HTTP response");
+		return;
+	}
+	c->reused=false; /* it answered: it's not stale */
+	http_string_sink sink(c->result.body);
+	int used=c->response.feed(&buf[0],n,&sink);
+	if (used<0) finish(c,c->response.get_error());
+	else if (c->response.done()) {
+		if (used<n) close(c); /* junk after the response: can't reuse */
+		finish(c,0);
+	}
+}
+
+/* Wait for some network activity, and act on it */
+void osl::http_async_client::step(void)
+{
+	double now=porthread_time(), wake_at=now+1.0;
+	std::vector<http_async_call *> starting, cancelled;
+	{ /* Take new calls off the queue, and sweep it for dead ones */
+		porlock_scoped l(&lock);
+		for (unsigned int i=0;i<queue.size();) {
+			http_async_call *c=queue[i];
+			if (porthread_atomic_load(&c->cancelled) || c->deadline<=now) {
+				cancelled.push_back(c);
+				queue.erase(queue.begin()+i);
+			}
+			else {
+				if (c->deadline<wake_at) wake_at=c->deadline;
+				i++;
+			}
+		}
+		while (queue.size()>0 && active.size()+starting.size()<(unsigned int)max_parallel) {
+			starting.push_back(queue.front());
+			queue.pop_front();
+		}
+	}
+	for (unsigned int i=0;i<cancelled.size();i++)
+		finish(cancelled[i],porthread_atomic_load(&cancelled[i]->cancelled)?"Cancelled":"Timeout");
+	for (unsigned int i=0;i<starting.size();i++) start(starting[i]);
+
+	/* Calls waiting on DNS that's come back, or for room in the pool */
+	std::vector<http_async_call *> list=active; /* active changes as calls finish */
+	bool waiting=false;
+	for (unsigned int i=0;i<list.size();i++) {
+		http_async_call *c=list[i];
+		if (c->state==http_async_call::s_resolving && resolved(c,false))
+			connect_or_finish(c);
+		else if (c->state==http_async_call::s_waiting) {
+			const char *error=connect(c,!c->retried);
+			if (error) finish(c,error);
+			else if (c->state==http_async_call::s_waiting) waiting=true;
+		}
+	}
+	if (waiting && wake_at>now+0.05) 
+		wake_at=now+0.05; /* other threads' connections coming back don't wake us */
+
+	fd_set rfds, wfds, efds;
+	FD_ZERO(&rfds); FD_ZERO(&wfds); FD_ZERO(&efds);
+	FD_SET(wake_recv,&rfds);
+	SOCKET maxfd=wake_recv;
+	for (unsigned int i=0;i<active.size();i++) {
+		http_async_call *c=active[i];
+		if (c->deadline<wake_at) wake_at=c->deadline;
+		if (c->state==http_async_call::s_resolving || c->state==http_async_call::s_waiting) continue;
+		if (c->state==http_async_call::s_receiving) FD_SET(c->s,&rfds);
+		else FD_SET(c->s,&wfds);
+		if (c->state==http_async_call::s_connecting) FD_SET(c->s,&efds); /* Windows reports failures here */
+		if (c->s>maxfd) maxfd=c->s;
+	}
+	struct timeval tv;
+	double wait=wake_at-now;
+	if (wait<0) wait=0;
+	tv.tv_sec=(int)wait;
+	tv.tv_usec=(int)((wait-tv.tv_sec)*1.0e6);
+	int n=select(1+maxfd,&rfds,&wfds,&efds,&tv);
+	if (n<0) {
+		if (!async_would_block()) porthread_yield(10); /* shouldn't happen: don't spin */
+		return;
+	}
+	if (FD_ISSET(wake_recv,&rfds)) { /* just drain the wakeups */
+		char junk[256];
+		while (recv(wake_recv,junk,sizeof(junk),0)>0) {}
+	}
+
+	now=porthread_time();
+	list=active;
+	for (unsigned int i=0;i<list.size();i++) {
+		http_async_call *c=list[i];
+		SOCKET s=c->s;
+		switch (c->state) {
+		case http_async_call::s_connecting:
+			if (FD_ISSET(s,&efds) || (FD_ISSET(s,&wfds) && 0!=skt_finish_connect(s))) {
+				finish(c,"Could not connect");
+				continue;
+			}
+			if (FD_ISSET(s,&wfds)) {
+				c->state=http_async_call::s_sending;
+				do_send(c);
+			}
+			break;
+		case http_async_call::s_sending:
+			if (FD_ISSET(s,&wfds)) do_send(c);
+			break;
+		case http_async_call::s_receiving:
+			if (FD_ISSET(s,&rfds)) do_receive(c);
+			break;
+		default:
+			break;
+		}
+	}
+	/* Whatever's left past its deadline has timed out, or been cancelled */
+	list=active;
+	for (unsigned int i=0;i<list.size();i++) {
+		if (porthread_atomic_load(&list[i]->cancelled)) finish(list[i],"Cancelled");
+		else if (list[i]->deadline<=now) finish(list[i],"Timeout");
+	}
+}
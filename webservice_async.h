@@ -0,0 +1,151 @@
+/**
+ Asynchronous HTTP client: start requests without waiting for them,
+ and pick up the results later (or get called back when they finish).
+	osl::http_async_client &client=osl::http_async_client::shared();
+	osl::http_future a=client.get("http://www.foo.com/a.txt");
+	osl::http_future b=client.get("http://www.bar.com/b.txt",500);
+	... do other work ...
+	if (a.get().ok()) use(a.get().body);
+	if (!b.wait(100)) b.cancel();
+
+ One event-loop thread per client multiplexes every request with
+ non-blocking sockets and select, reusing keep-alive connections
+ from an http_connection_pool.  Hostnames are looked up on helper
+ threads, so a slow DNS server doesn't stall the other requests.
+*/
+#ifndef __OSL_WEBSERVICE_ASYNC_H
+#define __OSL_WEBSERVICE_ASYNC_H
+
+#include "webservice.h"
+#include <vector>
+#include <deque>
+
+namespace osl {
+
+/** How one request turned out. */
+class OSL_DLL download_result {
+public:
+	std::string url;
+	int index; /**< position of url in the list, for download_urls */
+	int status; /**< HTTP status code, like 200, or 0 if we never got one */
+	std::string error; /**< empty if we got a whole response, else what went wrong */
+	std::map<std::string,std::string> headers; /**< response headers, lowercase names */
+	std::string body;
+
+	download_result() :index(-1), status(0) {}
+	/** Return true if we got a whole 2xx response. */
+	bool ok(void) const {return error.size()==0 && status>=200 && status<300;}
+};
+
+/** Gets told about each request as soon as it finishes. */
+class OSL_DLL download_callback {
+public:
+	/** This request just finished (or failed, or was cancelled).
+	  For http_async_client this is called from its event-loop thread,
+	  so keep it short and don't wait on other requests here. */
+	virtual void downloaded(download_result &r) =0;
+	virtual ~download_callback();
+};
+
+class http_async_call;
+
+/**
+ The result of an asynchronous request, once it's finished.
+ Copies all refer to the same request.
+*/
+class OSL_DLL http_future {
+public:
+	http_future() :call(0) {}
+	http_future(const http_future &f);
+	http_future &operator=(const http_future &f);
+	~http_future();
+	/** Return true if this refers to a request at all. */
+	bool valid(void) const {return call!=0;}
+
+	/** Return true if the request has finished. */
+	bool ready(void) const;
+	/** Wait up to msec milliseconds (0 for forever) for the request
+	  to finish.  Returns true if it has. */
+	bool wait(int msec=0) const;
+	/** Wait for the request to finish, and return its result. */
+	download_result &get(void);
+	/** Give up on this request, if it hasn't finished yet.
+	  Its result's error will be "Cancelled". */
+	void cancel(void);
+
+	http_future(http_async_call *c); /* for http_async_client only */
+private:
+	http_async_call *call;
+};
+
+/**
+ Runs HTTP requests on a background event-loop thread.
+ All methods are thread-safe.
+*/
+class OSL_DLL http_async_client {
+public:
+	/** Run at most max_parallel requests at once (more wait their turn),
+	  on connections from this pool.  Requests to a host at the pool's
+	  max_per_host wait for one of its connections to come back. */
+	http_async_client(int max_parallel=64,http_connection_pool *pool=&http_connection_pool::global());
+	/** Cancels anything still running, and stops the event loop. */
+	~http_async_client();
+
+	/** A client shared by everything in this process. */
+	static http_async_client &shared(void);
+
+	/** Start a GET of this http:// URL.  If it hasn't finished within
+	  timeout_msec milliseconds from now, it fails with "Timeout".
+	  If cb is nonzero, it's called when the request finishes. */
+	http_future get(const std::string &url,int timeout_msec=60000,download_callback *cb=0);
+	/** Start any request.  headers are extra prebuilt header lines,
+	  like "Content-Type: text/plain\r\n"; body is sent with a
+	  Content-Length if it's nonempty, or if the method is POST or PUT. */
+	http_future request(const std::string &method,const std::string &url,
+		const std::string &headers="",const std::string &body="",
+		int timeout_msec=60000,download_callback *cb=0);
+
+	/** Return the number of requests that haven't finished yet. */
+	int pending(void);
+
+	/* Interrupt the event loop's select, so it notices new work. */
+	void wake(void);
+private:
+	int max_parallel;
+	http_connection_pool *pool;
+	porlock lock; /* protects everything below */
+	std::deque<http_async_call *> queue; /* not started yet, oldest first */
+	std::vector<http_async_call *> active; /* started; changed only by the event loop */
+	struct dns_entry {
+		skt_ip_t ip; /* or _skt_invalid_ip, if the lookup failed */
+		double expires; /* porthread_time() we look it up again */
+	};
+	std::map<std::string,dns_entry> ips; /* DNS cache, by hostname */
+	std::map<std::string,bool> resolving; /* hostnames being looked up now */
+	int resolvers; /* DNS lookup threads still running */
+	porcond resolvers_done;
+	bool quit;
+	SOCKET wake_send, wake_recv; /* loopback connection, to interrupt select */
+	porthread_t thread;
+	std::string buf; /* receive buffer */
+
+	static void run(void *client);
+	void loop(void);
+	void step(void);
+	void start(http_async_call *c);
+	bool resolved(http_async_call *c,bool fresh);
+	static void resolve(void *arg);
+	const char *connect(http_async_call *c,bool allow_reuse);
+	void connect_or_finish(http_async_call *c);
+	void close(http_async_call *c);
+	void retry_or_fail(http_async_call *c,const char *why);
+	void finish(http_async_call *c,const char *error);
+	void do_send(http_async_call *c);
+	void do_receive(http_async_call *c);
+	http_async_client(const http_async_client &src); /* do not copy */
+	void operator=(const http_async_client &src);
+};
+
+};
+
+#endif
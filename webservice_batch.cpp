@@ -0,0 +1,74 @@
+/**
+ Download a list of URLs over several multiplexed connections.
+*/
+#include "webservice_batch.h"
+#include <deque>
+
+/* Collects finished downloads from the event loop, for the caller's thread */
+class batch_collector {
+public:
+	batch_collector(std::vector<osl::download_result> &results_) :results(results_) {}
+
+	/* Event loop thread: stash this result, and say it's done */
+	void finished(int index,osl::download_result &r) {
+		porlock_scoped l(&lock);
+		osl::download_result &d=results[index];
+		d.status=r.status;
+		d.error=r.error;
+		d.headers.swap(r.headers);
+		d.body.swap(r.body);
+		done.push_back(index);
+		arrived.signal();
+	}
+	/* Caller's thread: wait for the next download to finish, and return its index */
+	int next(void) {
+		porlock_scoped l(&lock);
+		while (done.size()==0) arrived.wait(&lock);
+		int i=done.front();
+		done.pop_front();
+		return i;
+	}
+private:
+	std::vector<osl::download_result> &results;
+	porlock lock; /* protects done */
+	porcond arrived;
+	std::deque<int> done; /* indices of finished downloads, in order */
+};
+
+/* Tells the collector which URL just finished */
+class batch_slot : public osl::download_callback {
+public:
+	batch_collector *collector;
+	int index;
+	void downloaded(osl::download_result &r) {collector->finished(index,r);}
+};
+
+std::vector<osl::download_result> osl::download_urls(const std::vector<std::string> &urls,
+	int max_parallel,int timeout_msec,download_callback *cb,http_connection_pool *pool)
+{
+	std::vector<download_result> results(urls.size());
+	for (unsigned int i=0;i<urls.size();i++) {
+		results[i].url=urls[i];
+		results[i].index=i;
+	}
+	if (max_parallel<1) max_parallel=1;
+	batch_collector collector(results);
+	std::vector<batch_slot> slots(urls.size());
+	http_async_client client(max_parallel,pool); /* destroyed first: it may call slots */
+
+	/* Keep max_parallel requests in flight, so each one's timeout
+	   starts about when its connection does. */
+	unsigned int next=0, done=0;
+	while (done<urls.size()) {
+		while (next<urls.size() && next-done<(unsigned int)max_parallel) {
+			slots[next].collector=&collector;
+			slots[next].index=next;
+			client.get(urls[next],timeout_msec,&slots[next]);
+			next++;
+		}
+		int i=collector.next();
+		done++;
+		if (cb) cb->downloaded(results[i]);
+	}
+	return results;
+}
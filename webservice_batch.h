@@ -0,0 +1,39 @@
+/**
+ Download a whole list of URLs at once, several at a time,
+ so the total time is closer to the slowest single download
+ than to the sum of them all:
+	std::vector<std::string> urls;
+	urls.push_back("http://www.foo.com/a.txt");
+	urls.push_back("http://www.bar.com/b.txt");
+	std::vector<osl::download_result> r=osl::download_urls(urls);
+	for (unsigned int i=0;i<r.size();i++)
+		if (r[i].ok()) use(r[i].body);
+
+ The downloads run on an http_async_client of their own, which
+ multiplexes all the connections with non-blocking sockets and
+ select, reusing keep-alive connections from an http_connection_pool.
+*/
+#ifndef __OSL_WEBSERVICE_BATCH_H
+#define __OSL_WEBSERVICE_BATCH_H
+
+#include "webservice_async.h"
+
+namespace osl {
+
+/**
+ Download all these http:// URLs, with at most max_parallel
+ connections open at once.  Each URL gets timeout_msec milliseconds
+ from when we start on it; failures and timeouts are reported in
+ its result's error string, not by aborting.
+ Results come back in the same order as urls; if cb is nonzero,
+ it also gets each one as it finishes, called from the thread running
+ download_urls, in completion order.  It can take the body with swap,
+ if you don't want it kept for the returned results.
+*/
+OSL_DLL std::vector<download_result> download_urls(const std::vector<std::string> &urls,
+	int max_parallel=8,int timeout_msec=60000,download_callback *cb=0,
+	http_connection_pool *pool=&http_connection_pool::global());
+
+};
+
+#endif
@@ -0,0 +1,270 @@
+/**
+ On-disk HTTP client cache, with conditional revalidation.
+*/
+#include "webservice_cache.h"
+#include "sha2.h"
+#include "mkdir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <io.h>
+#  include <process.h>
+#  define open _open
+#  define close _close
+#  define getpid _getpid
+#  define O_WRONLY (_O_WRONLY|_O_BINARY)
+#else
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
+
+/************* Mapped body **************/
+osl::http_cached_body::http_cached_body()
+	:mapped(0), mapped_size(0)
+{
+#ifdef _WIN32
+	file=mapping=0;
+#endif
+}
+
+bool osl::http_cached_body::map(const std::string &filename)
+{
+	clear();
+#ifdef _WIN32
+	HANDLE f=CreateFileA(filename.c_str(),GENERIC_READ,FILE_SHARE_READ|FILE_SHARE_DELETE,
+		0,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,0);
+	if (f==INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER len;
+	GetFileSizeEx(f,&len);
+	if (len.QuadPart==0) {CloseHandle(f); return true;} /* can't map nothing */
+	HANDLE m=CreateFileMapping(f,0,PAGE_READONLY,0,0,0);
+	void *p=m?MapViewOfFile(m,FILE_MAP_READ,0,0,0):0;
+	if (!p) {
+		if (m) CloseHandle(m);
+		CloseHandle(f);
+		return false;
+	}
+	file=f; mapping=m;
+	mapped=(const char *)p;
+	mapped_size=len.QuadPart;
+#else
+	int fd=open(filename.c_str(),O_RDONLY);
+	if (fd<0) return false;
+	struct stat st;
+	if (0!=fstat(fd,&st)) {close(fd); return false;}
+	if (st.st_size==0) {close(fd); return true;} /* can't map nothing */
+	void *p=mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	close(fd); /* the mapping keeps the file */
+	if (p==MAP_FAILED) return false;
+	mapped=(const char *)p;
+	mapped_size=st.st_size;
+#endif
+	return true;
+}
+
+void osl::http_cached_body::clear(void)
+{
+	if (mapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(mapped);
+		CloseHandle((HANDLE)mapping);
+		CloseHandle((HANDLE)file);
+		file=mapping=0;
+#else
+		munmap((void *)mapped,mapped_size);
+#endif
+	}
+	mapped=0;
+	mapped_size=0;
+	owned="";
+}
+
+
+/************* Cache metadata **************/
+/* What we know about one cached URL */
+struct cache_meta {
+	std::string url, etag, last_modified;
+	long long max_age; /* seconds, or -1 if the server didn't say */
+	long long expires; /* time() the body goes stale */
+	long long length; /* bytes in the body file */
+
+	cache_meta() :max_age(-1), expires(0), length(-1) {}
+	bool read(const std::string &filename);
+	bool write(const std::string &filename) const;
+	/* Pick up validators and freshness from these response headers */
+	bool update(const osl::http_response_decoder &r,long long now);
+};
+
+bool cache_meta::read(const std::string &filename)
+{
+	FILE *f=fopen(filename.c_str(),"r");
+	if (!f) return false;
+	char line[8192];
+	while (fgets(line,sizeof(line),f)) {
+		std::string l=line;
+		while (l.size()>0 && (l[l.size()-1]=='\n' || l[l.size()-1]=='\r')) l.erase(l.size()-1);
+		size_t colon=l.find(": ");
+		if (colon==std::string::npos) continue;
+		std::string k=l.substr(0,colon), v=l.substr(colon+2);
+		if (k=="url") url=v;
+		else if (k=="etag") etag=v;
+		else if (k=="last-modified") last_modified=v;
+		else if (k=="max-age") max_age=atoll(v.c_str());
+		else if (k=="expires") expires=atoll(v.c_str());
+		else if (k=="length") length=atoll(v.c_str());
+	}
+	fclose(f);
+	return url.size()>0 && length>=0;
+}
+
+bool cache_meta::write(const std::string &filename) const
+{
+	FILE *f=fopen(filename.c_str(),"w");
+	if (!f) return false;
+	fprintf(f,"url: %s\n",url.c_str());
+	if (etag.size()>0) fprintf(f,"etag: %s\n",etag.c_str());
+	if (last_modified.size()>0) fprintf(f,"last-modified: %s\n",last_modified.c_str());
+	fprintf(f,"max-age: %lld\nexpires: %lld\nlength: %lld\n",max_age,expires,length);
+	return 0==fclose(f);
+}
+
+/* Return true if this response may be stored */
+bool cache_meta::update(const osl::http_response_decoder &r,long long now)
+{
+	std::string cc=r.get_header("Cache-Control");
+	for (unsigned int i=0;i<cc.size();i++) cc[i]=tolower((unsigned char)cc[i]);
+	if (cc.find("no-store")!=std::string::npos) return false;
+	size_t ma=cc.find("max-age=");
+	if (ma!=std::string::npos) max_age=atoll(cc.c_str()+ma+8);
+	if (cc.find("no-cache")!=std::string::npos) max_age=0; /* store, but always revalidate */
+	long long age=atoll(r.get_header("Age").c_str());
+	expires=now+(max_age>age?max_age-age:0);
+	std::string e=r.get_header("ETag"), lm=r.get_header("Last-Modified");
+	if (e.size()>0) etag=e;
+	if (lm.size()>0) last_modified=lm;
+	return max_age>0 || etag.size()>0 || last_modified.size()>0; /* else it'd never be usable */
+}
+
+/* Move this temporary file over the real one */
+static bool cache_rename(const std::string &from,const std::string &to)
+{
+#ifdef _WIN32
+	::remove(to.c_str()); /* rename won't replace */
+#endif
+	return 0==rename(from.c_str(),to.c_str());
+}
+
+
+/************* Cache **************/
+osl::http_disk_cache::http_disk_cache(const std::string &directory)
+	:dir(directory), hits(0), revalidations(0), misses(0), temp_count(0)
+{
+	osl::mkdir(dir.c_str()); /* fine if it's already there */
+	if (dir.size()>0 && dir[dir.size()-1]!='/') dir+="/";
+}
+
+std::string osl::http_disk_cache::filename(const std::string &url,const char *ext)
+{
+	return dir+SHA256_digest(url).toHex()+ext;
+}
+
+void osl::http_disk_cache::remove(const std::string &url)
+{
+	::remove(filename(url,".meta").c_str());
+	::remove(filename(url,".body").c_str());
+}
+
+int osl::http_disk_cache::fetch(const std::string &url,network_progress &p,http_cached_body &body)
+{
+	std::string meta_file=filename(url,".meta"), body_file=filename(url,".body");
+	long long now=time(0);
+	cache_meta meta;
+	bool have=meta.read(meta_file) && meta.url==url;
+	if (have) { /* check the body's still all there */
+		struct stat st;
+		have=(0==stat(body_file.c_str(),&st) && st.st_size==meta.length);
+	}
+	if (have && now<meta.expires && body.map(body_file)) {
+		p.status(1,"Using cached copy of "+url);
+		porthread_atomic_add(&hits,1);
+		return 200;
+	}
+
+	url_parser u(url);
+	http_connection c(u.host,p,u.port,60,&http_connection_pool::global());
+	std::string path=u.path.size()>0?u.path:"/";
+	char port_str[20];
+	sprintf(port_str,":%d",u.port);
+	std::string req="GET "+path+" HTTP/1.1\r\n"
+		"Host: "+u.host+(u.port!=80?port_str:"")+"\r\n"
+		"User-Agent: Mozilla/5.0 (compatible; OSL web service)\r\n";
+	if (have && meta.etag.size()>0) req+="If-None-Match: "+meta.etag+"\r\n";
+	if (have && meta.last_modified.size()>0) req+="If-Modified-Since: "+meta.last_modified+"\r\n";
+	int status=c.send(req+"\r\n");
+
+	if (status==304 && have) { /* our copy is still good */
+		c.receive(); /* no body, but finish the response */
+		meta.update(c.get_response(),now);
+		char tmp[100];
+		sprintf(tmp,".tmp%d_%lld",(int)getpid(),porthread_atomic_add(&temp_count,1));
+		if (meta.write(meta_file+tmp)) cache_rename(meta_file+tmp,meta_file);
+		if (body.map(body_file)) {
+			p.status(1,"Cached copy of "+url+" is still current");
+			porthread_atomic_add(&revalidations,1);
+			return 200;
+		}
+		/* It vanished under us: ask again, unconditionally */
+		::remove(meta_file.c_str());
+		return fetch(url,p,body);
+	}
+
+	cache_meta fresh;
+	fresh.url=url;
+	porthread_atomic_add(&misses,1);
+	if (status!=200 || !fresh.update(c.get_response(),now)) { /* not cacheable: keep it in memory */
+		body.set(c.receive());
+		return status;
+	}
+
+	/* Stream the body to a temporary file, then move it into place */
+	char tmp[100];
+	sprintf(tmp,".tmp%d_%lld",(int)getpid(),porthread_atomic_add(&temp_count,1));
+	std::string tmp_body=body_file+tmp, tmp_meta=meta_file+tmp;
+	int fd=open(tmp_body.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0666);
+	if (fd<0) { /* can't write the cache: just download it */
+		body.set(c.receive());
+		return status;
+	}
+	http_fd_sink sink(fd);
+	fresh.length=c.receive(sink);
+	bool ok=(0==close(fd)) && c.get_response().done();
+	if (!ok) { /* incomplete download, or the body never made it to disk */
+		::remove(tmp_body.c_str());
+		return 0;
+	}
+	::remove(meta_file.c_str()); /* nobody trusts the old body while we replace it */
+	bool moved=cache_rename(tmp_body,body_file);
+	if (moved && fresh.write(tmp_meta) && cache_rename(tmp_meta,meta_file) && body.map(body_file)) 
+		return status;
+	/* We have the body, but couldn't finish caching it: use it uncached */
+	::remove(tmp_meta.c_str());
+	std::string file=moved?body_file:tmp_body;
+	bool mapped=body.map(file);
+	::remove(file.c_str()); /* with no meta file it's useless to the cache; a mapping outlives it */
+	return mapped?status:0;
+}
+
+std::string osl::download_url(std::string URL,network_progress &p,http_disk_cache *cache)
+{
+	if (!cache) return download_url(URL,p);
+	http_cached_body body;
+	cache->fetch(URL,p,body);
+	return body.str();
+}
@@ -0,0 +1,85 @@
+/**
+ An on-disk cache for HTTP client downloads, so fetching an
+ unchanged resource again costs one small request, or none:
+	osl::http_disk_cache cache("/tmp/my_cache");
+	std::string page=osl::download_url("http://www.foo.com/data.txt",p,&cache);
+
+ Bodies are kept while the server's Cache-Control max-age says
+ they're fresh, and then revalidated with If-None-Match or
+ If-Modified-Since, so a "304 Not Modified" reply reuses our copy.
+ Each URL is stored under the SHA-256 of its name, as a body file
+ plus a small text file of validators.  Fresh hits are mmap'd.
+*/
+#ifndef __OSL_WEBSERVICE_CACHE_H
+#define __OSL_WEBSERVICE_CACHE_H
+
+#include "webservice.h"
+
+namespace osl {
+
+/**
+ A downloaded body: either mapped straight from a cache file,
+ or (for responses we couldn't cache) held in memory.
+*/
+class OSL_DLL http_cached_body {
+public:
+	http_cached_body();
+	~http_cached_body() {clear();}
+
+	const char *data(void) const {return mapped?mapped:owned.data();}
+	long long size(void) const {return mapped?mapped_size:owned.size();}
+	std::string str(void) const {return std::string(data(),(size_t)size());}
+
+	/** Map this file read-only.  Returns false if it can't be opened. */
+	bool map(const std::string &filename);
+	/** Hold this data in memory instead. */
+	void set(const std::string &data) {clear(); owned=data;}
+	void clear(void);
+private:
+	const char *mapped; /* 0 if not mapped */
+	long long mapped_size;
+	std::string owned;
+#ifdef _WIN32
+	void *file, *mapping; /* HANDLEs */
+#endif
+	http_cached_body(const http_cached_body &src); /* do not copy */
+	void operator=(const http_cached_body &src);
+};
+
+/**
+ The cache directory, and the logic to use it.  Thread-safe:
+ updates are written to temporary files and renamed into place.
+*/
+class OSL_DLL http_disk_cache {
+public:
+	/** Cache files go in this directory, which we create if needed. */
+	http_disk_cache(const std::string &directory);
+
+	/** Get this http:// URL, from the cache if we can.  Returns the
+	  HTTP status: 200 for a fresh hit or a revalidated copy, otherwise
+	  whatever the server said.  Only 200 replies are cached. */
+	int fetch(const std::string &url,network_progress &p,http_cached_body &body);
+	/** Forget anything cached for this URL. */
+	void remove(const std::string &url);
+
+	/** Requests answered with no network traffic at all */
+	long long get_hits(void) {return porthread_atomic_load(&hits);}
+	/** Requests answered by a 304 Not Modified */
+	long long get_revalidations(void) {return porthread_atomic_load(&revalidations);}
+	/** Requests that downloaded the whole body */
+	long long get_misses(void) {return porthread_atomic_load(&misses);}
+private:
+	std::string dir;
+	porthread_atomic_t hits, revalidations, misses, temp_count;
+	std::string filename(const std::string &url,const char *ext);
+};
+
+/**
+ Retrieve HTTP content data from this URL, through this cache
+ (if cache is 0, this is the same as the plain download_url).
+*/
+OSL_DLL std::string download_url(std::string URL,network_progress &p,http_disk_cache *cache);
+
+};
+
+#endif
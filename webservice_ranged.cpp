@@ -0,0 +1,326 @@
+/**
+ Download one big file over several connections, by byte ranges.
+*/
+#include "webservice_ranged.h"
+#include "sha2.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <vector>
+
+#ifdef _WIN32
+#  include <io.h>
+#  define open _open
+#  define close _close
+#  define ftruncate _chsize_s
+#  define O_RDWR (_O_RDWR|_O_BINARY)
+#else
+#  include <unistd.h>
+#endif
+
+class ranged_segment;
+
+/* Everything the segment threads share */
+class ranged_state {
+public:
+	skt_ip_t ip;
+	int port;
+	std::string request_start; /* GET line and Host header */
+	int timeout_msec;
+	long long length; /* file length the probe found, or -1 before it's back */
+	std::string validator; /* probe's ETag or Last-Modified, for If-Range */
+	int fd; /* file we're writing */
+	SHA256 *hash; /* 0 if we're not hashing */
+
+	porlock lock; /* protects everything below */
+	std::vector<ranged_segment *> segs; /* in file order */
+	long long hashed; /* bytes at the start of the file that went into hash */
+	bool hashing; /* some thread is adding to hash now */
+
+	ranged_state() :length(-1), fd(-1), hash(0), hashed(0), hashing(false) {}
+	bool write_at(long long offset,const char *data,int len);
+	bool read_at(long long offset,char *data,int len);
+	void hash_prefix(void);
+#ifdef _WIN32
+	porlock file_lock; /* no pwrite: seek and write must stay together */
+#endif
+};
+
+/* One byte range of the file, and the sink its data goes to */
+class ranged_segment : public osl::http_download_sink {
+public:
+	ranged_state *st;
+	long long start, end; /* our bytes are [start,end) */
+	long long done; /* bytes written, from start.  Changes only with st->lock. */
+	bool probe; /* we're finding out the length, and ranges might not work */
+	long long total; /* probe only: file length, or -1 if unknown */
+	int status; /* probe only: HTTP status */
+	const char *error; /* last failure, or 0 */
+	int retries, failures;
+
+	ranged_segment(ranged_state *st_,long long start_,long long end_,int retries_)
+		:st(st_), start(start_), end(end_), done(0), probe(false), total(-1), status(0), error(0), 
+		 retries(retries_), failures(0) {}
+	bool write(const char *data,int len);
+	/* Check the response headers before any data lands.  Returns an error or 0. */
+	const char *check(const osl::http_response_decoder &r,long long from);
+	/* Fetch bytes [from,end) into the file.  Returns an error or 0. */
+	const char *fetch(long long from);
+};
+
+bool ranged_state::write_at(long long offset,const char *data,int len)
+{
+	while (len>0) {
+#ifdef _WIN32
+		int w;
+		{
+			porlock_scoped l(&file_lock);
+			_lseeki64(fd,offset,SEEK_SET);
+			w=_write(fd,data,len);
+		}
+#else
+		ssize_t w=pwrite(fd,data,len,offset);
+		if (w<0 && errno==EINTR) continue;
+#endif
+		if (w<=0) return false;
+		data+=w; len-=w; offset+=w;
+	}
+	return true;
+}
+
+bool ranged_state::read_at(long long offset,char *data,int len)
+{
+	while (len>0) {
+#ifdef _WIN32
+		int r;
+		{
+			porlock_scoped l(&file_lock);
+			_lseeki64(fd,offset,SEEK_SET);
+			r=_read(fd,data,len);
+		}
+#else
+		ssize_t r=pread(fd,data,len,offset);
+		if (r<0 && errno==EINTR) continue;
+#endif
+		if (r<=0) return false;
+		data+=r; len-=r; offset+=r;
+	}
+	return true;
+}
+
+/* Hash any newly contiguous data at the start of the file.
+   Only one thread hashes at a time; the others just move on,
+   and the hashing thread picks up their data on its next pass. */
+void ranged_state::hash_prefix(void)
+{
+	if (!hash) return;
+	std::vector<char> buf;
+	while (true) {
+		long long from, to;
+		{
+			porlock_scoped l(&lock);
+			if (hashing) return;
+			from=hashed;
+			to=from;
+			for (unsigned int i=0;i<segs.size();i++) {
+				ranged_segment *s=segs[i];
+				if (s->start>to) break; /* gap */
+				to=s->start+s->done;
+				if (to<s->end) break; /* this segment's not done */
+			}
+			if (to<=from) return;
+			hashing=true;
+		}
+		/* Read it back: it's fresh in the OS's file cache */
+		buf.resize(1024*1024);
+		bool ok=true;
+		for (long long o=from;ok && o<to;o+=buf.size()) {
+			int n=(int)(to-o<(long long)buf.size()?to-o:buf.size());
+			ok=read_at(o,&buf[0],n);
+			if (ok) hash->add(&buf[0],n);
+		}
+		porlock_scoped l(&lock);
+		hashing=false;
+		if (!ok) return; /* we'll find the file's broken soon enough */
+		hashed=to;
+	}
+}
+
+bool ranged_segment::write(const char *data,int len)
+{
+	long long at=start+done;
+	if (len>end-at) {error="Server sent more data than we asked for"; return false;}
+	if (!st->write_at(at,data,len)) {error="Error writing to file"; return false;}
+	{
+		porlock_scoped l(&st->lock);
+		done+=len;
+	}
+	st->hash_prefix();
+	return true;
+}
+
+/* Parse a Content-Range header, like "bytes 0-499/1234" */
+static bool parse_content_range(const std::string &v,long long &first,long long &last,long long &total)
+{
+	return 3==sscanf(v.c_str(),"bytes %lld-%lld/%lld",&first,&last,&total);
+}
+
+const char *ranged_segment::check(const osl::http_response_decoder &r,long long from)
+{
+	long long first, last;
+	status=r.get_status();
+	if (probe && status==416 && r.get_header("Content-Range")=="bytes */0") {
+		total=0; end=0; /* empty file */
+		return 0;
+	}
+	if (probe && status==200) { /* no ranges: this one connection gets the whole file */
+		if (from>0) return "Server can't resume the download";
+		total=r.get_content_length();
+		end=(total>=0)?total:((1LL<<62)-1);
+		return 0;
+	}
+	if (!probe && status==200 && st->validator.size()>0)
+		return "File changed on the server during the download"; /* If-Range failed */
+	if (status!=206) return "Server did not send the byte range we asked for";
+	if (!parse_content_range(r.get_header("Content-Range"),first,last,total) || first!=from)
+		return "Server sent the wrong byte range";
+	if (probe) {
+		end=last+1; /* just the first byte(s) */
+		std::string etag=r.get_header("ETag");
+		if (etag.size()>0 && etag.compare(0,2,"W/")!=0) st->validator=etag; /* If-Range needs a strong one */
+		else st->validator=r.get_header("Last-Modified");
+	}
+	else if (total!=st->length) /* splicing two versions together would be silent corruption */
+		return "File changed on the server during the download";
+	return 0;
+}
+
+const char *ranged_segment::fetch(long long from)
+{
+	char range[100];
+	sprintf(range,"Range: bytes=%lld-%lld\r\n",from,end-1);
+	std::string req=st->request_start+range;
+	if (!probe && st->validator.size()>0) /* only if it's the same file the probe saw */
+		req+="If-Range: "+st->validator+"\r\n";
+	req+="Connection: close\r\n\r\n";
+	SOCKET s=skt_try_connect(st->ip,st->port,st->timeout_msec);
+	if (s==INVALID_SOCKET) return "Could not connect";
+	error=0;
+	if (0!=skt_try_sendN(s,&req[0],req.size())) error="Error sending HTTP request";
+
+	osl::http_response_decoder r;
+	std::vector<char> buf(64*1024);
+	while (!error && !r.done()) {
+		int n=skt_recv_some(s,&buf[0],buf.size(),st->timeout_msec);
+		if (n<0) {error="Error or timeout receiving data"; break;}
+		if (n==0) {
+			if (!r.finish()) error=r.get_error();
+			break;
+		}
+		int used=0;
+		if (!r.headers_done()) { /* decode headers alone, and check them before writing anything */
+			used=r.feed(&buf[0],n,0);
+			if (used<0) {error=r.get_error(); break;}
+			if (!r.headers_done()) continue;
+			if (0!=(error=check(r,from))) break;
+		}
+		if (used<n && r.feed(&buf[used],n-used,this)<0 && !error) error=r.get_error();
+	}
+	skt_close(s);
+	if (!error && start+done<end && !(probe && status==200 && total<0))
+		error="Connection closed early";
+	return error;
+}
+
+/* Thread: fetch one segment, retrying from where it stopped */
+static void ranged_segment_run(void *ptr)
+{
+	ranged_segment *seg=(ranged_segment *)ptr;
+	while (true) {
+		long long from=seg->start+seg->done;
+		if (from>=seg->end) {seg->error=0; return;}
+		if (0==(seg->error=seg->fetch(from))) return;
+		if (seg->failures++>=seg->retries) return;
+		porthread_yield(100*seg->failures); /* give the server a moment */
+	}
+}
+
+osl::ranged_download::ranged_download(const std::string &url_,network_progress &p_)
+	:url(url_), p(p_), segments(4), retries(3), timeout_msec(60000), length(-1) {}
+
+bool osl::ranged_download::save(const std::string &filename)
+{
+	error=sha256="";
+	length=-1;
+	url_parser u(url);
+	ranged_state st;
+	st.port=u.port;
+	st.timeout_msec=timeout_msec;
+	std::string path=u.path.size()>0?u.path:"/";
+	char port_str[20];
+	sprintf(port_str,":%d",u.port);
+	st.request_start="GET "+path+" HTTP/1.1\r\n"
+		"Host: "+u.host+(u.port!=80?port_str:"")+"\r\n"
+		"User-Agent: Mozilla/5.0 (compatible; OSL web service)\r\n";
+	p.status(1,"Looking up IP address for "+u.host);
+	st.ip=skt_lookup_invalid(u.host.c_str());
+	if (skt_ip_match(st.ip,_skt_invalid_ip)) {error="Invalid domain name "+u.host; return false;}
+	st.fd=open(filename.c_str(),O_RDWR|O_CREAT|O_TRUNC,0666);
+	if (st.fd<0) {error="Could not create file "+filename; return false;}
+	SHA256 hash;
+	if (expected_sha256.size()>0) st.hash=&hash;
+
+	/* Ask for the first byte: the reply tells us the length, and if ranges work */
+	p.status(1,"Finding length of "+url);
+	ranged_segment probe(&st,0,1,retries);
+	probe.probe=true;
+	st.segs.push_back(&probe);
+	ranged_segment_run(&probe);
+	std::vector<ranged_segment *> segs;
+	if (probe.error) error=probe.error;
+	else if (probe.status==200) { /* whole file came on one connection */
+		p.status(1,"Server doesn't support byte ranges; downloaded on one connection");
+		length=probe.done;
+	}
+	else {
+		length=st.length=probe.total;
+		if (0!=ftruncate(st.fd,length)) {error="Could not allocate space for "+filename;}
+		/* Split up the rest, but not into silly little pieces */
+		long long rest=length-1, min_size=256*1024;
+		long long n=segments;
+		if (n>(rest+min_size-1)/min_size) n=(rest+min_size-1)/min_size;
+		std::vector<porthread_t> threads;
+		for (long long i=0;error.size()==0 && i<n;i++) {
+			segs.push_back(new ranged_segment(&st,1+rest*i/n,1+rest*(i+1)/n,retries));
+		}
+		{
+			porlock_scoped l(&st.lock);
+			for (unsigned int i=0;i<segs.size();i++) st.segs.push_back(segs[i]);
+		}
+		char msg[100];
+		sprintf(msg," in %d segments",(int)segs.size());
+		p.status(1,"Downloading "+url+msg);
+		for (unsigned int i=0;i<segs.size();i++) threads.push_back(porthread_create(ranged_segment_run,segs[i]));
+		for (unsigned int i=0;i<threads.size();i++) porthread_wait(threads[i]);
+		for (unsigned int i=0;i<segs.size();i++) {
+			if (segs[i]->failures>0) {
+				sprintf(msg,"Segment %d needed %d retries",i,segs[i]->failures);
+				p.status(2,msg);
+			}
+			if (segs[i]->error && error.size()==0) error=segs[i]->error;
+		}
+	}
+
+	if (error.size()==0 && st.hash) {
+		st.hash_prefix(); /* all done: hashes everything left */
+		if (st.hashed!=length) error="Could not read back file to hash it";
+		else {
+			sha256=hash.finish().toHex();
+			if (sha256!=expected_sha256) error="SHA-256 mismatch: expected "+expected_sha256+" but got "+sha256;
+		}
+	}
+	close(st.fd);
+	for (unsigned int i=0;i<segs.size();i++) delete segs[i];
+	return error.size()==0;
+}
@@ -0,0 +1,56 @@
+/**
+ Download one big file over several connections at once, each
+ fetching its own byte range, for when a single connection
+ can't keep up with the network:
+	osl::network_progress p;
+	osl::ranged_download d("http://www.foo.com/big.iso",p);
+	d.set_segments(8);
+	d.set_sha256("9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08");
+	if (!d.save("big.iso")) printf("Download failed: %s\n",d.get_error().c_str());
+
+ If the server doesn't support byte ranges, we fall back to
+ one connection.  A segment that fails is retried from where
+ it stopped, without disturbing the others.
+*/
+#ifndef __OSL_WEBSERVICE_RANGED_H
+#define __OSL_WEBSERVICE_RANGED_H
+
+#include "webservice.h"
+
+namespace osl {
+
+class OSL_DLL ranged_download {
+public:
+	ranged_download(const std::string &url,network_progress &p);
+
+	/** Fetch this many byte ranges at once (default 4). */
+	void set_segments(int n) {segments=n<1?1:n;}
+	/** Retry a failed segment this many times (default 3). */
+	void set_retries(int n) {retries=n;}
+	/** Give up on a connection if it's idle this long (default 60 seconds). */
+	void set_timeout(int msec) {timeout_msec=msec;}
+	/** Check the downloaded file has this SHA-256 digest, in hex.
+	  The hash is computed as the data lands, so there's no second pass. */
+	void set_sha256(const std::string &hex) {expected_sha256=hex;}
+
+	/** Download into this file, creating or replacing it.
+	  Returns true if the whole file arrived (and matched the SHA-256). */
+	bool save(const std::string &filename);
+
+	/** Return the file's length, once save has found it out. */
+	long long get_length(void) const {return length;}
+	/** Return the SHA-256 we computed, in hex, if set_sha256 was called. */
+	const std::string &get_sha256(void) const {return sha256;}
+	/** Return what went wrong, or empty string if nothing. */
+	const std::string &get_error(void) const {return error;}
+private:
+	std::string url;
+	network_progress &p;
+	int segments, retries, timeout_msec;
+	std::string expected_sha256, sha256, error;
+	long long length;
+};
+
+};
+
+#endif